@@ -0,0 +1,32 @@
+#include <stdio.h>
+
+#include "arbiter.h"
+
+void arbiter_init(struct Arbiter *arbiter) {
+    arbiter->first = 0;
+    for (int i = 0; i < NB_PLAYERS; i++) {
+        histogram_init(&arbiter->delay[i]);
+    }
+}
+
+int arbiter_player(const struct Arbiter *arbiter, int k) {
+    return (arbiter->first + k) % NB_PLAYERS;
+}
+
+void arbiter_next_round(struct Arbiter *arbiter, int served) {
+    if (served == NB_PLAYERS) {
+        arbiter->first = (arbiter->first + 1) % NB_PLAYERS;
+    }
+}
+
+void arbiter_record(struct Arbiter *arbiter, int player, uint64_t received_ns, uint64_t applied_ns) {
+    histogram_record(&arbiter->delay[player], applied_ns > received_ns ? applied_ns - received_ns : 0);
+}
+
+void arbiter_print(const char *who, const struct Arbiter *arbiter) {
+    for (int i = 0; i < NB_PLAYERS; i++) {
+        char label[64];
+        snprintf(label, sizeof(label), "%s, queueing delay of player %d", who, i + 1);
+        histogram_print(label, &arbiter->delay[i]);
+    }
+}
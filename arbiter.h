@@ -0,0 +1,38 @@
+#ifndef __ARBITER__
+#define __ARBITER__
+
+#include <stdint.h>
+
+#include "game.h"
+#include "histogram.h"
+
+// Decides in which order the players are served when both of them have a
+// command waiting, whoever's command arrived (or whoever's process woke up)
+// first. Commands are applied in rounds, one command per player at most:
+// each round in which both players are served hands the first place to the
+// player who was second.
+//
+// It also measures how long each player's commands wait between the moment
+// they are received and the moment they are applied.
+struct Arbiter {
+    // The player served first in the next round (0 or 1)
+    int first;
+    struct Histogram delay[NB_PLAYERS];
+};
+
+void arbiter_init(struct Arbiter *arbiter);
+
+// The player (0 or 1) served at place 'k' of the current round.
+int arbiter_player(const struct Arbiter *arbiter, int k);
+
+// Ends the current round, in which 'served' players were served.
+void arbiter_next_round(struct Arbiter *arbiter, int served);
+
+// A command of 'player' received at 'received_ns' (see now_ns) is applied
+// at 'applied_ns'.
+void arbiter_record(struct Arbiter *arbiter, int player, uint64_t received_ns, uint64_t applied_ns);
+
+// Prints the queueing delay of each player, prefixed by 'who'.
+void arbiter_print(const char *who, const struct Arbiter *arbiter);
+
+#endif //__ARBITER__
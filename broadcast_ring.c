@@ -0,0 +1,82 @@
+#include "broadcast_ring.h"
+
+void broadcast_init(struct BroadcastRing *ring) {
+    atomic_init(&ring->head, 0);
+    for (int i = 0; i < BROADCAST_MAX_READERS; i++) {
+        atomic_init(&ring->sleeping[i], false);
+        atomic_init(&ring->acked[i], 0);
+    }
+}
+
+void broadcast_publish(struct BroadcastRing *ring, const union Message *msgs, size_t count, uint64_t input_ns) {
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    for (size_t i = 0; i < count; i++) {
+        ring->msgs[(head + i) % BROADCAST_RING_SIZE]     = msgs[i];
+        ring->input_ns[(head + i) % BROADCAST_RING_SIZE] = i == 0 ? input_ns : 0;
+    }
+    // Readers see the messages once they see the new head
+    atomic_store_explicit(&ring->head, head + count, memory_order_seq_cst);
+}
+
+bool broadcast_wake(struct BroadcastRing *ring, int reader) {
+    return atomic_exchange(&ring->sleeping[reader], false);
+}
+
+ssize_t broadcast_peek(struct BroadcastRing *ring, uint64_t cursor, struct iovec iov[2], int *iovcnt) {
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (head - cursor > BROADCAST_RING_SIZE) {
+        return -1;
+    }
+
+    size_t count = head - cursor;
+    size_t start = cursor % BROADCAST_RING_SIZE;
+    size_t first = count < BROADCAST_RING_SIZE - start ? count : BROADCAST_RING_SIZE - start;
+    *iovcnt = 0;
+    if (first > 0) {
+        iov[*iovcnt].iov_base = &ring->msgs[start];
+        iov[*iovcnt].iov_len  = first * sizeof(union Message);
+        (*iovcnt)++;
+    }
+    if (count > first) {
+        iov[*iovcnt].iov_base = &ring->msgs[0];
+        iov[*iovcnt].iov_len  = (count - first) * sizeof(union Message);
+        (*iovcnt)++;
+    }
+    return count;
+}
+
+uint64_t broadcast_input_ns(struct BroadcastRing *ring, uint64_t cursor, size_t count) {
+    uint64_t oldest = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t input_ns = ring->input_ns[(cursor + i) % BROADCAST_RING_SIZE];
+        if (input_ns != 0 && (oldest == 0 || input_ns < oldest)) {
+            oldest = input_ns;
+        }
+    }
+    return oldest;
+}
+
+bool broadcast_overrun(struct BroadcastRing *ring, uint64_t cursor) {
+    // The messages have been read before the head is loaded again
+    atomic_thread_fence(memory_order_acquire);
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    return head - cursor > BROADCAST_RING_SIZE;
+}
+
+void broadcast_ack(struct BroadcastRing *ring, int reader, uint64_t cursor) {
+    atomic_store(&ring->acked[reader], cursor);
+}
+
+bool broadcast_fits(struct BroadcastRing *ring, int reader, size_t count) {
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    return head + count - atomic_load(&ring->acked[reader]) <= BROADCAST_RING_SIZE;
+}
+
+bool broadcast_sleep(struct BroadcastRing *ring, int reader, uint64_t cursor) {
+    atomic_store(&ring->sleeping[reader], true);
+    if (atomic_load(&ring->head) != cursor) {
+        atomic_store(&ring->sleeping[reader], false);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,87 @@
+#ifndef __BROADCAST_RING__
+#define __BROADCAST_RING__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "pascman.h"
+
+// Number of messages a ring holds (must be a power of two). A chunk of a
+// map (see SNAPSHOT_CHUNK_TILES) must fit in it, with room to spare.
+#define BROADCAST_RING_SIZE 4096
+// Maximum number of readers of a ring
+#define BROADCAST_MAX_READERS 8
+
+// A single-producer / multi-consumer ring of messages. It holds no pointer
+// and needs no lock, so it can live in shared memory: the producer writes
+// each message once, and every reader hands it from there to the kernel at
+// its own pace, keeping its own cursor (the sequence number of the next
+// message to read).
+//
+// The producer never waits for the readers while a game is played. A reader
+// which lags more than BROADCAST_RING_SIZE messages behind has lost
+// messages, and is told so. Only a burst larger than the ring (the map of a
+// large game) is published once the readers acknowledged enough of it.
+//
+// Readers which have nothing to read may sleep (on an eventfd, a pipe...):
+// each of them raises its flag before going to sleep, and the producer
+// tells which ones have to be woken up once it has published.
+struct BroadcastRing {
+    // Sequence number of the next message to be published
+    _Alignas(64) _Atomic uint64_t head;
+    // Which readers are (about to be) sleeping
+    _Alignas(64) _Atomic bool sleeping[BROADCAST_MAX_READERS];
+    // Sequence number of the first message each reader did not forward yet
+    _Alignas(64) _Atomic uint64_t acked[BROADCAST_MAX_READERS];
+    _Alignas(64) union Message msgs[BROADCAST_RING_SIZE];
+    // When the oldest command behind each published batch was received
+    // (see now_ns), stored with the first message of the batch. 0 for the
+    // other messages, and for batches which answer no command.
+    uint64_t input_ns[BROADCAST_RING_SIZE];
+};
+
+// Empties the ring. Must be done before the producer and the readers start.
+void broadcast_init(struct BroadcastRing *ring);
+
+// Publishes 'count' messages at once, produced by commands received at
+// 'input_ns' at the earliest (0 if they answer no command). Producer side
+// only.
+void broadcast_publish(struct BroadcastRing *ring, const union Message *msgs, size_t count, uint64_t input_ns);
+
+// Clears the flag of the reader and returns true if it was sleeping, in
+// which case the producer must wake it up. Producer side only.
+bool broadcast_wake(struct BroadcastRing *ring, int reader);
+
+// Describes the messages published past 'cursor' with (at most two, as they
+// may wrap around the end of the ring) iovecs, ready for writev/sendmsg.
+// Returns the number of messages, or -1 if the reader lagged so much behind
+// that some of them have been overwritten already.
+ssize_t broadcast_peek(struct BroadcastRing *ring, uint64_t cursor, struct iovec iov[2], int *iovcnt);
+
+// When the oldest command behind the 'count' messages published past
+// 'cursor' was received, 0 if they answer no command. Like the messages,
+// it must be checked with broadcast_overrun once used.
+uint64_t broadcast_input_ns(struct BroadcastRing *ring, uint64_t cursor, size_t count);
+
+// Has anything past 'cursor' been overwritten ? Must be checked once the
+// messages described by broadcast_peek have been written: if it is the
+// case, what has been written may be garbage.
+bool broadcast_overrun(struct BroadcastRing *ring, uint64_t cursor);
+
+// Tells the producer that the reader forwarded every message before
+// 'cursor'. Reader side only.
+void broadcast_ack(struct BroadcastRing *ring, int reader, uint64_t cursor);
+
+// Can 'count' more messages be published without overwriting any that the
+// reader did not acknowledge yet ? Producer side only.
+bool broadcast_fits(struct BroadcastRing *ring, int reader, size_t count);
+
+// Raises the flag of the reader before it goes to sleep. Returns false (and
+// clears the flag) if something has been published past 'cursor' meanwhile,
+// in which case the reader must not sleep.
+bool broadcast_sleep(struct BroadcastRing *ring, int reader, uint64_t cursor);
+
+#endif //__BROADCAST_RING__
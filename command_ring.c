@@ -0,0 +1,37 @@
+#include "command_ring.h"
+
+void ring_init(struct CommandRing *ring) {
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+}
+
+bool ring_push(struct CommandRing *ring, enum Direction dir, uint64_t received_ns) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (tail - head == COMMAND_RING_SIZE) {
+        return false;
+    }
+    ring->cmds[tail % COMMAND_RING_SIZE].dir         = dir;
+    ring->cmds[tail % COMMAND_RING_SIZE].received_ns = received_ns;
+    // Publishes the command: the consumer sees it once it sees the new tail
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_seq_cst);
+    return true;
+}
+
+bool ring_pop(struct CommandRing *ring, enum Direction *dir, uint64_t *received_ns) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head == tail) {
+        return false;
+    }
+    *dir         = ring->cmds[head % COMMAND_RING_SIZE].dir;
+    *received_ns = ring->cmds[head % COMMAND_RING_SIZE].received_ns;
+    // Gives the slot back to the producer
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return true;
+}
+
+bool ring_empty(struct CommandRing *ring) {
+    return atomic_load_explicit(&ring->head, memory_order_relaxed)
+        == atomic_load_explicit(&ring->tail, memory_order_seq_cst);
+}
@@ -0,0 +1,46 @@
+#ifndef __COMMAND_RING__
+#define __COMMAND_RING__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "game.h"
+
+// Number of commands a ring holds (must be a power of two)
+#define COMMAND_RING_SIZE 256
+
+// A direction, and when it was received from the player (see now_ns)
+struct RingCommand {
+    enum Direction dir;
+    uint64_t received_ns;
+};
+
+// A single-producer / single-consumer queue of directions. It holds no
+// pointer and needs no lock, so it can live in shared memory and be used
+// between two processes (or two threads) without any syscall: the producer
+// only ever writes 'tail', the consumer only ever writes 'head'.
+//
+// Each index is kept on its own cache line so that the producer and the
+// consumer do not keep stealing the line from each other.
+struct CommandRing {
+    _Alignas(64) _Atomic uint32_t head;
+    _Alignas(64) _Atomic uint32_t tail;
+    _Alignas(64) struct RingCommand cmds[COMMAND_RING_SIZE];
+};
+
+// Empties the ring. Must be done before the producer and the consumer start.
+void ring_init(struct CommandRing *ring);
+
+// Appends a direction, received at 'received_ns', to the ring. Returns
+// false if the ring is full. Producer side only.
+bool ring_push(struct CommandRing *ring, enum Direction dir, uint64_t received_ns);
+
+// Takes the oldest direction of the ring, and when it was received. Returns
+// false if the ring is empty. Consumer side only.
+bool ring_pop(struct CommandRing *ring, enum Direction *dir, uint64_t *received_ns);
+
+// Is there nothing to pop ?
+bool ring_empty(struct CommandRing *ring);
+
+#endif //__COMMAND_RING__
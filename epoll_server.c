@@ -0,0 +1,1484 @@
+#include "utils_v3.h"
+#include "game.h"
+#include "pascman.h"
+#include "server.h"
+#include "room.h"
+#include "worker_pool.h"
+#include "protocol_v2.h"
+#include "framing.h"
+#include "rate_limit.h"
+#include "socket_tuning.h"
+#include "metrics.h"
+#include "trace.h"
+#include "spectators.h"
+#include "event_fds.h"
+#include "epoll_server.h"
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/random.h>
+
+#define MAX_EVENTS 64
+#define TOKEN_LISTENER UINT64_MAX
+#define TOKEN_POOL (UINT64_MAX - 1)
+#define TOKEN_SPECTATORS (UINT64_MAX - 2)
+#define TOKEN_SIGNALS (UINT64_MAX - 3)
+#define TOKEN_TIMER (UINT64_MAX - 4)
+#define TOKEN_HANDOVER (UINT64_MAX - 5)
+
+// A connected player (or spectator), as seen by the event loop
+struct Conn {
+    FileDescriptor fd;
+    // The room this player is seated in, and its index in that room
+    struct Room *room;
+    int player;
+    // Spectators have no seat: they pick the room they watch, and share the
+    // batches of that room with its other spectators. 'watching' is set
+    // once they got the snapshot of the game they joined.
+    bool spectator;
+    bool watching;
+    struct SpectatorQueue view;
+    // What the player sent and has not been handled yet
+    struct InputBuffer in;
+    // How many commands per second the player may send
+    struct InputLimiter limiter;
+    // Bytes that could not be written yet because the socket was full
+    char *out;
+    size_t out_len;
+    size_t out_cap;
+    // When the oldest command answered by the pending output was received,
+    // and how many of its bytes have to leave before it counts as answered
+    // (0 if no answer is pending)
+    uint64_t mark_ns;
+    size_t mark_end;
+    // Messages queued since the output was last empty
+    size_t queued;
+    // Is EPOLLOUT currently part of the events we wait for on 'fd' ?
+    bool want_out;
+    // Has the player acknowledged GAME_OVER ?
+    bool acked;
+    // Is the player back in a game it lost its connection to, waiting for
+    // the snapshot of that game ?
+    bool resuming;
+    // When a player accepted while a seat was held is seated as a new one,
+    // unless it asked for that seat by then (see seat_unseated)
+    struct timespec seat_at;
+    // Is the connection in the list of those to flush ?
+    bool dirty;
+    // The version of the protocol the player speaks, and what the encoder
+    // remembers of the messages sent so far in version 2
+    int version;
+    struct V2Codec codec;
+};
+
+struct EpollServer {
+    const struct ServerConfig *config;
+    FileDescriptor epfd;
+    FileDescriptor sockfd;
+    // SIGINT, SIGCHLD and SIGHUP, read along with the sockets
+    FileDescriptor signal_fd;
+    // Where the outcome of a hand-over in progress is read from, -1 if
+    // there is none
+    FileDescriptor handover_fd;
+    // Expires at the earliest deadline of every room, 'armed' if it is set
+    // to 'armed_at'
+    FileDescriptor timer;
+    bool armed;
+    struct timespec armed_at;
+    // Is the listening socket currently part of the epoll set ?
+    bool listening;
+    // The socket spectators connect to, -1 if there is none, and is it
+    // currently part of the epoll set ?
+    FileDescriptor spectator_fd;
+    bool spectating;
+    // Connections, indexed by their slot (which is also their epoll token)
+    struct Conn **conns;
+    size_t conn_cap;
+    // Every room that currently exists (waiting, playing or closing)
+    struct Room **rooms;
+    size_t room_count;
+    size_t room_cap;
+    // The room new connections are seated in, NULL if there is none yet
+    struct Room *waiting;
+    // Players accepted while a seat was held, who are not seated yet (see
+    // seat_unseated)
+    size_t unseated;
+    // Rooms are numbered with a stride of the number of workers, each
+    // worker from its own index: no two rooms of the server share an id
+    uint32_t next_room_id;
+    uint32_t room_id_step;
+    // Workers running the rooms, NULL if they are run by the event loop,
+    // and their counters as last added to the metrics
+    struct WorkerPool *pool;
+    struct WorkerStats *published;
+    // Rooms which received commands during the current loop iteration
+    struct Room **ready;
+    size_t ready_len;
+    size_t ready_cap;
+    // Connections with some output queued during the current loop iteration
+    int *dirty;
+    size_t dirty_len;
+    size_t dirty_cap;
+    // Is any player's command held over its rate limit ?
+    bool held;
+    // Queueing delay of the players of every room closed so far
+    struct Arbiter delays;
+    // Input to broadcast latency of every room closed so far
+    struct Histogram latency;
+    struct FlushStats stats;
+    struct InputStats input;
+};
+
+static void set_nonblocking(FileDescriptor fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    checkNeg(flags, "fcntl F_GETFL");
+    checkNeg(fcntl(fd, F_SETFL, flags | O_NONBLOCK), "fcntl F_SETFL");
+}
+
+static void ep_ctl(struct EpollServer *srv, int op, FileDescriptor fd, uint32_t events, uint64_t token) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events   = events;
+    ev.data.u64 = token;
+    checkNeg(epoll_ctl(srv->epfd, op, fd, &ev), "epoll_ctl");
+}
+
+// Number of milliseconds before 'deadline' (never negative). It is rounded
+// up so that the loop never wakes up just before a deadline.
+static int ms_until(const struct timespec *deadline) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long ns = (deadline->tv_sec - now.tv_sec) * 1000000000L + (deadline->tv_nsec - now.tv_nsec);
+    long ms = ns > 0 ? (ns + 999999) / 1000000 : 0;
+    return ms < 0 ? 0 : (int) ms;
+}
+
+//#############################################################################
+// CONNECTIONS
+//#############################################################################
+
+// Makes room for 'len' more bytes of output, and returns where they go
+static char *conn_reserve(struct Conn *conn, size_t len) {
+    if (conn->out_len + len > conn->out_cap) {
+        size_t cap = conn->out_cap == 0 ? 4096 : conn->out_cap;
+        while (cap < conn->out_len + len) {
+            cap *= 2;
+        }
+        conn->out = realloc(conn->out, cap);
+        checkNull(conn->out, "realloc connection buffer");
+        conn->out_cap = cap;
+    }
+    return conn->out + conn->out_len;
+}
+
+// The connection will be flushed at the end of the loop iteration
+static void conn_mark_dirty(struct EpollServer *srv, int slot) {
+    struct Conn *conn = srv->conns[slot];
+    if (conn->dirty) {
+        return;
+    }
+    if (srv->dirty_len == srv->dirty_cap) {
+        srv->dirty_cap = srv->dirty_cap == 0 ? 64 : 2 * srv->dirty_cap;
+        srv->dirty     = realloc(srv->dirty, srv->dirty_cap * sizeof(int));
+        checkNull(srv->dirty, "realloc dirty connections");
+    }
+    srv->dirty[srv->dirty_len++] = slot;
+    conn->dirty = true;
+}
+
+// Queues messages for the connection, in the version of the protocol it
+// speaks. They are flushed at the end of the current loop iteration (see
+// flush_pending).
+static void conn_push(struct EpollServer *srv, int slot, const union Message *msgs, size_t count) {
+    struct Conn *conn = srv->conns[slot];
+    if (conn->version == PROTOCOL_V2) {
+        // Each chunk of a large map travels in a batch of its own, which the
+        // client applies as soon as it has it
+        for (size_t start = 0; start < count;) {
+            size_t chunk   = snapshot_chunk_len(msgs + start, count - start);
+            uint8_t *batch = (uint8_t *) conn_reserve(conn, V2_MAX_SIZE(chunk));
+            size_t len     = metrics_out_v2(&conn->codec, msgs + start, chunk, batch + V2_BATCH_HEADER);
+            v2_batch_header(batch, len);
+            conn->out_len += V2_BATCH_HEADER + len;
+            start         += chunk;
+        }
+    } else {
+        size_t tiles_left = 0;
+        metrics_out_v1(msgs, count, &tiles_left);
+        memcpy(conn_reserve(conn, count * sizeof(union Message)), msgs, count * sizeof(union Message));
+        conn->out_len += count * sizeof(union Message);
+    }
+    conn->queued += count;
+    metrics_gauge(&metrics->queue_depth, count);
+    conn_mark_dirty(srv, slot);
+}
+
+// Writes as many bytes as the socket accepts without blocking.
+// Returns the number of bytes written, or -1 if the peer is gone.
+static ssize_t conn_send(struct EpollServer *srv, FileDescriptor fd, const void *buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = send(fd, (const char *) buf + done, len - done, MSG_NOSIGNAL);
+        srv->stats.syscalls++;
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        done += n;
+    }
+    srv->stats.bytes += done;
+    return done;
+}
+
+static int conn_add(struct EpollServer *srv, FileDescriptor fd) {
+    size_t slot = 0;
+    while (slot < srv->conn_cap && srv->conns[slot] != NULL) {
+        slot++;
+    }
+    if (slot == srv->conn_cap) {
+        size_t cap = srv->conn_cap == 0 ? 64 : 2 * srv->conn_cap;
+        srv->conns = realloc(srv->conns, cap * sizeof(struct Conn *));
+        checkNull(srv->conns, "realloc connections");
+        memset(srv->conns + srv->conn_cap, 0, (cap - srv->conn_cap) * sizeof(struct Conn *));
+        srv->conn_cap = cap;
+    }
+
+    struct Conn *conn = smalloc(sizeof(struct Conn));
+    memset(conn, 0, sizeof(struct Conn));
+    conn->fd      = fd;
+    conn->version = PROTOCOL_V1;
+    input_init(&conn->in);
+    limiter_init(&conn->limiter, srv->config->rate_limit);
+    srv->conns[slot] = conn;
+    ep_ctl(srv, EPOLL_CTL_ADD, fd, EPOLLIN, slot);
+    return slot;
+}
+
+// The player asked for version 2 of the protocol: whatever is queued after
+// the PROTOCOL message that announces it is encoded in that version
+static void conn_upgrade(struct EpollServer *srv, int slot) {
+    struct Conn *conn = srv->conns[slot];
+    if (conn->version == PROTOCOL_V2) {
+        return;
+    }
+    union Message msg = { .protocol = { .msgt = PROTOCOL, .version = PROTOCOL_V2 } };
+    conn_push(srv, slot, &msg, 1);
+    conn->version = PROTOCOL_V2;
+    v2_init(&conn->codec);
+}
+
+// Closes the connection and removes the player (or spectator) from its room
+static void conn_drop(struct EpollServer *srv, int slot) {
+    struct Conn *conn = srv->conns[slot];
+    if (conn == NULL) {
+        return;
+    }
+    if (conn->spectator) {
+        if (conn->room != NULL) {
+            room_remove_spectator(conn->room, slot);
+        }
+        spectator_queue_free(&conn->view);
+        metrics_gauge(&metrics->spectators_open, -1);
+    } else if (conn->room != NULL) {
+        room_remove_player(conn->room, conn->player);
+    } else {
+        srv->unseated--;
+    }
+    metrics_gauge(&metrics->queue_depth, -(int64_t) conn->queued);
+    metrics_gauge(&metrics->connections_open, -1);
+    limiter_close(&conn->limiter);
+    srv->input.accepted  += conn->limiter.accepted;
+    srv->input.coalesced += conn->limiter.coalesced;
+    ep_ctl(srv, EPOLL_CTL_DEL, conn->fd, 0, slot);
+    sclose(conn->fd);
+    input_free(&conn->in);
+    free(conn->out);
+    free(conn);
+    srv->conns[slot] = NULL;
+}
+
+// (Un)subscribes to EPOLLOUT, depending on whether some output is pending
+static void conn_want_out(struct EpollServer *srv, int slot, bool want_out) {
+    struct Conn *conn = srv->conns[slot];
+    if (want_out != conn->want_out) {
+        ep_ctl(srv, EPOLL_CTL_MOD, conn->fd, EPOLLIN | (want_out ? EPOLLOUT : 0), slot);
+        conn->want_out = want_out;
+    }
+}
+
+// The player lost its connection. If players may resume, its seat is held
+// and the game paused until it comes back (see player_resume).
+static void conn_lose(struct EpollServer *srv, int slot) {
+    struct Conn *conn = srv->conns[slot];
+    struct Room *room = conn->room;
+    int player        = conn->player;
+    conn_drop(srv, slot);
+    if (room != NULL && room->phase == ROOM_PLAYING && srv->config->grace > 0) {
+        room_hold_seat(room, player, srv->config->grace);
+        printf("Room %u: seat of player %d held for %d seconds, game paused\n", room->id, player + 1, srv->config->grace);
+    }
+}
+
+// Tries to empty the pending output of the connection, and (un)subscribes
+// to EPOLLOUT accordingly. Returns false if the connection had to be dropped.
+static bool conn_flush(struct EpollServer *srv, int slot) {
+    struct Conn *conn = srv->conns[slot];
+    if (conn->out_len > 0) {
+        srv->stats.flushes++;
+        uint64_t start = trace_begin();
+        ssize_t n      = conn_send(srv, conn->fd, conn->out, conn->out_len);
+        trace_end("conn_send", start);
+        if (n < 0 && conn->room == NULL) {
+            printf("A player disconnected while sending, before being seated\n");
+            conn_drop(srv, slot);
+            return false;
+        }
+        if (n < 0) {
+            printf("Room %u: player %d disconnected while sending\n", conn->room->id, conn->player + 1);
+            conn_lose(srv, slot);
+            return false;
+        }
+        memmove(conn->out, conn->out + n, conn->out_len - n);
+        conn->out_len -= n;
+        if (conn->mark_ns != 0 && (size_t) n >= conn->mark_end) {
+            histogram_record(&conn->room->latency, now_ns() - conn->mark_ns);
+            conn->mark_ns = 0;
+        } else if (conn->mark_ns != 0) {
+            conn->mark_end -= n;
+        }
+        if (conn->out_len == 0) {
+            metrics_gauge(&metrics->queue_depth, -(int64_t) conn->queued);
+            conn->queued = 0;
+        }
+    }
+
+    conn_want_out(srv, slot, conn->out_len > 0);
+    return true;
+}
+
+// Sends a spectator as much of its queue as its socket accepts. Returns
+// false if it had to be dropped.
+static bool spectator_flush(struct EpollServer *srv, int slot) {
+    struct Conn *conn = srv->conns[slot];
+    ssize_t n = spectator_queue_send(&conn->view, conn->fd);
+    if (n < 0) {
+        printf("Room %u: a spectator disconnected while sending\n", conn->room != NULL ? conn->room->id : 0);
+        conn_drop(srv, slot);
+        return false;
+    }
+    metrics_count(&metrics->spectator_bytes_out, n);
+    conn_want_out(srv, slot, conn->view.len > 0);
+    return true;
+}
+
+//#############################################################################
+// ROOMS
+//#############################################################################
+
+// The global phase summarizes the state of every room. It is what the
+// SIGINT handler looks at to decide whether the server may stop right away.
+static void update_phase(struct EpollServer *srv) {
+    if (srv->room_count == 0) {
+        set_phase(PHASE_IDLE);
+    } else if (srv->room_count == 1 && srv->waiting != NULL) {
+        set_phase(PHASE_REGISTRATION);
+    } else {
+        set_phase(PHASE_GAME);
+    }
+}
+
+// The listening socket is only watched while new players can be seated, the
+// one of the spectators until the server shuts down
+static void update_listening(struct EpollServer *srv) {
+    bool listening = !shutdown_requested
+        && (srv->waiting != NULL || srv->room_count < (size_t) srv->config->max_rooms);
+    if (srv->listening == listening) {
+        return;
+    }
+    if (listening) {
+        ep_ctl(srv, EPOLL_CTL_ADD, srv->sockfd, EPOLLIN, TOKEN_LISTENER);
+    } else {
+        ep_ctl(srv, EPOLL_CTL_DEL, srv->sockfd, 0, TOKEN_LISTENER);
+    }
+    srv->listening = listening;
+
+    bool spectating = !shutdown_requested && srv->spectator_fd != -1;
+    if (srv->spectating != spectating) {
+        ep_ctl(srv, spectating ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, srv->spectator_fd, EPOLLIN, TOKEN_SPECTATORS);
+        srv->spectating = spectating;
+    }
+}
+
+// Runs a room on behalf of the pool
+static void room_task(struct PoolTask *task) {
+    room_step(task->arg);
+}
+
+static struct Room *room_open(struct EpollServer *srv) {
+    if (srv->room_count == srv->room_cap) {
+        srv->room_cap = srv->room_cap == 0 ? 16 : 2 * srv->room_cap;
+        srv->rooms    = realloc(srv->rooms, srv->room_cap * sizeof(struct Room *));
+        checkNull(srv->rooms, "realloc rooms");
+    }
+    struct Room *room = room_create(srv->next_room_id, REGISTRATION_TIMEOUT);
+    srv->next_room_id += srv->room_id_step;
+    room->task.run    = room_task;
+    srv->rooms[srv->room_count++] = room;
+    metrics_gauge(&metrics->rooms_open, 1);
+    update_phase(srv);
+    return room;
+}
+
+// Drops every remaining player and forgets the room. Its spectators get
+// one last chance to receive what they have not yet.
+static void room_close(struct EpollServer *srv, struct Room *room) {
+    for (int i = 0; i < NB_PLAYERS; i++) {
+        if (room->players[i] != -1) {
+            conn_drop(srv, room->players[i]);
+        }
+    }
+    while (room->spectator_count > 0) {
+        int slot = room->spectators[room->spectator_count - 1];
+        if (spectator_flush(srv, slot)) {
+            conn_drop(srv, slot);
+        }
+    }
+    for (size_t i = 0; i < srv->room_count; i++) {
+        if (srv->rooms[i] == room) {
+            srv->rooms[i] = srv->rooms[--srv->room_count];
+            break;
+        }
+    }
+    if (srv->waiting == room) {
+        srv->waiting = NULL;
+    }
+    metrics_gauge(&metrics->rooms_open, -1);
+    for (int i = 0; i < NB_PLAYERS; i++) {
+        histogram_merge(&srv->delays.delay[i], &room->arbiter.delay[i]);
+    }
+    if (room->latency.total > 0) {
+        char who[64];
+        snprintf(who, sizeof(who), "Room %u, input to broadcast", room->id);
+        histogram_print(who, &room->latency);
+        histogram_merge(&srv->latency, &room->latency);
+    }
+    for (size_t i = 0; room->ready && i < srv->ready_len; i++) {
+        if (srv->ready[i] == room) {
+            srv->ready[i] = srv->ready[--srv->ready_len];
+            break;
+        }
+    }
+    room_destroy(room);
+
+    update_phase(srv);
+    update_listening(srv);
+    if (shutdown_requested && srv->room_count == 0) {
+        printf("Shutdown requested and every game has ended, exiting server\n");
+        running = false;
+    }
+}
+
+// Queues every message accumulated in the room outbox for its players. They
+// are written at the end of the loop iteration, with a single syscall per
+// connection however many steps the room (or its neighbours) went through.
+//
+// The latency of a connection is measured on the oldest answer it has
+// pending: once the bytes queued so far have left, that command counts as
+// answered.
+static void room_fan_out(struct EpollServer *srv, struct Room *room) {
+    for (int i = 0; i < NB_PLAYERS && room->out.len > 0; i++) {
+        if (room->players[i] != -1 && !srv->conns[room->players[i]]->resuming) {
+            struct Conn *conn = srv->conns[room->players[i]];
+            conn_push(srv, room->players[i], room->out.msgs, room->out.len);
+            if (room->input_ns != 0 && conn->mark_ns == 0) {
+                conn->mark_ns  = room->input_ns;
+                conn->mark_end = conn->out_len;
+            }
+        }
+    }
+    if (room->spectator_count > 0 && room->out.len > 0) {
+        struct SharedBatch *batch = batch_create(room->out.msgs, room->out.len);
+        // Dropping a spectator moves the last one into its place
+        for (size_t i = room->spectator_count; i > 0; i--) {
+            int slot = room->spectators[i - 1];
+            if (!srv->conns[slot]->watching) {
+                continue;
+            }
+            if (!spectator_queue_push(&srv->conns[slot]->view, batch)) {
+                printf("Room %u: a spectator lags too far behind, disconnecting\n", room->id);
+                conn_drop(srv, slot);
+                continue;
+            }
+            conn_mark_dirty(srv, slot);
+        }
+        batch_release(batch);
+    }
+    outbox_clear(&room->out);
+    room->input_ns = 0;
+}
+
+// The spectator joins the game as it is now: it gets a snapshot of the map
+// and the players, then every batch the room publishes. Its registration
+// names no player, and only offers version 1 of the protocol, in which the
+// batches are shared.
+static void spectator_admit(struct EpollServer *srv, struct Room *room, int slot) {
+    struct Outbox out;
+    outbox_init(&out);
+    union Message reg = {
+        .registration = { .msgt = REGISTRATION, .player = 0, .versions = 1u << PROTOCOL_V1 }
+    };
+    outbox_push(&out, &reg);
+    send_map_snapshot_to(&room->state, &out);
+
+    struct Conn *conn = srv->conns[slot];
+    struct SharedBatch *batch = batch_create(out.msgs, out.len);
+    spectator_queue_start(&conn->view, batch);
+    batch_release(batch);
+    outbox_free(&out);
+    conn->watching = true;
+    conn_mark_dirty(srv, slot);
+}
+
+// The player is back in its game: it registers again, with the same
+// session, and gets a snapshot of the map and the players
+static void player_admit(struct EpollServer *srv, struct Room *room, int slot) {
+    struct Conn *conn = srv->conns[slot];
+    uint64_t token    = room->tokens[conn->player];
+    union Message reg = {
+        .registration = {
+            .msgt     = REGISTRATION,
+            .player   = conn->player + 1,
+            .versions = PROTOCOL_VERSIONS,
+            .session  = { (uint32_t) token, (uint32_t) (token >> 32) }
+        }
+    };
+    conn_push(srv, slot, &reg, 1);
+    struct Outbox out;
+    outbox_init(&out);
+    send_map_snapshot_to(&room->state, &out);
+    conn_push(srv, slot, out.msgs, out.len);
+    outbox_free(&out);
+    conn->resuming = false;
+}
+
+// Admits the spectators and the players who came back while the room was
+// away
+static void room_admit(struct EpollServer *srv, struct Room *room) {
+    for (int i = 0; i < NB_PLAYERS; i++) {
+        if (room->players[i] != -1 && srv->conns[room->players[i]]->resuming) {
+            player_admit(srv, room, room->players[i]);
+        }
+    }
+    for (size_t i = 0; i < room->spectator_count; i++) {
+        if (!srv->conns[room->spectators[i]]->watching) {
+            spectator_admit(srv, room, room->spectators[i]);
+        }
+    }
+}
+
+// Players of a closing room are dropped as soon as their output is flushed
+// and they acknowledged GAME_OVER. The room itself goes away with its last
+// player.
+static void room_reap(struct EpollServer *srv, struct Room *room) {
+    for (int i = 0; i < NB_PLAYERS; i++) {
+        int slot = room->players[i];
+        if (slot != -1 && srv->conns[slot]->out_len == 0 && srv->conns[slot]->acked) {
+            conn_drop(srv, slot);
+        }
+    }
+    if (room->player_count == 0) {
+        room_close(srv, room);
+    }
+}
+
+// The game is over: the room will be closed once every player is flushed
+// and acknowledged GAME_OVER, or once GAME_OVER_ACK_TIMEOUT expires
+static void room_end(struct EpollServer *srv, struct Room *room) {
+    enum Item winner = room->state.scores[0] > room->state.scores[1] ? PLAYER1 : PLAYER2;
+    printf("Room %u: game over - Player %d wins with score %d vs %d\n", room->id,
+        winner == PLAYER1 ? 1 : 2,
+        room->state.scores[winner == PLAYER1 ? 0 : 1],
+        room->state.scores[winner == PLAYER1 ? 1 : 0]);
+
+    room->phase = ROOM_CLOSING;
+    clock_gettime(CLOCK_MONOTONIC, &room->deadline);
+    room->deadline.tv_sec += GAME_OVER_ACK_TIMEOUT;
+    room_reap(srv, room);
+}
+
+// Hands the room over to a worker, or runs it right away when there is no
+// pool. Either way room_done is called once the step is over.
+static void room_done(struct EpollServer *srv, struct Room *room);
+
+static void room_schedule(struct EpollServer *srv, struct Room *room) {
+    if (srv->pool != NULL) {
+        room->away = true;
+        pool_submit(srv->pool, &room->task);
+    } else {
+        room_step(room);
+        room_done(srv, room);
+    }
+}
+
+// A token nobody can guess, never 0
+static uint64_t new_session_token(void) {
+    uint64_t token = 0;
+    while (token == 0) {
+        checkCond(getrandom(&token, sizeof(token), 0) != sizeof(token), "getrandom");
+    }
+    return token;
+}
+
+static void room_begin(struct EpollServer *srv, struct Room *room) {
+    printf("Room %u: all players connected, starting the game\n", room->id);
+    if (srv->waiting == room) {
+        srv->waiting = NULL;
+    }
+    update_phase(srv);
+    update_listening(srv);
+
+    for (int i = 0; i < NB_PLAYERS; i++) {
+        room->tokens[i] = srv->config->grace > 0 ? new_session_token() : 0;
+        union Message reg = {
+            .registration = {
+                .msgt     = REGISTRATION,
+                .player   = i + 1,
+                .versions = PROTOCOL_VERSIONS,
+                .session  = { (uint32_t) room->tokens[i], (uint32_t) (room->tokens[i] >> 32) }
+            }
+        };
+        conn_push(srv, room->players[i], &reg, 1);
+    }
+    if (srv->config->record_dir != NULL) {
+        char path[4096];
+        recording_path(path, sizeof(path), srv->config->record_dir, room->id);
+        if (recorder_open(&room->recorder, path)) {
+            printf("Room %u: recording to %s\n", room->id, path);
+        }
+    }
+    room_start(room, map_pool_next(srv->config->maps), srv->config->tick_rate);
+    room_schedule(srv, room);
+}
+
+// The room is back from a step: what it produced is sent to its players,
+// and the commands received in the meantime are scheduled.
+static void room_done(struct EpollServer *srv, struct Room *room) {
+    room->away = false;
+    if (room->staged.len > 0) {
+        struct CommandList inbox = room->inbox;
+        room->inbox  = room->staged;
+        room->staged = inbox;
+    }
+
+    room_fan_out(srv, room);
+    room_admit(srv, room);
+    if (room_game_over(room)) {
+        room_end(srv, room);
+    } else if (room->inbox.len > 0 && !room_ticking(room)) {
+        room_schedule(srv, room);
+    }
+}
+
+// The room will be run once every event of the loop iteration has been
+// handled: the commands both of its players sent meanwhile are then
+// arbitrated together (see arbiter.h), whichever was read first.
+static void room_mark_ready(struct EpollServer *srv, struct Room *room) {
+    if (room->ready) {
+        return;
+    }
+    if (srv->ready_len == srv->ready_cap) {
+        srv->ready_cap = srv->ready_cap == 0 ? 16 : 2 * srv->ready_cap;
+        srv->ready     = realloc(srv->ready, srv->ready_cap * sizeof(struct Room *));
+        checkNull(srv->ready, "realloc ready rooms");
+    }
+    srv->ready[srv->ready_len++] = room;
+    room->ready = true;
+}
+
+// Moves the room forward after some I/O happened on one of its players. A
+// player not seated yet (see seat_unseated) has no room: there is nothing
+// to do then.
+static void room_update(struct EpollServer *srv, struct Room *room) {
+    if (room == NULL) {
+        return;
+    }
+    switch (room->phase) {
+    case ROOM_WAITING:
+        if (room->player_count == 0) {
+            printf("Room %u: the only player left during registration\n", room->id);
+            room_close(srv, room);
+        }
+        break;
+    case ROOM_PLAYING:
+        if (room->away) {
+            // room_done will take care of it
+        } else if (room->inbox.len > 0 && !room_ticking(room)) {
+            // A ticking room only runs on its ticks (see handle_ticks)
+            room_mark_ready(srv, room);
+        } else if (room_game_over(room)) {
+            room_end(srv, room);
+        }
+        break;
+    case ROOM_CLOSING:
+        room_reap(srv, room);
+        break;
+    }
+}
+
+//#############################################################################
+// EVENTS
+//#############################################################################
+
+// Seats the player in the room waiting for players. The game starts once
+// the room is full.
+static void seat_player(struct EpollServer *srv, struct Room *room, int slot) {
+    struct Conn *conn = srv->conns[slot];
+    conn->room        = room;
+    conn->player      = room_add_player(room, slot);
+    printf("Room %u: player %d connected\n", room->id, conn->player + 1);
+    if (room_is_full(room)) {
+        room_begin(srv, room);
+    }
+}
+
+// Seats a new player in the room waiting for players, which is opened if
+// there is none
+static void seat_newcomer(struct EpollServer *srv, int slot) {
+    if (srv->waiting == NULL) {
+        srv->waiting = room_open(srv);
+        printf("Room %u opened. Registration phase started: %d seconds timeout\n",
+               srv->waiting->id, REGISTRATION_TIMEOUT);
+    }
+    seat_player(srv, srv->waiting, slot);
+}
+
+// Is the seat of some player who lost its connection held ?
+static bool seats_held(struct EpollServer *srv) {
+    for (size_t i = 0; i < srv->room_count; i++) {
+        if (srv->rooms[i]->phase == ROOM_PLAYING && room_paused(srv->rooms[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// While a seat is held, a player who connects may be the one coming back
+// to it, whose RESUME_REQUEST is yet to arrive: it is not seated before it
+// sent one (see player_resume), RESUME_WINDOW_MS later at most, or as soon
+// as no seat is held anymore. Then it is seated as a new player, or let go
+// if the server shuts down. A later RESUME_REQUEST still finds its seat as
+// long as its room waits for players.
+static void seat_unseated(struct EpollServer *srv) {
+    if (srv->unseated == 0) {
+        return;
+    }
+    bool held = seats_held(srv);
+    for (size_t slot = 0; slot < srv->conn_cap && srv->unseated > 0; slot++) {
+        struct Conn *conn = srv->conns[slot];
+        if (conn == NULL || conn->spectator || conn->room != NULL) {
+            continue;
+        }
+        if (held && ms_until(&conn->seat_at) > 0) {
+            continue;
+        }
+        if (shutdown_requested) {
+            conn_drop(srv, slot);
+            continue;
+        }
+        srv->unseated--;
+        seat_newcomer(srv, slot);
+    }
+    update_listening(srv);
+}
+
+// A room lost a player before its game started. Its other player, if any,
+// waits for an opponent again: in this room, or in the one already waiting
+// for players.
+static void room_reopen(struct EpollServer *srv, struct Room *room) {
+    if (room->player_count == 0) {
+        room_close(srv, room);
+        return;
+    }
+    int slot = room->players[0] != -1 ? room->players[0] : room->players[1];
+    if (srv->waiting == NULL) {
+        srv->waiting = room;
+        clock_gettime(CLOCK_MONOTONIC, &room->deadline);
+        room->deadline.tv_sec += REGISTRATION_TIMEOUT;
+        printf("Room %u: waiting for another player again\n", room->id);
+        update_phase(srv);
+        return;
+    }
+    room_remove_player(room, srv->conns[slot]->player);
+    room_close(srv, room);
+    seat_player(srv, srv->waiting, slot);
+}
+
+// The player who just connected asks for the seat it lost in a game in
+// progress, presenting its session token. It is either not seated yet (see
+// seat_unseated) or seated in a room waiting for players. The game goes on
+// as soon as nobody else is missing.
+static void player_resume(struct EpollServer *srv, int slot, uint64_t token) {
+    struct Conn *conn    = srv->conns[slot];
+    struct Room *waiting = conn->room;
+    struct Room *room    = NULL;
+    int player           = -1;
+    for (size_t i = 0; i < srv->room_count && room == NULL; i++) {
+        for (int p = 0; p < NB_PLAYERS; p++) {
+            struct Room *candidate = srv->rooms[i];
+            if (candidate->phase == ROOM_PLAYING && candidate->held[p] && candidate->tokens[p] == token) {
+                room   = candidate;
+                player = p;
+            }
+        }
+    }
+    if (room == NULL && waiting == NULL) {
+        printf("A player presented an unknown session, disconnecting\n");
+        conn_drop(srv, slot);
+        return;
+    }
+    if (room == NULL) {
+        printf("Room %u: player %d presented an unknown session, disconnecting\n", waiting->id, conn->player + 1);
+        conn_drop(srv, slot);
+        room_reopen(srv, waiting);
+        return;
+    }
+
+    if (waiting != NULL) {
+        room_remove_player(waiting, conn->player);
+    } else {
+        srv->unseated--;
+    }
+    conn->room   = room;
+    conn->player = player;
+    room_resume_seat(room, player, slot);
+    printf("Room %u: player %d is back\n", room->id, player + 1);
+    if (waiting != NULL) {
+        room_reopen(srv, waiting);
+    }
+
+    // A room which is away gets its player back once done
+    conn->resuming = true;
+    if (!room->away) {
+        player_admit(srv, room, slot);
+    }
+    if (!room_paused(room) && room_ticking(room)) {
+        tick_clock_start(&room->clock, room->tick_rate);
+    }
+}
+
+static void accept_clients(struct EpollServer *srv) {
+    while (srv->listening) {
+        FileDescriptor fd = accept(srv->sockfd, NULL, NULL);
+        if (fd < 0 && errno == EINTR) {
+            continue;
+        }
+        if (fd < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        checkNeg(fd, "accept failure");
+        set_nonblocking(fd);
+        if (srv->config->low_latency) {
+            socket_low_latency(fd);
+        }
+        metrics_count(&metrics->connections, 1);
+        metrics_gauge(&metrics->connections_open, 1);
+
+        int slot = conn_add(srv, fd);
+        if (seats_held(srv)) {
+            struct timespec *seat_at = &srv->conns[slot]->seat_at;
+            clock_gettime(CLOCK_MONOTONIC, seat_at);
+            seat_at->tv_nsec += RESUME_WINDOW_MS * 1000000L;
+            seat_at->tv_sec  += seat_at->tv_nsec / 1000000000L;
+            seat_at->tv_nsec %= 1000000000L;
+            srv->unseated++;
+        } else {
+            seat_newcomer(srv, slot);
+        }
+        update_listening(srv);
+    }
+}
+
+static void accept_spectators(struct EpollServer *srv) {
+    while (srv->spectating) {
+        FileDescriptor fd = accept(srv->spectator_fd, NULL, NULL);
+        if (fd < 0 && errno == EINTR) {
+            continue;
+        }
+        if (fd < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        checkNeg(fd, "accept failure");
+        set_nonblocking(fd);
+        metrics_count(&metrics->connections, 1);
+        metrics_gauge(&metrics->connections_open, 1);
+        metrics_gauge(&metrics->spectators_open, 1);
+
+        int slot          = conn_add(srv, fd);
+        struct Conn *conn = srv->conns[slot];
+        conn->spectator   = true;
+        conn->player      = -1;
+        spectator_queue_init(&conn->view);
+    }
+}
+
+// The game a spectator asks for: the room 'id', or the game started last
+// if 'id' is 0. NULL if no such game is being played.
+static struct Room *find_game(struct EpollServer *srv, uint32_t id) {
+    struct Room *found = NULL;
+    for (size_t i = 0; i < srv->room_count; i++) {
+        struct Room *room = srv->rooms[i];
+        if (room->phase != ROOM_PLAYING || (id != 0 && room->id != id)) {
+            continue;
+        }
+        if (found == NULL || room->id > found->id) {
+            found = room;
+        }
+    }
+    return found;
+}
+
+// A spectator only ever sends the id of the room it wants to watch (a u32,
+// 0 for the game started last). Anything else is ignored.
+static void handle_spectator_input(struct EpollServer *srv, int slot) {
+    struct Conn *conn = srv->conns[slot];
+    ssize_t n = input_fill(&conn->in, conn->fd);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return;
+    }
+    if (n <= 0) {
+        if (conn->room != NULL) {
+            printf("Room %u: a spectator left\n", conn->room->id);
+        }
+        conn_drop(srv, slot);
+        return;
+    }
+
+    ssize_t size;
+    const uint8_t *frame;
+    while ((frame = input_next(&conn->in, command_frame_size, &size)) != NULL) {
+        if (conn->room != NULL) {
+            continue;
+        }
+        uint32_t id;
+        memcpy(&id, frame, sizeof(id));
+        struct Room *room = find_game(srv, id);
+        if (room == NULL) {
+            printf("A spectator asked for room %u, which is not playing\n", id);
+            conn_drop(srv, slot);
+            return;
+        }
+        conn->room = room;
+        room_add_spectator(room, slot);
+        printf("Room %u: a spectator joined (%zu watching)\n", room->id, room->spectator_count);
+        // A room which is away gets its new spectators once back
+        if (!room->away) {
+            spectator_admit(srv, room, slot);
+        }
+    }
+}
+
+// Reads everything the player sent, in a single read, and runs every
+// complete command. Whatever does not fit is reported again by epoll.
+static void handle_input(struct EpollServer *srv, int slot) {
+    struct Conn *conn = srv->conns[slot];
+    struct Room *room = conn->room;
+
+    ssize_t n = input_fill(&conn->in, conn->fd);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return;
+    }
+    if (n <= 0 && room == NULL) {
+        printf("A player left before being seated\n");
+        conn_drop(srv, slot);
+        return;
+    }
+    if (n <= 0) {
+        printf("Room %u: player %d disconnected\n", room->id, conn->player + 1);
+        conn_lose(srv, slot);
+        room_update(srv, room);
+        return;
+    }
+
+    uint64_t received = now_ns();
+    ssize_t size;
+    const uint8_t *frame;
+    while ((frame = input_next(&conn->in, command_frame_size, &size)) != NULL) {
+        // Commands received outside of a running game, or while it is
+        // paused, are ignored
+        uint32_t word;
+        memcpy(&word, frame, sizeof(word));
+        if (word == RESUME_REQUEST && (room == NULL || room->phase == ROOM_WAITING)) {
+            uint64_t token;
+            memcpy(&token, frame + sizeof(word), sizeof(token));
+            player_resume(srv, slot, token);
+            if (srv->conns[slot] == NULL) {
+                return;
+            }
+            room = conn->room;
+        } else if (room == NULL) {
+            // Not seated yet: nothing else is expected, and nothing may be
+            // sent to it before REGISTRATION
+        } else if (word == PROTOCOL_V2_REQUEST) {
+            conn_upgrade(srv, slot);
+        } else if (room->phase == ROOM_CLOSING && word == GAME_OVER_ACK) {
+            conn->acked = true;
+        } else if (room->phase == ROOM_PLAYING && !room_paused(room) && word != GAME_OVER_ACK && word != RESUME_REQUEST) {
+            enum Direction dir;
+            memcpy(&dir, frame, sizeof(dir));
+            if (!valid_direction(dir)) {
+                continue;
+            }
+            metrics_count(&metrics->commands_in, 1);
+            enum LimitVerdict verdict = limiter_input(&conn->limiter, &dir);
+            if (verdict == LIMIT_PASS) {
+                commands_push(room->away ? &room->staged : &room->inbox, conn->player, dir, received);
+            } else if (verdict == LIMIT_HELD) {
+                srv->held = true;
+            } else {
+                printf("Room %u: player %d keeps flooding the server, disconnecting\n", room->id, conn->player + 1);
+                srv->input.kicked++;
+                conn_drop(srv, slot);
+                break;
+            }
+        }
+    }
+
+    room_update(srv, room);
+}
+
+// Adds to the metrics what the workers did since the last call
+static void publish_workers(struct EpollServer *srv) {
+    int count = pool_size(srv->pool) < METRICS_WORKERS ? pool_size(srv->pool) : METRICS_WORKERS;
+    for (int i = 0; i < count; i++) {
+        struct WorkerStats stats;
+        pool_stats(srv->pool, i, &stats);
+        struct WorkerStats *last = &srv->published[i];
+        metrics_count(&metrics->worker_executed[i], stats.executed - last->executed);
+        metrics_count(&metrics->worker_stolen[i], stats.stolen - last->stolen);
+        metrics_count(&metrics->worker_busy_ns[i], stats.busy_ns - last->busy_ns);
+        *last = stats;
+    }
+}
+
+static void handle_completed(struct EpollServer *srv) {
+    struct PoolTask *task = pool_completed(srv->pool);
+    while (task != NULL) {
+        struct PoolTask *next = task->next;
+        room_done(srv, task->arg);
+        task = next;
+    }
+    publish_workers(srv);
+}
+
+// Runs the rooms which received commands during this loop iteration
+static void run_ready(struct EpollServer *srv) {
+    // Running a room may close it, which removes it from the list
+    while (srv->ready_len > 0) {
+        struct Room *room = srv->ready[--srv->ready_len];
+        room->ready = false;
+        if (room->phase == ROOM_PLAYING && !room->away && room->inbox.len > 0) {
+            room_schedule(srv, room);
+        }
+    }
+}
+
+// Writes the output queued during this loop iteration: to every player
+// first, then to the spectators
+static void flush_pending(struct EpollServer *srv) {
+    size_t spectators = 0;
+    for (size_t i = 0; i < srv->dirty_len; i++) {
+        int slot = srv->dirty[i];
+        struct Conn *conn = srv->conns[slot];
+        if (conn == NULL || !conn->dirty) {
+            continue; // dropped meanwhile
+        }
+        if (conn->spectator) {
+            srv->dirty[spectators++] = slot;
+            continue;
+        }
+        conn->dirty = false;
+        struct Room *room = conn->room;
+        conn_flush(srv, slot);
+        room_update(srv, room);
+    }
+    for (size_t i = 0; i < spectators; i++) {
+        int slot = srv->dirty[i];
+        struct Conn *conn = srv->conns[slot];
+        if (conn == NULL || !conn->dirty) {
+            continue; // dropped with its room
+        }
+        conn->dirty = false;
+        spectator_flush(srv, slot);
+    }
+    srv->dirty_len = 0;
+}
+
+static void handle_output(struct EpollServer *srv, int slot) {
+    if (srv->conns[slot]->spectator) {
+        spectator_flush(srv, slot);
+        return;
+    }
+    struct Room *room = srv->conns[slot]->room;
+    conn_flush(srv, slot);
+    room_update(srv, room);
+}
+
+// Keeps the earliest of '*next' (if any) and 'deadline'
+static void earliest(const struct timespec **next, const struct timespec *deadline) {
+    if (*next == NULL || deadline->tv_sec < (*next)->tv_sec
+        || (deadline->tv_sec == (*next)->tv_sec && deadline->tv_nsec < (*next)->tv_nsec)) {
+        *next = deadline;
+    }
+}
+
+// The next deadline the event loop has to wake up for, NULL if there is
+// none: the next tick of a game played at a fixed timestep, the end of the
+// seat held for a player, the end of a registration or of a GAME_OVER
+// acknowledgement, or the time a player not seated yet gets its seat
+static const struct timespec *next_deadline(struct EpollServer *srv) {
+    const struct timespec *next = NULL;
+    for (size_t slot = 0; slot < srv->conn_cap && srv->unseated > 0; slot++) {
+        struct Conn *conn = srv->conns[slot];
+        if (conn != NULL && !conn->spectator && conn->room == NULL) {
+            earliest(&next, &conn->seat_at);
+        }
+    }
+    for (size_t i = 0; i < srv->room_count; i++) {
+        struct Room *room = srv->rooms[i];
+        if (room->phase != ROOM_PLAYING) {
+            earliest(&next, &room->deadline);
+            continue;
+        }
+        for (int p = 0; p < NB_PLAYERS; p++) {
+            if (room->held[p]) {
+                earliest(&next, &room->held_until[p]);
+            }
+        }
+        // A room which is away is looked at again once back
+        if (room_ticking(room) && !room->away && !room_paused(room)) {
+            earliest(&next, &room->clock.next);
+        }
+    }
+    return next;
+}
+
+// Runs the ticks which are due in every game played at a fixed timestep.
+// Whatever the players sent since the previous tick is applied at once, and
+// what the tick produced is sent to them as one batch.
+static void handle_ticks(struct EpollServer *srv) {
+    // Scheduling a room may close it, which moves the last room into its slot
+    for (size_t i = srv->room_count; i > 0; i--) {
+        struct Room *room = srv->rooms[i - 1];
+        if (room->phase != ROOM_PLAYING || !room_ticking(room) || room->away || room_paused(room)) {
+            continue;
+        }
+        unsigned due = tick_clock_due(&room->clock);
+        if (due > 0) {
+            room->ticks_due += due;
+            room_schedule(srv, room);
+        }
+    }
+}
+
+// Releases the seats of the players who did not come back in time. The
+// game goes on without them.
+static void release_seats(struct EpollServer *srv, struct Room *room) {
+    bool released = false;
+    for (int p = 0; p < NB_PLAYERS; p++) {
+        if (room->held[p] && ms_until(&room->held_until[p]) == 0) {
+            printf("Room %u: player %d did not come back within %d seconds\n", room->id, p + 1, srv->config->grace);
+            room_release_seat(room, p);
+            released = true;
+        }
+    }
+    if (!released) {
+        return;
+    }
+    if (!room_paused(room) && room_ticking(room)) {
+        tick_clock_start(&room->clock, room->tick_rate);
+    }
+    room_update(srv, room);
+}
+
+// Releases the seats held for too long, and closes the rooms whose deadline
+// expired: the one waiting for players and those whose players did not
+// acknowledge GAME_OVER in time
+static void handle_timeouts(struct EpollServer *srv) {
+    size_t i = 0;
+    while (i < srv->room_count) {
+        struct Room *room = srv->rooms[i];
+        if (room->phase == ROOM_PLAYING) {
+            release_seats(srv, room);
+            // Ending the game may have closed the room, which moves the
+            // last room into this slot
+            if (i < srv->room_count && srv->rooms[i] == room) {
+                i++;
+            }
+            continue;
+        }
+        if (ms_until(&room->deadline) > 0) {
+            i++;
+            continue;
+        }
+        if (room->phase == ROOM_WAITING) {
+            printf("Room %u: registration timeout, not enough players connected within %d seconds\n",
+                   room->id, REGISTRATION_TIMEOUT);
+        } else {
+            printf("Room %u: GAME_OVER not acknowledged within %d seconds, closing\n",
+                   room->id, GAME_OVER_ACK_TIMEOUT);
+        }
+        // room_close moves the last room into this slot
+        room_close(srv, room);
+    }
+}
+
+// Applies the commands held over the rate limit of their player whose token
+// is available by now. Returns the number of milliseconds before the next
+// one can be, -1 if none is held anymore.
+static int release_held(struct EpollServer *srv) {
+    if (!srv->held) {
+        return -1;
+    }
+    srv->held = false;
+    int wait  = -1;
+    for (size_t slot = 0; slot < srv->conn_cap; slot++) {
+        struct Conn *conn = srv->conns[slot];
+        if (conn == NULL || !conn->limiter.has_pending) {
+            continue;
+        }
+        enum Direction dir;
+        if (limiter_release(&conn->limiter, &dir)) {
+            struct Room *room = conn->room;
+            if (room->phase == ROOM_PLAYING && !room_paused(room)) {
+                commands_push(room->away ? &room->staged : &room->inbox, conn->player, dir, now_ns());
+                room_update(srv, room);
+            }
+            continue;
+        }
+        int ms    = limiter_wait_ms(&conn->limiter);
+        wait      = wait < 0 || ms < wait ? ms : wait;
+        srv->held = true;
+    }
+    return wait;
+}
+
+// Sets the timer for 'deadline', if it is not already set for it. A single
+// timer serves every room: it expires at the earliest of their deadlines,
+// to the nanosecond.
+static void arm_timer(struct EpollServer *srv, const struct timespec *deadline) {
+    if (deadline == NULL ? !srv->armed
+                         : srv->armed && deadline->tv_sec == srv->armed_at.tv_sec
+                                      && deadline->tv_nsec == srv->armed_at.tv_nsec) {
+        return;
+    }
+    timer_arm(srv->timer, deadline);
+    srv->armed = deadline != NULL;
+    if (deadline != NULL) {
+        srv->armed_at = *deadline;
+    }
+}
+
+// Handles the signals delivered since the last call. SIGCHLD (the metrics
+// process) needs nothing from the event loop. A worker leaves SIGHUP to the
+// process which started it, which owns the sockets.
+static void handle_signals(struct EpollServer *srv) {
+    int sig;
+    while ((sig = signals_next(srv->signal_fd)) != 0) {
+        if (sig == SIGINT) {
+            request_shutdown();
+        } else if (sig == SIGHUP && srv->config->workers == 0 && srv->handover_fd == -1) {
+            srv->handover_fd = start_handover();
+            if (srv->handover_fd != -1) {
+                ep_ctl(srv, EPOLL_CTL_ADD, srv->handover_fd, EPOLLIN, TOKEN_HANDOVER);
+            }
+        }
+    }
+}
+
+// A shutdown has been requested: nobody new gets in, the room waiting for
+// players is closed and the games in progress are allowed to finish.
+static void handle_shutdown(struct EpollServer *srv) {
+    update_listening(srv);
+    if (srv->waiting != NULL) {
+        room_close(srv, srv->waiting);
+    }
+    if (srv->room_count == 0) {
+        running = false;
+    } else if (running) {
+        printf("Server will continue running until the %zu game(s) in progress complete.\n", srv->room_count);
+    }
+}
+
+void run_epoll_server(FileDescriptor sockfd, FileDescriptor signal_fd, const struct ServerConfig *config) {
+    struct EpollServer srv;
+    memset(&srv, 0, sizeof(srv));
+    srv.config = config;
+    srv.sockfd = sockfd;
+    srv.signal_fd = signal_fd;
+    srv.timer = timer_open();
+    srv.spectator_fd = config->spectator_fd;
+    srv.handover_fd  = -1;
+    srv.next_room_id = config->worker + 1;
+    srv.room_id_step = config->workers > 0 ? config->workers : 1;
+    arbiter_init(&srv.delays);
+    histogram_init(&srv.latency);
+
+    srv.epfd = epoll_create1(EPOLL_CLOEXEC);
+    checkNeg(srv.epfd, "epoll_create1");
+    set_nonblocking(sockfd);
+    if (srv.spectator_fd != -1) {
+        set_nonblocking(srv.spectator_fd);
+    }
+    ep_ctl(&srv, EPOLL_CTL_ADD, signal_fd, EPOLLIN, TOKEN_SIGNALS);
+    ep_ctl(&srv, EPOLL_CTL_ADD, srv.timer, EPOLLIN, TOKEN_TIMER);
+    update_listening(&srv);
+    update_phase(&srv);
+    if (config->threads > 0) {
+        srv.pool      = pool_create(config->threads);
+        srv.published = smalloc(config->threads * sizeof(struct WorkerStats));
+        memset(srv.published, 0, config->threads * sizeof(struct WorkerStats));
+        metrics_workers(config->threads);
+        ep_ctl(&srv, EPOLL_CTL_ADD, pool_done_fd(srv.pool), EPOLLIN, TOKEN_POOL);
+        printf("Games are run by %d worker threads\n", config->threads);
+    }
+    if (config->rate_limit > 0) {
+        printf("Players may send %d commands per second\n", config->rate_limit);
+    }
+    if (config->tick_rate > 0) {
+        printf("Games are played at %d ticks per second\n", config->tick_rate);
+    }
+    if (srv.spectator_fd != -1) {
+        printf("Spectators may watch the games on port %d\n", config->spectator_port);
+    }
+    if (config->grace > 0) {
+        printf("Players who lose their connection have %d seconds to resume\n", config->grace);
+    }
+    printf("Waiting for players to connect (at most %d rooms)...\n", config->max_rooms);
+
+    bool shutdown_handled = false;
+    int held_wait         = -1;
+    struct epoll_event events[MAX_EVENTS];
+    while (running) {
+        if (shutdown_requested && !shutdown_handled) {
+            shutdown_handled = true;
+            handle_shutdown(&srv);
+            continue;
+        }
+
+        // The deadlines of the rooms come as events of the timer, only the
+        // commands held over the rate limit still need a timeout
+        arm_timer(&srv, next_deadline(&srv));
+        int timeout = srv.ready_len > 0 ? 0 : held_wait;
+        int n = epoll_wait(srv.epfd, events, MAX_EVENTS, timeout);
+        if (n < 0 && errno == EINTR) {
+            continue; // SIGUSR2
+        }
+        checkNeg(n, "epoll_wait");
+
+        // An iteration spans everything done between two waits
+        uint64_t iteration = trace_begin();
+        for (int i = 0; i < n; i++) {
+            uint64_t token = events[i].data.u64;
+            if (token == TOKEN_LISTENER) {
+                accept_clients(&srv);
+                continue;
+            }
+            if (token == TOKEN_POOL) {
+                handle_completed(&srv);
+                continue;
+            }
+            if (token == TOKEN_SPECTATORS) {
+                accept_spectators(&srv);
+                continue;
+            }
+            if (token == TOKEN_SIGNALS) {
+                handle_signals(&srv);
+                continue;
+            }
+            if (token == TOKEN_HANDOVER) {
+                // Once the successor serves, the loop winds down
+                ep_ctl(&srv, EPOLL_CTL_DEL, srv.handover_fd, 0, TOKEN_HANDOVER);
+                if (finish_handover(srv.handover_fd)) {
+                    stop_after_phase("Handed over to the new server");
+                }
+                srv.handover_fd = -1;
+                continue;
+            }
+            if (token == TOKEN_TIMER) {
+                // Armed again for whatever deadline is next, even if it is
+                // the same one
+                timer_expired(srv.timer);
+                srv.armed = false;
+                continue;
+            }
+
+            int slot = (int) token;
+            if (srv.conns[slot] == NULL) {
+                continue; // dropped earlier in this batch
+            }
+            if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && srv.conns[slot]->spectator) {
+                handle_spectator_input(&srv, slot);
+            } else if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                handle_input(&srv, slot);
+            }
+            if (srv.conns[slot] != NULL && (events[i].events & EPOLLOUT)) {
+                handle_output(&srv, slot);
+            }
+        }
+
+        handle_timeouts(&srv);
+        seat_unseated(&srv);
+        handle_ticks(&srv);
+        held_wait = release_held(&srv);
+        run_ready(&srv);
+        flush_pending(&srv);
+        trace_end("event_loop", iteration);
+    }
+
+    if (srv.pool != NULL) {
+        for (int i = 0; i < pool_size(srv.pool); i++) {
+            struct WorkerStats stats;
+            pool_stats(srv.pool, i, &stats);
+            printf("Worker %d: %" PRIu64 " steps run (%" PRIu64 " stolen), %.1f ms busy\n",
+                   i, stats.executed, stats.stolen, stats.busy_ns / 1e6);
+        }
+        publish_workers(&srv);
+        pool_destroy(srv.pool);
+        free(srv.published);
+        for (size_t i = 0; i < srv.room_count; i++) {
+            srv.rooms[i]->away = false;
+        }
+    }
+    while (srv.room_count > 0) {
+        room_close(&srv, srv.rooms[0]);
+    }
+    // Spectators which never picked a game
+    for (size_t slot = 0; slot < srv.conn_cap; slot++) {
+        conn_drop(&srv, slot);
+    }
+    if (srv.handover_fd != -1) {
+        sclose(srv.handover_fd);
+    }
+    print_flush_stats("Output", &srv.stats);
+    print_input_stats("Input", &srv.input);
+    arbiter_print("All rooms", &srv.delays);
+    histogram_print("All rooms, input to broadcast", &srv.latency);
+    free(srv.rooms);
+    free(srv.conns);
+    free(srv.dirty);
+    free(srv.ready);
+    sclose(srv.timer);
+    sclose(srv.epfd);
+}
@@ -0,0 +1,25 @@
+#ifndef __EPOLL_SERVER__
+#define __EPOLL_SERVER__
+
+#include "game.h"
+#include "server.h"
+
+// Runs the whole server in a single process, around one non-blocking epoll
+// loop: it accepts the players, reads their commands, runs
+// process_user_command and fans the resulting messages out to the sockets.
+// There is no fork, no semaphore, no shared memory and no pipe involved.
+//
+// Incoming connections are paired into rooms (see room.h), each of them
+// hosting an independent game. At most 'config->max_rooms' rooms exist at
+// the same time. When 'config->threads' is positive, the games are run by
+// a work-stealing pool of threads (see worker_pool.h) while the event loop
+// keeps doing all the I/O.
+//
+// 'sockfd' must be a bound and listening socket, and 'signal_fd' the
+// signalfd SIGINT and SIGHUP are delivered on (see event_fds.h). On SIGHUP,
+// the server hands its sockets over to a new one (see handover.h) unless
+// it is one of several workers. This function returns once 'running' has
+// been cleared (see server.h).
+void run_epoll_server(FileDescriptor sockfd, FileDescriptor signal_fd, const struct ServerConfig *config);
+
+#endif //__EPOLL_SERVER__
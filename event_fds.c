@@ -0,0 +1,80 @@
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#include "utils_v3.h"
+#include "event_fds.h"
+
+static void event_signals(sigset_t *mask) {
+    sigemptyset(mask);
+    sigaddset(mask, SIGINT);
+    sigaddset(mask, SIGCHLD);
+    sigaddset(mask, SIGHUP);
+}
+
+FileDescriptor signals_open(void) {
+    sigset_t mask;
+    event_signals(&mask);
+    checkNeg(sigprocmask(SIG_BLOCK, &mask, NULL), "sigprocmask");
+    FileDescriptor fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    checkNeg(fd, "signalfd");
+    return fd;
+}
+
+void signals_restore(void) {
+    sigset_t mask;
+    event_signals(&mask);
+    checkNeg(sigprocmask(SIG_UNBLOCK, &mask, NULL), "sigprocmask");
+}
+
+int signals_next(FileDescriptor fd) {
+    struct signalfd_siginfo info;
+    ssize_t n;
+    do {
+        n = read(fd, &info, sizeof(info));
+    } while (n < 0 && errno == EINTR);
+    if (n < 0 && errno == EAGAIN) {
+        return 0;
+    }
+    checkCond(n != sizeof(info), "signalfd read");
+    return info.ssi_signo;
+}
+
+FileDescriptor timer_open(void) {
+    FileDescriptor fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    checkNeg(fd, "timerfd_create");
+    return fd;
+}
+
+void timer_arm(FileDescriptor fd, const struct timespec *deadline) {
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if (deadline != NULL) {
+        spec.it_value = *deadline;
+        // A zero it_value would disarm the timer instead
+        if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+            spec.it_value.tv_nsec = 1;
+        }
+    }
+    checkNeg(timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, NULL), "timerfd_settime");
+}
+
+void timer_arm_in(FileDescriptor fd, int seconds) {
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = seconds;
+    checkNeg(timerfd_settime(fd, 0, &spec, NULL), "timerfd_settime");
+}
+
+bool timer_expired(FileDescriptor fd) {
+    uint64_t expirations;
+    ssize_t n;
+    do {
+        n = read(fd, &expirations, sizeof(expirations));
+    } while (n < 0 && errno == EINTR);
+    return n == sizeof(expirations);
+}
@@ -0,0 +1,40 @@
+#ifndef __EVENT_FDS__
+#define __EVENT_FDS__
+
+#include <stdbool.h>
+#include <time.h>
+
+#include "game.h"
+
+// Signals and deadlines delivered as file descriptors, so that the loops of
+// the server wait for them along with their sockets: no handler, no flag
+// checked after an EINTR, no process-wide alarm, and as many timers as
+// needed.
+
+// Blocks SIGINT, SIGCHLD and SIGHUP in the calling process, and in the threads and
+// processes it creates from then on, and returns a non-blocking signalfd
+// which delivers them instead.
+FileDescriptor signals_open(void);
+
+// Unblocks the signals blocked by signals_open. A child which does not
+// wait for them on the signalfd calls it right after the fork.
+void signals_restore(void);
+
+// The next signal delivered on 'fd', 0 if there is none left.
+int signals_next(FileDescriptor fd);
+
+// Creates a non-blocking timer on CLOCK_MONOTONIC, disarmed.
+FileDescriptor timer_open(void);
+
+// Arms the timer to expire at 'deadline' (on CLOCK_MONOTONIC, possibly in
+// the past), or disarms it if 'deadline' is NULL.
+void timer_arm(FileDescriptor fd, const struct timespec *deadline);
+
+// Arms the timer to expire 'seconds' from now.
+void timer_arm_in(FileDescriptor fd, int seconds);
+
+// Acknowledges the expiration of the timer. Returns false if it did not
+// expire since the last call.
+bool timer_expired(FileDescriptor fd);
+
+#endif //__EVENT_FDS__
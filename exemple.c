@@ -23,6 +23,7 @@
 
 int main(int argc, char** argv) {
     struct GameState state;
+    init_gamestate(&state);
     FileDescriptor sout = 1;
     FileDescriptor map  = sopen("./resources/map.txt", O_RDONLY, 0);
     load_map(map, sout, &state);
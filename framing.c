@@ -0,0 +1,65 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "utils_v3.h"
+#include "framing.h"
+
+void input_init(struct InputBuffer *in) {
+    memset(in, 0, sizeof(struct InputBuffer));
+}
+
+void input_free(struct InputBuffer *in) {
+    free(in->data);
+    input_init(in);
+}
+
+ssize_t input_fill(struct InputBuffer *in, FileDescriptor fd) {
+    // What has been handed over makes room for what comes next
+    if (in->start > 0) {
+        memmove(in->data, in->data + in->start, in->len - in->start);
+        in->len  -= in->start;
+        in->start = 0;
+    }
+    if (in->cap - in->len < INPUT_CHUNK) {
+        size_t cap = in->cap == 0 ? INPUT_CHUNK : 2 * in->cap;
+        while (cap - in->len < INPUT_CHUNK) {
+            cap *= 2;
+        }
+        in->data = realloc(in->data, cap);
+        checkNull(in->data, "realloc input buffer");
+        in->cap = cap;
+    }
+
+    ssize_t n;
+    do {
+        n = read(fd, in->data + in->len, in->cap - in->len);
+    } while (n < 0 && errno == EINTR);
+    if (n > 0) {
+        in->len += n;
+    }
+    return n;
+}
+
+const uint8_t *input_next(struct InputBuffer *in, FrameSize size, ssize_t *len) {
+    *len = size(in->data + in->start, in->len - in->start);
+    if (*len <= 0) {
+        return NULL;
+    }
+    const uint8_t *frame = in->data + in->start;
+    in->start += *len;
+    return frame;
+}
+
+ssize_t command_frame_size(const uint8_t *buf, size_t len) {
+    if (len < sizeof(uint32_t)) {
+        return 0;
+    }
+    uint32_t word;
+    memcpy(&word, buf, sizeof(word));
+    if (word == RESUME_REQUEST) {
+        return len < RESUME_FRAME_SIZE ? 0 : (ssize_t) RESUME_FRAME_SIZE;
+    }
+    return sizeof(uint32_t);
+}
@@ -0,0 +1,55 @@
+#ifndef __FRAMING__
+#define __FRAMING__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "game.h"
+
+// Room made for a read when the input buffer is (almost) full
+#define INPUT_CHUNK 4096
+
+// Size of a RESUME_REQUEST and of the session token which follows it
+#define RESUME_FRAME_SIZE (sizeof(uint32_t) + sizeof(uint64_t))
+
+// Size of the frame at the start of 'buf', which holds 'len' bytes: 0 if
+// it has not been received whole yet, -1 if 'buf' does not start with a
+// valid frame. Each kind of stream has its own (command_frame_size,
+// v1_message_size, v2_batch_size...).
+typedef ssize_t (*FrameSize)(const uint8_t *buf, size_t len);
+
+// What has been received on a stream (a socket, a pipe...) and not handled
+// yet. Everything available is read in one call, then every complete frame
+// is handed over: a burst costs a single wakeup, and a frame split across
+// reads is only handed over once whole.
+struct InputBuffer {
+    uint8_t *data;
+    // The frames not handed over yet are data[start] to data[len - 1]
+    size_t start;
+    size_t len;
+    size_t cap;
+};
+
+void input_init(struct InputBuffer *in);
+
+void input_free(struct InputBuffer *in);
+
+// Reads whatever 'fd' has to offer, in a single read (retried on EINTR).
+// Returns what read returned: the number of bytes received, 0 at the end of
+// the stream, or -1 with errno set (EAGAIN if 'fd' is non-blocking and has
+// nothing to offer). The frames handed over so far become invalid.
+ssize_t input_fill(struct InputBuffer *in, FileDescriptor fd);
+
+// Hands over the next complete frame, as measured by 'size', and sets
+// '*len' to its size. Returns NULL once there is none left, '*len' being
+// then 0, or -1 if the stream is malformed. The frame stays valid until the
+// next input_fill.
+const uint8_t *input_next(struct InputBuffer *in, FrameSize size, ssize_t *len);
+
+// Every word a player sends to the server (a direction, GAME_OVER_ACK,
+// PROTOCOL_V2_REQUEST) is a frame of sizeof(uint32_t) bytes, but
+// RESUME_REQUEST which is followed by the 64-bit session token.
+ssize_t command_frame_size(const uint8_t *buf, size_t len);
+
+#endif //__FRAMING__
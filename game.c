@@ -1,9 +1,14 @@
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "utils_v3.h"
 
 #include "game.h"
+#include "map_binary.h"
 
 /******************************************************************************************
  * CES FONCTIONS POURRAIENT ETRE PUBLIQUES. MAIS POUR SIMPLIFIER LA VIE DES ETUDIANTS 
@@ -11,30 +16,32 @@
  ******************************************************************************************/
 
 // Cette fonction utilitaire permet de connaitre l'identifiant 
-// d'une resource qui se trouve à une position donnée sur la carte.
+// d'une resource qui se trouve à une position donnée sur la carte
+// de 'state'.
 //
 // Cette fonction renvoie -1 en cas d'erreur
-int32_t id(uint32_t x, uint32_t y, enum Item item);
+int32_t id(const struct GameState *state, uint32_t x, uint32_t y, enum Item item);
 
 // Cette fonction utilitaire permet de connaitre l'identifiant 
-// d'une resource qui se trouve à une position donnée sur la carte.
+// d'une resource qui se trouve à une position donnée sur la carte
+// de 'state'.
 //
 // Cette fonction renvoie -1 en cas d'erreur
-int32_t id_at(struct Position pos, enum Item item);
+int32_t id_at(const struct GameState *state, struct Position pos, enum Item item);
 
 // Cette fonction utilitaire permet de connaitre l'offset d'une 
-// position dans la carte.
-size_t position2index(struct Position pos);
+// position dans la carte de 'state'.
+size_t position2index(const struct GameState *state, struct Position pos);
 
 // Cette fonction ecrit le message approprié pour signifier aux clients qu'une 
 // resource donnée est introduite dans le jeu.
-void send_spawn_item(uint32_t x, uint32_t y, enum Item item, FileDescriptor fdbcast);
+void send_spawn_item(const struct GameState *state, uint32_t x, uint32_t y, enum Item item, struct Outbox *out);
 // Cette fonction ecrit le message approprié pour signifier aux clients qu'un 
 // des joueurs a bougé sur le plateau de jeu.
-void send_player_moved(enum Item player, struct Position to, FileDescriptor fdbcast);
+void send_player_moved(const struct GameState *state, enum Item player, struct Position to, struct Outbox *out);
 // Cette fonction ecrit le message approprié pour signifier aux clients que
 // de la nourriture ou superfood a été mangée par un joueur.
-void send_eat_food(enum Item player, enum Item food, struct Position to, FileDescriptor fdbcast);
+void send_eat_food(const struct GameState *state, enum Item player, enum Item food, struct Position to, struct Outbox *out);
 // Cette fonction ecrit le message approprié pour signifier aux clients que
 // la partie est terminée.
 void send_game_over(enum Item winner, FileDescriptor fdbcast);
@@ -43,18 +50,19 @@ void send_game_over(enum Item winner, FileDescriptor fdbcast);
  * FIN DU PSEUDO-HEADER.
  ******************************************************************************************/
 
-// Renvoie le début du range d'id pour ce type d'items.
-static uint32_t __base_id(enum Item item) {
+// Renvoie le début du range d'id pour ce type d'items, sur la carte de 'state'.
+static uint32_t __base_id(const struct GameState *state, enum Item item) {
+    uint32_t size = state->width * state->height;
     switch (item) {
     case FOOD:
     case SUPERFOOD:
         return 0;
     case WALL:
     case FLOOR:
-        return MAP_SIZE;
+        return size;
     case PLAYER1:
     case PLAYER2:
-        return 3*MAP_SIZE;
+        return 3*size;
     default:
         perror("The given item type is invalid");
         exit(EXIT_FAILURE);
@@ -63,25 +71,90 @@ static uint32_t __base_id(enum Item item) {
 
 // Cette fonction utilitaire permet de connaitre l'identifiant 
 // d'une resource qui se trouve à une position donnée sur la carte.
-int32_t id_at(struct Position pos, enum Item item) {
-    return id(pos.x, pos.y, item);
+int32_t id_at(const struct GameState *state, struct Position pos, enum Item item) {
+    return id(state, pos.x, pos.y, item);
 }
 
 // Cette fonction utilitaire permet de connaitre l'identifiant 
 // d'une resource qui se trouve à une position donnée sur la carte.
-int32_t id(uint32_t x, uint32_t y, enum Item item) {
+int32_t id(const struct GameState *state, uint32_t x, uint32_t y, enum Item item) {
     if (item == PLAYER1) {
-        return PLAYER1_ID;
+        return PLAYER1_ID(state);
     }
     if (item == PLAYER2) {
-        return PLAYER2_ID;
+        return PLAYER2_ID(state);
     }
-    return __base_id(item) + (y * WIDTH + x);
+    return __base_id(state, item) + (y * state->width + x);
 }
 // Cette fonction utilitaire permet de connaitre l'offset d'une 
 // position dans la carte.
-size_t position2index(struct Position pos) {
-    return (size_t) (pos.y * WIDTH + pos.x);
+size_t position2index(const struct GameState *state, struct Position pos) {
+    return (size_t) pos.y * state->width + pos.x;
+}
+
+// Initialise un outbox qui écrit chaque message directement sur 'fd'.
+void outbox_init_fd(struct Outbox *out, FileDescriptor fd) {
+    out->fd   = fd;
+    out->msgs = NULL;
+    out->len  = 0;
+    out->cap  = 0;
+}
+
+// Initialise un outbox qui accumule les messages en mémoire.
+void outbox_init(struct Outbox *out) {
+    outbox_init_fd(out, -1);
+}
+
+// Ajoute un message à l'outbox (ou l'écrit directement sur son fd).
+void outbox_push(struct Outbox *out, const union Message *msg) {
+    if (out->fd >= 0) {
+        swrite(out->fd, msg, sizeof(union Message));
+        return;
+    }
+    if (out->len == out->cap) {
+        out->cap  = out->cap == 0 ? 64 : 2 * out->cap;
+        out->msgs = realloc(out->msgs, out->cap * sizeof(union Message));
+        checkNull(out->msgs, "realloc outbox");
+    }
+    out->msgs[out->len++] = *msg;
+}
+
+// Ajoute 'count' messages d'un coup à l'outbox.
+void outbox_push_all(struct Outbox *out, const union Message *msgs, size_t count) {
+    if (out->fd >= 0) {
+        swrite(out->fd, msgs, count * sizeof(union Message));
+        return;
+    }
+    if (out->len + count > out->cap) {
+        while (out->len + count > out->cap) {
+            out->cap = out->cap == 0 ? 64 : 2 * out->cap;
+        }
+        out->msgs = realloc(out->msgs, out->cap * sizeof(union Message));
+        checkNull(out->msgs, "realloc outbox");
+    }
+    memcpy(out->msgs + out->len, msgs, count * sizeof(union Message));
+    out->len += count;
+}
+
+// Oublie tous les messages accumulés (la mémoire est conservée).
+void outbox_clear(struct Outbox *out) {
+    out->len = 0;
+}
+
+// Libère la mémoire utilisée par l'outbox.
+void outbox_free(struct Outbox *out) {
+    free(out->msgs);
+    out->msgs = NULL;
+    out->len  = 0;
+    out->cap  = 0;
+}
+
+// Initialise un objet GameState sans carte.
+void init_gamestate(struct GameState *state) {
+    state->width  = 0;
+    state->height = 0;
+    state->map    = NULL;
+    reset_gamestate(state);
 }
 
 // Cette réinitialise un objet GameState ce qui permet de s'assurer
@@ -90,7 +163,7 @@ size_t position2index(struct Position pos) {
 void reset_gamestate(struct GameState *state) {
     state->game_over = true;
     state->food_count= 0;
-    if(!memset(state->map, 0, sizeof(state->map))) {
+    if(state->map != NULL && !memset(state->map, 0, (size_t) state->width * state->height)) {
         perror("memset map:");
         exit(EXIT_FAILURE);
     }
@@ -104,6 +177,35 @@ void reset_gamestate(struct GameState *state) {
     }
 }
 
+// Donne à 'state' une carte de 'width' x 'height' tuiles, toutes vides.
+void resize_gamestate(struct GameState *state, uint32_t width, uint32_t height) {
+    size_t size = (size_t) width * height;
+    if (size != (size_t) state->width * state->height || state->map == NULL) {
+        free(state->map);
+        // Une carte vide a tout de même un tableau de tuiles
+        state->map = smalloc(size > 0 ? size : 1);
+    }
+    state->width  = width;
+    state->height = height;
+    reset_gamestate(state);
+}
+
+// Copie l'état 'src' (tuiles comprises) dans 'dst'.
+void copy_gamestate(struct GameState *dst, const struct GameState *src) {
+    resize_gamestate(dst, src->width, src->height);
+    memcpy(dst->map, src->map, (size_t) src->width * src->height);
+    memcpy(dst->scores, src->scores, sizeof(dst->scores));
+    memcpy(dst->positions, src->positions, sizeof(dst->positions));
+    dst->food_count = src->food_count;
+    dst->game_over  = src->game_over;
+}
+
+// Libère les tuiles de 'state'.
+void free_gamestate(struct GameState *state) {
+    free(state->map);
+    init_gamestate(state);
+}
+
 /* Cette fonction lit la map stockée dans le fichier 'resources/map.txt' et génère une suite
  * de messages qui sont écrits l'un à la suite de lautre sur la sortie standard du programme.
  * 
@@ -111,105 +213,349 @@ void reset_gamestate(struct GameState *state) {
  * utiliser pour maintenir une copie l'état courant du jeu.
  */
 void load_map(FileDescriptor fdmap, FileDescriptor fdbcast, struct GameState *state) {
-    reset_gamestate(state);
+    struct Outbox out;
+    outbox_init_fd(&out, fdbcast);
+    load_map_to(fdmap, &out, state);
+}
 
-    size_t pos  = 0;
-    uint32_t x  = 0;
-    uint32_t y  = 0;
-    char c      = '\0';
-    while(sread(fdmap, &c, sizeof(char)) > 0) {
-        // on a lu tout le fichier en une fois, maintenant on peut le parcourir charactere par
-        // charactere pour voir creer les messages nécessaires à dessiner la map. 
-        // - Lorsqu'on rencontrera un caractere '#' on ajoutera un mur
-        // - Lorsqu'on rencontrera un caractere '.' on ajoutera un tuile de sol et de la nourriture
-        // - Lorsqu'on rencontrera un caractere '*' on ajoutera un tuile de sol et de la superfood
-        // - Lorsqu'on rencontrera un caractere ' ' on ajoutera uniquement une tuile de sol.
-        // - Lorsqu'on rencontrera un caractere '@' on injectera le 1er joueur
-        // - Lorsqu'on rencontrera un caractere '!' on injectera le 2nd joueur
-        switch (c) {
-            case '#': 
-                send_spawn_item(x, y, WALL, fdbcast);
-                state->map[pos] = WALL;
-                x++;
-                pos++;
-                break;
-            case '.':
-                send_spawn_item(x, y, FLOOR, fdbcast);
-                send_spawn_item(x, y, FOOD, fdbcast);
-                state->map[pos] = FOOD;
-                state->food_count++;
-                x++;
-                pos++;
-                break;
-            case '*':
-                send_spawn_item(x, y, FLOOR, fdbcast);
-                send_spawn_item(x, y, SUPERFOOD, fdbcast);
-                state->map[pos] = SUPERFOOD;
+// Ce que représente chaque caractère d'une carte: l'item qui occupe la tuile,
+// 0 pour un caractère invalide, et -1 pour un caractère qui ne représente
+// aucune tuile (le '\r' des fins de ligne Windows).
+static const signed char __map_chars[256] = {
+    ['#']  = WALL,
+    ['.']  = FOOD,
+    ['*']  = SUPERFOOD,
+    [' ']  = FLOOR,
+    ['@']  = PLAYER1,
+    ['!']  = PLAYER2,
+    ['\r'] = -1,
+};
+
+// Donne accès à tout le contenu du fichier 'fdmap' d'un coup: il est mappé
+// en mémoire si c'est un fichier ordinaire lu depuis son début, et lu par
+// gros blocs sinon (pipe, ...). '*mapped' indique comment libérer le texte.
+static char *__load_text(FileDescriptor fdmap, size_t *len, bool *mapped) {
+    struct stat st;
+    if (fstat(fdmap, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0
+        && lseek(fdmap, 0, SEEK_CUR) == 0) {
+        char *text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fdmap, 0);
+        if (text != MAP_FAILED) {
+            *len    = st.st_size;
+            *mapped = true;
+            return text;
+        }
+    }
+
+    size_t cap = 4096;
+    char *text = smalloc(cap);
+    *len    = 0;
+    *mapped = false;
+    ssize_t n;
+    while ((n = sread(fdmap, text + *len, cap - *len)) > 0) {
+        *len += n;
+        if (*len == cap) {
+            cap *= 2;
+            text = realloc(text, cap);
+            checkNull(text, "realloc map");
+        }
+    }
+    return text;
+}
+
+static void __free_text(char *text, size_t len, bool mapped) {
+    if (mapped) {
+        munmap(text, len);
+    } else {
+        free(text);
+    }
+}
+
+// Compte les tuiles d'une ligne de la carte (tout caractère qui n'est pas
+// ignoré en est une, ou une erreur qui sera signalée ensuite).
+static size_t __row_tiles(const char *row, size_t len) {
+    size_t tiles = 0;
+    for (size_t i = 0; i < len; i++) {
+        tiles += __map_chars[(unsigned char) row[i]] >= 0;
+    }
+    return tiles;
+}
+
+// Mesure la carte: sa largeur est celle de sa plus longue ligne, et sa
+// hauteur s'arrête à sa dernière ligne non vide (des lignes vides peuvent
+// suivre la carte).
+static bool __measure_rows(const char *text, size_t len, uint32_t *width, uint32_t *height) {
+    const char *line = text;
+    const char *end  = text + len;
+    *width  = 0;
+    *height = 0;
+
+    for (size_t y = 0; line < end; y++) {
+        const char *eol = memchr(line, '\n', end - line);
+        if (eol == NULL) {
+            eol = end;
+        }
+        size_t tiles = __row_tiles(line, eol - line);
+        line = eol + 1;
+        if (tiles == 0) {
+            continue;
+        }
+        if (y >= MAP_MAX_HEIGHT) {
+            fprintf(stderr, "Invalid map: more than %d rows\n", MAP_MAX_HEIGHT);
+            return false;
+        }
+        if (tiles > MAP_MAX_WIDTH) {
+            fprintf(stderr, "Invalid map: row %zu is longer than %d tiles\n", y + 1, MAP_MAX_WIDTH);
+            return false;
+        }
+        *height = y + 1;
+        *width  = tiles > *width ? tiles : *width;
+    }
+    return true;
+}
+
+// Peuple 'state' à partir du texte de la carte. Chaque ligne est délimitée
+// d'un coup (memchr), puis chacun de ses caractères est classé par une
+// simple lecture dans __map_chars. La carte est d'abord mesurée, pour que
+// ses tuiles soient allouées une fois pour toutes.
+static bool __parse_rows(const char *text, size_t len, struct GameState *state) {
+    uint32_t map_width, map_height;
+    if (!__measure_rows(text, len, &map_width, &map_height)) {
+        return false;
+    }
+    resize_gamestate(state, map_width, map_height);
+
+    const char *line = text;
+    const char *end  = text + len;
+    bool players[NB_PLAYERS] = { false, false };
+
+    for (uint32_t y = 0; y < map_height; y++) {
+        const char *eol = memchr(line, '\n', end - line);
+        if (eol == NULL) {
+            eol = end;
+        }
+        size_t width = eol - line;
+        line = eol + 1;
+
+        const char *row = eol - width;
+        uint32_t x      = 0;
+        for (size_t i = 0; i < width; i++) {
+            signed char item = __map_chars[(unsigned char) row[i]];
+            if (item < 0) {
+                continue;
+            }
+            if (item == 0) {
+                fprintf(stderr, "Invalid map: row %u, column %u: unexpected character 0x%02x\n",
+                        y + 1, x + 1, (unsigned char) row[i]);
+                return false;
+            }
+            size_t pos = (size_t) y * map_width + x;
+            switch (item) {
+            case FOOD:
+            case SUPERFOOD:
                 state->food_count++;
-                x++;
-                pos++;
+                state->map[pos] = item;
                 break;
-            case ' ':
-                send_spawn_item(x, y, FLOOR, fdbcast);
+            case PLAYER1:
+            case PLAYER2: {
+                int player = item == PLAYER1 ? 0 : 1;
+                if (players[player]) {
+                    fprintf(stderr, "Invalid map: row %u, column %u: player %d appears twice\n",
+                            y + 1, x + 1, player + 1);
+                    return false;
+                }
+                players[player] = true;
+                state->positions[player].x = x;
+                state->positions[player].y = y;
                 state->map[pos] = FLOOR;
-                x++;
-                pos++;
                 break;
-            case '@':
-                send_spawn_item(x, y, PLAYER1, fdbcast); // player 1
-                send_spawn_item(x, y, FLOOR, fdbcast);
-                state->map[pos] = FLOOR;
-                state->positions[0].x = x;
-                state->positions[0].y = y;
-                x++;
-                pos++;
+            }
+            default:
+                state->map[pos] = item;
                 break;
-            case '!':
-                send_spawn_item(x, y, PLAYER2, fdbcast); // player 2
-                send_spawn_item(x, y, FLOOR, fdbcast);
-                state->map[pos] = FLOOR;
-                state->positions[1].x = x;
-                state->positions[1].y = y;
-                x++;
-                pos++;
+            }
+            x++;
+        }
+    }
+
+    for (int i = 0; i < NB_PLAYERS; i++) {
+        if (!players[i]) {
+            fprintf(stderr, "Invalid map: player %d is missing\n", i + 1);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Cette fonction lit la map stockée dans le fichier 'fdmap' et peuple 'state'.
+bool parse_map(FileDescriptor fdmap, struct GameState *state) {
+    resize_gamestate(state, 0, 0);
+
+    size_t len;
+    bool mapped;
+    char *text = __load_text(fdmap, &len, &mapped);
+    // Une carte compilée (voir pas_mapc) est copiée telle quelle
+    bool valid = binary_map_detect(text, len) ? binary_map_read(text, len, state)
+                                              : __parse_rows(text, len, state);
+    __free_text(text, len, mapped);
+    return valid;
+}
+
+// Introduit un item, sauf si la carte est lue sans générer de SPAWN
+// ('out' vaut alors NULL).
+static void __spawn(const struct GameState *state, uint32_t x, uint32_t y, enum Item item, struct Outbox *out) {
+    if (out != NULL) {
+        send_spawn_item(state, x, y, item, out);
+    }
+}
+
+// Lit la map stockée dans le fichier 'fdmap' pour peupler 'state'. Si 'spawns'
+// n'est pas NULL, chaque tuile y est introduite par un message SPAWN, ligne
+// par ligne. Une carte invalide met fin au programme.
+static void __read_map(FileDescriptor fdmap, struct Outbox *spawns, struct GameState *state) {
+    if (!parse_map(fdmap, state)) {
+        exit(EXIT_FAILURE);
+    }
+    if (spawns == NULL) {
+        return;
+    }
+
+    for (uint32_t y = 0; y < state->height; y++) {
+        for (uint32_t x = 0; x < state->width; x++) {
+            enum Item item = state->map[(size_t) y * state->width + x];
+            for (int i = 0; i < NB_PLAYERS; i++) {
+                if (state->positions[i].x == x && state->positions[i].y == y) {
+                    __spawn(state, x, y, i == 0 ? PLAYER1 : PLAYER2, spawns);
+                }
+            }
+            switch (item) {
+            case WALL:
+            case FLOOR:
+                __spawn(state, x, y, item, spawns);
                 break;
-            case '\n':
-                y ++;
-                x = 0;
+            case FOOD:
+            case SUPERFOOD:
+                __spawn(state, x, y, FLOOR, spawns);
+                __spawn(state, x, y, item, spawns);
                 break;
             default:
-                // par défaut on ne fait simplement rien
+                // pas de tuile à cet endroit
                 break;
+            }
         }
     }
+}
 
+// Démarre la partie dont la carte vient d'être chargée dans 'state'. Une
+// carte sans nourriture est une partie déjà terminée.
+void start_game_to(struct GameState *state, struct Outbox *out) {
     if (state->food_count == 0) {
         state->game_over = true;
-        send_game_over(PLAYER1, fdbcast);
+        send_final_scores_to(state, out);
     } else {
         state->game_over = false;
     }
 }
 
+// Idem load_map, mais les messages sont envoyés dans l'outbox 'out'.
+void load_map_to(FileDescriptor fdmap, struct Outbox *out, struct GameState *state) {
+    __read_map(fdmap, out, state);
+    start_game_to(state, out);
+}
+
+// Idem load_map_to, mais les tuiles sont envoyées dans des MAP_SNAPSHOT
+// (plusieurs pour une grande carte) plutôt que tuile par tuile.
+void load_map_snapshot_to(FileDescriptor fdmap, struct Outbox *out, struct GameState *state) {
+    __read_map(fdmap, NULL, state);
+    send_map_snapshot_to(state, out);
+    start_game_to(state, out);
+}
+
+// Cette fonction ecrit les MAP_SNAPSHOT qui décrivent la carte de 'state',
+// par morceaux d'au plus SNAPSHOT_CHUNK_TILES tuiles (au moins une ligne).
+void send_map_snapshot_to(const struct GameState *state, struct Outbox *out) {
+    uint32_t chunk_rows = state->width > 0 ? SNAPSHOT_CHUNK_TILES / state->width : 1;
+    if (chunk_rows == 0) {
+        chunk_rows = 1;
+    }
+    union Message *slots = smalloc((SNAPSHOT_SLOTS((size_t) state->width, chunk_rows) + 1) * sizeof(union Message));
+
+    for (uint32_t y = 0; y < state->height; y += chunk_rows) {
+        uint32_t rows = state->height - y < chunk_rows ? state->height - y : chunk_rows;
+        union Message msg = {
+            .snapshot = {
+                .msgt   = MAP_SNAPSHOT,
+                .width  = state->width,
+                .height = state->height,
+                .y      = y,
+                .rows   = rows
+            }
+        };
+        outbox_push(out, &msg);
+
+        // Les tuiles suivent l'en-tête, par paquets de sizeof(union Message),
+        // le dernier complété par des zéros.
+        size_t count   = SNAPSHOT_SLOTS((size_t) state->width, rows);
+        uint8_t *tiles = (uint8_t *) slots;
+        if (count > 0) {
+            memset(&slots[count - 1], 0, sizeof(union Message));
+        }
+        memcpy(tiles, state->map + (size_t) y * state->width, (size_t) rows * state->width);
+        for (int i = 0; i < NB_PLAYERS; i++) {
+            struct Position pos = state->positions[i];
+            if (pos.y >= y && pos.y < y + rows) {
+                tiles[position2index(state, pos) - (size_t) y * state->width] = i == 0 ? PLAYER1 : PLAYER2;
+            }
+        }
+        outbox_push_all(out, slots, count);
+    }
+    free(slots);
+}
+
+// Renvoie le nombre de messages qui précèdent le deuxième morceau de carte.
+size_t snapshot_chunk_len(const union Message *msgs, size_t count) {
+    bool chunk = false;
+    size_t i   = 0;
+    while (i < count) {
+        if (msgs[i].msgt == MAP_SNAPSHOT) {
+            if (chunk) {
+                return i;
+            }
+            chunk = true;
+            // Ses tuiles ne sont pas des messages
+            i += SNAPSHOT_SLOTS((size_t) msgs[i].snapshot.width, msgs[i].snapshot.rows);
+        }
+        i++;
+    }
+    return count;
+}
+
 // Cette fonction ecrit le message approprié pour signifier à un client qu'il est
 void send_registered(uint32_t player, FileDescriptor socket) {
+    struct Outbox out;
+    outbox_init_fd(&out, socket);
+    send_registered_to(player, &out);
+}
+
+// Idem send_registered, mais le message est envoyé dans l'outbox 'out'.
+void send_registered_to(uint32_t player, struct Outbox *out) {
     union Message msg = {
         .registration = {
-            .msgt = REGISTRATION,
-            .player   = player
+            .msgt     = REGISTRATION,
+            .player   = player,
+            .versions = PROTOCOL_VERSIONS
         }
     };
 
-    swrite(socket, &msg, sizeof(union Message));
+    outbox_push(out, &msg);
 }
 
 // Cette fonction ecrit le message approprié pour signifier aux clients qu'une 
 // resource donnée est introduite dans le jeu.
-void send_spawn_item(uint32_t x, uint32_t y, enum Item item, FileDescriptor fdbcast) {
+void send_spawn_item(const struct GameState *state, uint32_t x, uint32_t y, enum Item item, struct Outbox *out) {
     union Message msg = {
         .spawn = {
             .msgt = SPAWN,
-            .id   = id(x, y, item),
+            .id   = id(state, x, y, item),
             .item = item,
             .pos  = {
                 .x = x,
@@ -218,53 +564,78 @@ void send_spawn_item(uint32_t x, uint32_t y, enum Item item, FileDescriptor fdbc
         }
     };
 
-    swrite(fdbcast, &msg, sizeof(union Message));
+    outbox_push(out, &msg);
 }
 
 // Cette fonction ecrit le message approprié pour signifier aux clients qu'un 
 // des joueurs a bougé sur le plateau de jeu.
-void send_player_moved(enum Item player, struct Position to, FileDescriptor fdbcast) {
+void send_player_moved(const struct GameState *state, enum Item player, struct Position to, struct Outbox *out) {
     union Message msg = {
         .movement = {
             .msgt = MOVEMENT,
-            .id   = id_at(to, player),
+            .id   = id_at(state, to, player),
             .pos  = to
         }
     };
-    swrite(fdbcast, &msg, sizeof(union Message));
+    outbox_push(out, &msg);
 }
 
 // Cette fonction ecrit le message approprié pour signifier aux clients que
 // de la nourriture ou superfood a été mangée par un joueur.
-void send_eat_food(enum Item player, enum Item food, struct Position to, FileDescriptor fdbcast) {
+void send_eat_food(const struct GameState *state, enum Item player, enum Item food, struct Position to, struct Outbox *out) {
     union Message msg = {
         .eat_food = {
             .msgt  = EAT_FOOD,
-            .eater = id_at(to, player),
-            .food  = id_at(to, food),
+            .eater = id_at(state, to, player),
+            .food  = id_at(state, to, food),
         }
     };
 
-    swrite(fdbcast, &msg, sizeof(union Message));
+    outbox_push(out, &msg);
 }
 
 // Cette fonction ecrit le message approprié pour signifier aux clients que
 // la partie est terminée.
 void send_game_over(enum Item winner, FileDescriptor fdbcast) {
+    struct Outbox out;
+    outbox_init_fd(&out, fdbcast);
+    send_game_over_to(winner, &out);
+}
+
+// Idem send_game_over, mais le message est envoyé dans l'outbox 'out'.
+void send_game_over_to(enum Item winner, struct Outbox *out) {
     union Message msg = {
         .game_over = {
             .msgt   = GAME_OVER,
             .winner = winner == PLAYER1 ? 1 : 2
         }
     };
-    swrite(fdbcast, &msg, sizeof(union Message));
+    outbox_push(out, &msg);
+}
+
+// Idem send_game_over_to, mais le gagnant et les scores finaux sont tirés
+// de l'état du jeu.
+void send_final_scores_to(const struct GameState *state, struct Outbox *out) {
+    enum Item winner = state->scores[0] > state->scores[1] ? PLAYER1 : PLAYER2;
+    union Message msg = {
+        .game_over = {
+            .msgt   = GAME_OVER,
+            .winner = winner == PLAYER1 ? 1 : 2,
+            .scores = { state->scores[0], state->scores[1] }
+        }
+    };
+    outbox_push(out, &msg);
+}
+
+bool valid_direction(enum Direction dir) {
+    return dir == UP || dir == DOWN || dir == LEFT || dir == RIGHT;
 }
 
 // Cette fonction renvoie la prochaine position du joueur après
-// avoir traité le déplacement dans la direction 'dir'. Il est
-// important de noter que la position renvoyée peut être impossible
-//  à atteindre.
-static struct Position __next_position(struct Position pos, enum Direction dir) {
+// avoir traité le déplacement dans la direction 'dir', sur la
+// carte de 'state'. Il est important de noter que la position
+// renvoyée peut être impossible à atteindre.
+static struct Position __next_position(const struct GameState *state, struct Position pos, enum Direction dir) {
     struct Position next = pos;
     switch (dir) {
     case UP:
@@ -273,7 +644,7 @@ static struct Position __next_position(struct Position pos, enum Direction dir)
         }
         break;
     case DOWN:
-        if (next.y < HEIGHT-1) {
+        if (next.y + 1 < state->height) {
             next.y += 1;
         }
         break;
@@ -283,7 +654,7 @@ static struct Position __next_position(struct Position pos, enum Direction dir)
         }
         break;
     case RIGHT:
-        if (next.x < WIDTH -1) {
+        if (next.x + 1 < state->width) {
             next.x += 1;
         }
         break;
@@ -299,31 +670,36 @@ static struct Position __next_position(struct Position pos, enum Direction dir)
 // Par ailleurs, cette fonction renvoie 'true' si la partie est 
 // terminée, false sinon.
 bool process_user_command(struct GameState* state, enum Item player, enum Direction dir, FileDescriptor fdbcast) {
+    struct Outbox out;
+    outbox_init_fd(&out, fdbcast);
+    return process_user_command_to(state, player, dir, &out);
+}
+
+// Idem process_user_command, mais les messages sont envoyés dans l'outbox 'out'.
+bool process_user_command_to(struct GameState* state, enum Item player, enum Direction dir, struct Outbox *out) {
     if (state->game_over) {
-        enum Item winner = state->scores[0] > state->scores[1] ? PLAYER1 : PLAYER2;
-        send_game_over(winner, fdbcast);
+        send_final_scores_to(state, out);
         return true;
     }
 
     size_t player_offset  = player == PLAYER1 ? 0 : 1;
-    struct Position next  = __next_position(state->positions[player_offset], dir);
+    struct Position next  = __next_position(state, state->positions[player_offset], dir);
     struct Position other = state->positions[(player_offset + 1) % 2];
 
     // Si l'autre joueur se trouve sur la case destination, le jeu est fini.
     if (next.x == other.x && next.y == other.y) {
         state->game_over = true;
-        enum Item winner = state->scores[0] > state->scores[1] ? PLAYER1 : PLAYER2;
-        send_game_over(winner, fdbcast);
+        send_final_scores_to(state, out);
         return true;
     }
 
     // La partie n'est pas finie, il faut mettre l'état à jour et envoyer une série de messages.
-    size_t next_offset = position2index(next);
+    size_t next_offset = position2index(state, next);
     enum Item at_next  = state->map[next_offset];
     switch (at_next) {
     case FLOOR:
         state->positions[player_offset] = next;
-        send_player_moved(player, next, fdbcast);
+        send_player_moved(state, player, next, out);
         break;
     case FOOD:
         state->map[next_offset] = FLOOR;
@@ -333,8 +709,8 @@ bool process_user_command(struct GameState* state, enum Item player, enum Direct
         if (state->food_count == 0) {
             state->game_over = true;
         }
-        send_player_moved(player, next, fdbcast);
-        send_eat_food(player, at_next, next, fdbcast);
+        send_player_moved(state, player, next, out);
+        send_eat_food(state, player, at_next, next, out);
         break;
     case SUPERFOOD:
         state->map[next_offset] = FLOOR;
@@ -344,8 +720,8 @@ bool process_user_command(struct GameState* state, enum Item player, enum Direct
         if (state->food_count == 0) {
             state->game_over = true;
         }
-        send_player_moved(player, next, fdbcast);
-        send_eat_food(player, at_next, next, fdbcast);
+        send_player_moved(state, player, next, out);
+        send_eat_food(state, player, at_next, next, out);
         break;
     default:
         /* do nothing */
@@ -353,8 +729,7 @@ bool process_user_command(struct GameState* state, enum Item player, enum Direct
     }
 
     if (state->game_over) {
-        enum Item winner = state->scores[0] > state->scores[1] ? PLAYER1 : PLAYER2;
-        send_game_over(winner, fdbcast);
+        send_final_scores_to(state, out);
     }
 
     return state->game_over;
@@ -9,22 +9,48 @@
 
 #define NB_PLAYERS 2
 
+// Ce que le client renvoie au serveur (à la place d'une direction) pour
+// accuser réception du message GAME_OVER. Le serveur ferme alors la
+// connexion sans attendre.
+#define GAME_OVER_ACK 0x4B434147u
+
+// Ce que le client renvoie au serveur (à la place d'une direction) pour
+// demander à recevoir la suite des messages dans la version 2 du protocole
+// (voir protocol_v2.h). Il ne peut le faire que si le message REGISTRATION
+// annonce que le serveur la supporte.
+#define PROTOCOL_V2_REQUEST 0x32565350u
+
+// Ce que le client envoie au serveur, suivi des 8 octets du jeton de session
+// reçu dans REGISTRATION, comme premier message d'une nouvelle connexion pour
+// reprendre sa place dans une partie après avoir perdu la précédente.
+#define RESUME_REQUEST 0x454D5352u
+
+// Les versions du protocole que le serveur annonce dans REGISTRATION.
+#define PROTOCOL_VERSIONS ((1u << 1) | (1u << 2))
+
 // Tous les éléments du jeu ont un identifiant qui peut être 
 // choisi arbitrairement. Par facilité, on va opter pour le
 // schéma suivant:
 // - Les items de type FOOD et SUPERFOOD sont dans le range
-//   (0..MAP_SIZE), ce qui veut dire qu'on peut directement 
+//   (0..size), où size = width * height est le nombre de tuiles
+//   de la carte, ce qui veut dire qu'on peut directement 
 //   convertir l'identifiant en position sur la map et vice
 //   versa.
 // - Les items de type WALL et FLOOR ont un identifiant dans
-//   le range (MAP_SIZE, 2*MAP_SIZE) parce qu'en fait, on 
+//   le range (size, 2*size) parce qu'en fait, on 
 //   n'aura jamais besoin de manipuler leurs id.
-// - Les itesm de type PLAYER1, PLAYER2 sont dans le range 3*MAP_SIZE
-//   et 3*MAP_SIZE + 1. Ce qui permet de connaitre immédiatement
+// - Les itesm de type PLAYER1, PLAYER2 sont dans le range 3*size
+//   et 3*size + 1. Ce qui permet de connaitre immédiatement
 //   l'id d'un joueur, de retrouver le joueur en fonction de
 //   son id.
-#define PLAYER1_ID (3 * MAP_SIZE)
-#define PLAYER2_ID (3 * MAP_SIZE + 1)
+// Les identifiants dépendent donc des dimensions de la carte jouée.
+#define PLAYER1_ID(state) (3 * (state)->width * (state)->height)
+#define PLAYER2_ID(state) (3 * (state)->width * (state)->height + 1)
+
+// Le nombre maximum de tuiles décrites par un même MAP_SNAPSHOT: une carte
+// plus grande est envoyée en plusieurs morceaux de quelques lignes, que les
+// clients reçoivent (et dessinent) l'un après l'autre.
+#define SNAPSHOT_CHUNK_TILES 16384
 
 // Juste histoire de rendre le code plus facile à lire.
 typedef int FileDescriptor;
@@ -33,19 +59,26 @@ typedef int FileDescriptor;
 // SHARED STATE (SHM)
 //#############################################################################
 
-// Il s'agit ici de l'état partagé par tous les processus
-// qui tournent sur le server. C'est lui qui sera stocké en
-// mémoire partagée.
+// Il s'agit ici de l'état d'une partie. Il n'est modifié que
+// par le processus (ou le thread) qui fait tourner la partie.
+//
+// Ses tuiles sont allouées à la taille de la carte (voir
+// init_gamestate et free_gamestate): un GameState ne se copie
+// donc pas par une simple affectation, mais par copy_gamestate.
 struct GameState
 {
-    // Pour chaque position de la carte, on va stocker le
-    // type d'item qui se trouve à la position. Les joueurs, 
-    // par contre, ne sont pas stockés comme éléments de la 
-    // carte: leur position est gérée à part.
+    // Les dimensions de la carte, lues dans son fichier.
+    uint32_t width;
+    uint32_t height;
+    // Pour chaque position de la carte (y * width + x), on va
+    // stocker le type d'item qui se trouve à la position, sur
+    // un octet comme dans un MAP_SNAPSHOT (0 s'il n'y a pas de
+    // tuile). Les joueurs, par contre, ne sont pas stockés comme
+    // éléments de la carte: leur position est gérée à part.
     // Dans la pratique, ca nous permettra de savoir:
     // 1. Si un mouvement est possible (destionation != wall)
     // 2. Quelle food ou superfood on a mangé.
-    enum Item map[MAP_SIZE];
+    uint8_t *map;
     // Ce tableau stocke le score de chacun des deux joueurs.
     int scores[NB_PLAYERS];
     // Compte le nombre d'éléménts qui peuvent encore être mangés sur le plateau.
@@ -56,15 +89,85 @@ struct GameState
     bool game_over;
 };
 
+//#############################################################################
+// OUTBOX
+//#############################################################################
+
+// Un Outbox est la destination des messages générés par le jeu. Soit il
+// écrit chaque message directement sur un FileDescriptor (c'est le
+// comportement historique: pipe de broadcast, stdout, ...), soit il les
+// accumule en mémoire pour que l'appelant puisse ensuite les diffuser
+// lui-même, en une fois, à tous les clients.
+struct Outbox
+{
+    // Si fd >= 0, chaque message est directement écrit sur ce fd.
+    FileDescriptor fd;
+    // Sinon, les messages sont accumulés dans ce tableau.
+    union Message *msgs;
+    // Nombre de messages accumulés.
+    size_t len;
+    // Nombre de messages que 'msgs' peut contenir avant de devoir grandir.
+    size_t cap;
+};
+
+// Initialise un outbox qui écrit chaque message directement sur 'fd'.
+void outbox_init_fd(struct Outbox *out, FileDescriptor fd);
+
+// Initialise un outbox qui accumule les messages en mémoire.
+void outbox_init(struct Outbox *out);
+
+// Ajoute un message à l'outbox (ou l'écrit directement sur son fd).
+void outbox_push(struct Outbox *out, const union Message *msg);
+
+// Ajoute 'count' messages d'un coup à l'outbox.
+void outbox_push_all(struct Outbox *out, const union Message *msgs, size_t count);
+
+// Oublie tous les messages accumulés (la mémoire est conservée).
+void outbox_clear(struct Outbox *out);
+
+// Libère la mémoire utilisée par l'outbox.
+void outbox_free(struct Outbox *out);
+
 //#############################################################################
 // INITIALISATION
 //#############################################################################
 
+// Initialise un objet GameState sans carte (0 x 0 tuiles). Tout GameState
+// doit être initialisé avant d'être utilisé.
+void init_gamestate(struct GameState *state);
+
 // Cette réinitialise un objet GameState ce qui permet de s'assurer
 // que toutes les valeurs soient correctement initialisées
 // (par exemple en mettant -1 partout dans le champ 'food').
+// Ses dimensions sont conservées, mais toutes ses tuiles sont vidées.
 void reset_gamestate(struct GameState *state);
 
+// Donne à 'state' une carte de 'width' x 'height' tuiles, toutes vides, et
+// réinitialise tout le reste.
+void resize_gamestate(struct GameState *state, uint32_t width, uint32_t height);
+
+// Copie l'état 'src' (tuiles comprises) dans 'dst', qui doit avoir été
+// initialisé.
+void copy_gamestate(struct GameState *dst, const struct GameState *src);
+
+// Libère les tuiles de 'state', qui n'a alors plus de carte.
+void free_gamestate(struct GameState *state);
+
+// Cette fonction lit la map stockée dans le fichier 'fdmap' (d'un coup, et non
+// caractère par caractère) et peuple 'state' (qui doit avoir été initialisé),
+// sans générer aucun message. La carte a la largeur de sa plus longue ligne,
+// et autant de lignes que le fichier (sans compter les lignes vides finales).
+//
+// Elle renvoie false si la carte est mal formée: une ligne de plus de
+// MAP_MAX_WIDTH tuiles, plus de MAP_MAX_HEIGHT lignes, un caractère inconnu,
+// ou un joueur absent ou présent deux fois. Le problème est alors expliqué sur
+// la sortie d'erreur.
+//
+// La carte peut aussi avoir été compilée par pas_mapc (voir map_binary.h): ses
+// tuiles sont alors recopiées dans 'state' sans rien analyser, après avoir
+// vérifié leur somme de contrôle.
+bool parse_map(FileDescriptor fdmap, struct GameState *state);
+
 // Cette fonction lit la map stockée dans le fichier 'fdmap' et génère une suite
 // de messages qui sont écrits l'un à la suite de lautre sur le pipe 'fdbcast'.
 // 
@@ -75,10 +178,45 @@ void reset_gamestate(struct GameState *state);
 //       qui doit s'en charger.
 void load_map(FileDescriptor fdmap, FileDescriptor fdbcast, struct GameState *state);
 
+// Idem load_map, mais les messages sont envoyés dans l'outbox 'out'.
+void load_map_to(FileDescriptor fdmap, struct Outbox *out, struct GameState *state);
+
+// Idem load_map_to, mais les tuiles de la carte sont envoyées ligne par ligne
+// dans des MAP_SNAPSHOT plutôt que par un SPAWN pour chaque tuile (une grande
+// carte en plusieurs morceaux, voir send_map_snapshot_to).
+void load_map_snapshot_to(FileDescriptor fdmap, struct Outbox *out, struct GameState *state);
+
+// Démarre la partie dont la carte vient d'être chargée dans 'state' (voir
+// parse_map). Si la carte ne contient aucune nourriture, la partie est déjà
+// terminée et le message GAME_OVER est envoyé dans l'outbox 'out'.
+void start_game_to(struct GameState *state, struct Outbox *out);
+
+// Cette fonction ecrit les MAP_SNAPSHOT qui décrivent la carte de 'state':
+// un seul pour une petite carte, un par morceau de SNAPSHOT_CHUNK_TILES
+// tuiles au plus (des lignes entières) sinon.
+void send_map_snapshot_to(const struct GameState *state, struct Outbox *out);
+
+// Parmi les 'count' messages de 'msgs', renvoie le nombre de ceux qui
+// précèdent le deuxième morceau de carte (un MAP_SNAPSHOT et ses tuiles), ou
+// 'count' s'il n'y en a pas: de quoi envoyer une grande carte morceau par
+// morceau.
+size_t snapshot_chunk_len(const union Message *msgs, size_t count);
+
 // Cette fonction ecrit le message approprié pour signifier à un client qu'il enregistré
 // et qu'il peut commencer à jouer.
 void send_registered(uint32_t player, FileDescriptor socket);
 
+// Idem send_registered, mais le message est envoyé dans l'outbox 'out'.
+void send_registered_to(uint32_t player, struct Outbox *out);
+
+// Cette fonction ecrit le message approprié pour signifier aux clients que
+// la partie est terminée.
+void send_game_over_to(enum Item winner, struct Outbox *out);
+
+// Idem send_game_over_to, mais le gagnant et les scores finaux sont tirés
+// de l'état du jeu.
+void send_final_scores_to(const struct GameState *state, struct Outbox *out);
+
 //#############################################################################
 // COEUR DU JEU
 //#############################################################################
@@ -92,4 +230,11 @@ void send_registered(uint32_t player, FileDescriptor socket);
 // terminée, false sinon.
 bool process_user_command(struct GameState* state, enum Item player, enum Direction dir, FileDescriptor fdbcast);
 
+// Idem process_user_command, mais les messages sont envoyés dans l'outbox 'out'.
+bool process_user_command_to(struct GameState* state, enum Item player, enum Direction dir, struct Outbox *out);
+
+// Renvoie true si 'dir' est l'une des quatre directions (UP, DOWN, LEFT ou
+// RIGHT). Une commande reçue d'un client doit être rejetée sinon.
+bool valid_direction(enum Direction dir);
+
 #endif //__SERVER_SHARED__
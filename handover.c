@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/close_range.h>
+
+#include "utils_v3.h"
+#include "event_fds.h"
+#include "handover.h"
+
+extern char **environ;
+
+// The successor being started, if any
+static pid_t successor = -1;
+
+int handover_inherited(FileDescriptor *fds, int max) {
+    const char *list = getenv(HANDOVER_FDS_ENV);
+    if (list == NULL) {
+        return 0;
+    }
+    int count = 0;
+    while (*list != '\0' && count < max) {
+        char *end;
+        long fd = strtol(list, &end, 10);
+        if (end == list || fd < 0 || fcntl((int) fd, F_GETFD) < 0) {
+            fprintf(stderr, "Invalid %s: %s\n", HANDOVER_FDS_ENV, getenv(HANDOVER_FDS_ENV));
+            exit(EXIT_FAILURE);
+        }
+        fds[count++] = (FileDescriptor) fd;
+        list = *end == ',' ? end + 1 : end;
+    }
+    // The successor of this server must not think it inherits them too
+    unsetenv(HANDOVER_FDS_ENV);
+    for (int i = 0; i < count; i++) {
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+    return count;
+}
+
+void handover_ready(void) {
+    const char *ready = getenv(HANDOVER_READY_ENV);
+    if (ready == NULL) {
+        return;
+    }
+    FileDescriptor fd = atoi(ready);
+    unsetenv(HANDOVER_READY_ENV);
+    char byte = 1;
+    if (write(fd, &byte, 1) != 1) {
+        perror("handover ready");
+    }
+    close(fd);
+}
+
+// Marks every descriptor of the process but the standard ones close-on-exec.
+// Called between fork and exec, while other threads of the parent may hold
+// locks: it makes system calls only.
+static void close_on_exec(int max_fd) {
+    if (syscall(SYS_close_range, STDERR_FILENO + 1, ~0U, CLOSE_RANGE_CLOEXEC) == 0) {
+        return;
+    }
+    // Kernels older than 5.11 have no close_range
+    for (int fd = STDERR_FILENO + 1; fd < max_fd; fd++) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+}
+
+// Finds the file 'name' stands for in PATH, as execvp would: the successor
+// is started by execve, which does not search. Returns it (to be freed), NULL
+// if there is none.
+static char *find_program(const char *name) {
+    if (strchr(name, '/') != NULL) {
+        return strdup(name);
+    }
+    const char *path = getenv("PATH");
+    if (path == NULL) {
+        path = "/usr/bin:/bin";
+    }
+    while (*path != '\0') {
+        // An empty entry stands for the current directory
+        size_t len = strcspn(path, ":");
+        char *file = smalloc(len + strlen(name) + 3);
+        sprintf(file, "%.*s/%s", len == 0 ? 1 : (int) len, len == 0 ? "." : path, name);
+        if (access(file, X_OK) == 0) {
+            return file;
+        }
+        free(file);
+        path += path[len] == ':' ? len + 1 : len;
+    }
+    return NULL;
+}
+
+// Builds the environment of the successor: that of this process, but for
+// the hand-over variables, which are set to 'fds_var' and 'ready_var'. The
+// array is to be freed, not the strings.
+static char **successor_environ(char *fds_var, char *ready_var) {
+    size_t len = 0;
+    while (environ[len] != NULL) {
+        len++;
+    }
+    char **envp = smalloc((len + 3) * sizeof(char *));
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (strncmp(environ[i], HANDOVER_FDS_ENV "=", strlen(HANDOVER_FDS_ENV) + 1) != 0
+                && strncmp(environ[i], HANDOVER_READY_ENV "=", strlen(HANDOVER_READY_ENV) + 1) != 0) {
+            envp[n++] = environ[i];
+        }
+    }
+    envp[n++] = fds_var;
+    envp[n++] = ready_var;
+    envp[n]   = NULL;
+    return envp;
+}
+
+FileDescriptor handover_start(char *const argv[], const FileDescriptor *fds, int count) {
+    char *program = find_program(argv[0]);
+    if (program == NULL) {
+        fprintf(stderr, "handover: %s not found\n", argv[0]);
+        return -1;
+    }
+    int ready[2];
+    if (pipe(ready) < 0) {
+        perror("handover pipe");
+        free(program);
+        return -1;
+    }
+    fcntl(ready[0], F_SETFD, FD_CLOEXEC);
+
+    // Everything the child needs is prepared here: between fork and exec, it
+    // may only make system calls, since the epoll server may be running
+    // worker threads (see worker_pool.h) which hold locks of the C library
+    char fds_var[sizeof(HANDOVER_FDS_ENV) + HANDOVER_MAX_FDS * 12] = HANDOVER_FDS_ENV "=";
+    size_t len = strlen(fds_var);
+    for (int i = 0; i < count; i++) {
+        len += snprintf(fds_var + len, sizeof(fds_var) - len, i == 0 ? "%d" : ",%d", fds[i]);
+    }
+    char ready_var[sizeof(HANDOVER_READY_ENV) + 12];
+    snprintf(ready_var, sizeof(ready_var), "%s=%d", HANDOVER_READY_ENV, ready[1]);
+    char **envp = successor_environ(fds_var, ready_var);
+    char failed[256];
+    snprintf(failed, sizeof(failed), "handover: cannot run %s\n", program);
+    size_t failed_len = strlen(failed);
+    long max_fd = sysconf(_SC_OPEN_MAX);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // The successor gets the sockets and the end of the pipe, and none
+        // of the connections of this server, which it would keep open
+        close_on_exec(max_fd < 0 ? 1024 : (int) max_fd);
+        for (int i = 0; i < count; i++) {
+            fcntl(fds[i], F_SETFD, 0);
+        }
+        fcntl(ready[1], F_SETFD, 0);
+        signals_restore();
+        execve(program, argv, envp);
+        write(STDERR_FILENO, failed, failed_len);
+        _exit(EXIT_FAILURE);
+    }
+    free(envp);
+    free(program);
+    close(ready[1]);
+    if (pid < 0) {
+        perror("handover fork");
+        close(ready[0]);
+        return -1;
+    }
+    successor = pid;
+    printf("Handing the listening sockets over to process %d\n", pid);
+    return ready[0];
+}
+
+bool handover_outcome(FileDescriptor fd) {
+    char byte;
+    ssize_t n;
+    do {
+        n = read(fd, &byte, 1);
+    } while (n < 0 && errno == EINTR);
+    close(fd);
+    if (n != 1 && successor > 0) {
+        waitpid(successor, NULL, 0);
+    }
+    successor = -1;
+    return n == 1;
+}
@@ -0,0 +1,40 @@
+#ifndef __HANDOVER__
+#define __HANDOVER__
+
+#include <stdbool.h>
+
+#include "game.h"
+
+// A running server hands its listening sockets over to a successor: a new
+// process started from the same command line, typically a new build of the
+// binary. The sockets are never closed in between, so no connection is
+// refused, and the games in progress finish in the old process while the
+// successor accepts the new ones.
+//
+// The successor finds the sockets in its environment, in the order they
+// were given, and says it is ready on a pipe, which lets the old server go
+// on serving if it fails to start.
+#define HANDOVER_FDS_ENV "PAS_LISTEN_FDS"
+#define HANDOVER_READY_ENV "PAS_READY_FD"
+
+// Most sockets handed over at once
+#define HANDOVER_MAX_FDS 64
+
+// Stores the sockets inherited from a predecessor into 'fds', which holds
+// 'max' of them. Returns their number, 0 if the server was started afresh.
+int handover_inherited(FileDescriptor *fds, int max);
+
+// Tells the predecessor, if any, that this server now serves.
+void handover_ready(void);
+
+// Starts the successor: runs 'argv' with the 'count' sockets 'fds' and no
+// other descriptor of this process. Returns a descriptor which becomes
+// readable once the successor is ready or gone (see handover_outcome), -1
+// if it could not be started.
+FileDescriptor handover_start(char *const argv[], const FileDescriptor *fds, int count);
+
+// Reads the outcome of the hand-over from 'fd', which it closes: true if
+// the successor is ready, false if it exited before it was.
+bool handover_outcome(FileDescriptor fd);
+
+#endif //__HANDOVER__
@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "histogram.h"
+
+uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+void histogram_init(struct Histogram *hist) {
+    memset(hist, 0, sizeof(struct Histogram));
+}
+
+void histogram_record(struct Histogram *hist, uint64_t ns) {
+    uint64_t us = ns / 1000;
+    int bucket  = 0;
+    while (us >= 2 && bucket < HISTOGRAM_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    hist->counts[bucket]++;
+    hist->total++;
+    hist->sum_ns += ns;
+    if (ns > hist->max_ns) {
+        hist->max_ns = ns;
+    }
+}
+
+void histogram_merge(struct Histogram *dst, const struct Histogram *src) {
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+    dst->total  += src->total;
+    dst->sum_ns += src->sum_ns;
+    if (src->max_ns > dst->max_ns) {
+        dst->max_ns = src->max_ns;
+    }
+}
+
+uint64_t histogram_percentile_us(const struct Histogram *hist, double p) {
+    if (hist->total == 0) {
+        return 0;
+    }
+    // Rank of the value, counted from 1
+    uint64_t rank = (uint64_t) (p / 100 * hist->total + 0.999999);
+    rank = rank == 0 ? 1 : rank;
+    // The bound of a bucket may be far above the largest value it holds
+    uint64_t max_us = (hist->max_ns + 999) / 1000;
+    uint64_t seen   = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS - 1; i++) {
+        seen += hist->counts[i];
+        if (seen >= rank) {
+            uint64_t bound = (uint64_t) 2 << i;
+            return bound < max_us ? bound : max_us;
+        }
+    }
+    return max_us;
+}
+
+void histogram_print(const char *who, const struct Histogram *hist) {
+    if (hist->total == 0) {
+        printf("%s: no sample\n", who);
+        return;
+    }
+    printf("%s: %" PRIu64 " samples, mean %.1f us, p50 <= %" PRIu64 " us, p90 <= %" PRIu64
+           " us, p99 <= %" PRIu64 " us, p999 <= %" PRIu64 " us, max %.1f us\n",
+           who, hist->total, hist->sum_ns / 1e3 / hist->total,
+           histogram_percentile_us(hist, 50), histogram_percentile_us(hist, 90),
+           histogram_percentile_us(hist, 99), histogram_percentile_us(hist, 99.9), hist->max_ns / 1e3);
+}
@@ -0,0 +1,39 @@
+#ifndef __HISTOGRAM__
+#define __HISTOGRAM__
+
+#include <stdint.h>
+
+// Number of buckets of a histogram: bucket 0 counts the values below 2 µs,
+// bucket i those from 2^i to 2^(i+1) µs, the last one everything above.
+#define HISTOGRAM_BUCKETS 32
+
+// A histogram of durations with buckets on a log2 scale. It holds no
+// pointer, so it can live in shared memory (with a single writer).
+struct Histogram {
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t total;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+};
+
+// The current time of CLOCK_MONOTONIC, in nanoseconds. It is the same clock
+// in every process, so timestamps can be compared across processes.
+uint64_t now_ns(void);
+
+void histogram_init(struct Histogram *hist);
+
+// Counts a duration, in nanoseconds.
+void histogram_record(struct Histogram *hist, uint64_t ns);
+
+// Adds the counts of 'src' to 'dst'.
+void histogram_merge(struct Histogram *dst, const struct Histogram *src);
+
+// An upper bound, in µs, of the 'p'-th percentile (0 < p <= 100): the bound
+// of the bucket which holds it, or the largest value if it is lower. 0 if
+// the histogram is empty.
+uint64_t histogram_percentile_us(const struct Histogram *hist, double p);
+
+// Prints a one line summary of the histogram, prefixed by 'who'.
+void histogram_print(const char *who, const struct Histogram *hist);
+
+#endif //__HISTOGRAM__
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils_v3.h"
+#include "map_binary.h"
+
+static uint32_t get_u32(const char *buf) {
+    const unsigned char *b = (const unsigned char *) buf;
+    return (uint32_t) b[0] | ((uint32_t) b[1] << 8) | ((uint32_t) b[2] << 16) | ((uint32_t) b[3] << 24);
+}
+
+static void put_u32(char *buf, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        buf[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+static uint32_t fnv1a(const char *buf, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) buf[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+bool binary_map_detect(const char *text, size_t len) {
+    return len >= 4 && memcmp(text, BINARY_MAP_MAGIC, 4) == 0;
+}
+
+bool binary_map_read(const char *text, size_t len, struct GameState *state) {
+    if (len < BINARY_MAP_HEADER || get_u32(text + 4) != BINARY_MAP_VERSION) {
+        fprintf(stderr, "Invalid compiled map: unknown version (compile it again with pas_mapc)\n");
+        return false;
+    }
+    uint32_t width      = get_u32(text + 8);
+    uint32_t height     = get_u32(text + 12);
+    uint32_t food_count = get_u32(text + 16);
+    if (width == 0 || height == 0 || width > MAP_MAX_WIDTH || height > MAP_MAX_HEIGHT) {
+        fprintf(stderr, "Invalid compiled map: %ux%u tiles, at most %dx%d expected\n",
+                width, height, MAP_MAX_WIDTH, MAP_MAX_HEIGHT);
+        return false;
+    }
+    size_t size = (size_t) width * height;
+    if (len != BINARY_MAP_HEADER + size) {
+        fprintf(stderr, "Invalid compiled map: truncated\n");
+        return false;
+    }
+    const char *tiles = text + BINARY_MAP_HEADER;
+    if (fnv1a(tiles, size) != get_u32(text + 36)) {
+        fprintf(stderr, "Invalid compiled map: bad checksum\n");
+        return false;
+    }
+
+    // The checksum only tells that the file is what pas_mapc wrote: its
+    // content is checked as parse_map checks a map file
+    size_t foods = 0;
+    for (size_t i = 0; i < size; i++) {
+        switch ((unsigned char) tiles[i]) {
+        case FOOD:
+        case SUPERFOOD:
+            foods++;
+            break;
+        case 0:
+        case WALL:
+        case FLOOR:
+            break;
+        default:
+            fprintf(stderr, "Invalid compiled map: row %zu, column %zu: unknown tile %u\n",
+                    i / width + 1, i % width + 1, (unsigned char) tiles[i]);
+            return false;
+        }
+    }
+    if (foods != food_count) {
+        fprintf(stderr, "Invalid compiled map: %u food tiles announced, %zu found\n", food_count, foods);
+        return false;
+    }
+
+    struct Position positions[NB_PLAYERS];
+    for (int i = 0; i < NB_PLAYERS; i++) {
+        positions[i].x = get_u32(text + 20 + 8 * i);
+        positions[i].y = get_u32(text + 24 + 8 * i);
+        if (positions[i].x >= width || positions[i].y >= height) {
+            fprintf(stderr, "Invalid compiled map: player %d is out of the map\n", i + 1);
+            return false;
+        }
+        if (tiles[(size_t) positions[i].y * width + positions[i].x] != FLOOR) {
+            fprintf(stderr, "Invalid compiled map: player %d is not on a floor tile\n", i + 1);
+            return false;
+        }
+    }
+    if (positions[0].x == positions[1].x && positions[0].y == positions[1].y) {
+        fprintf(stderr, "Invalid compiled map: both players are on the same tile\n");
+        return false;
+    }
+
+    resize_gamestate(state, width, height);
+    memcpy(state->positions, positions, sizeof(positions));
+    memcpy(state->map, tiles, size);
+    state->food_count = food_count;
+    return true;
+}
+
+void binary_map_write(const struct GameState *state, FileDescriptor fd) {
+    size_t size = (size_t) state->width * state->height;
+    size_t len  = BINARY_MAP_HEADER + size;
+    char *buf   = smalloc(len);
+    memcpy(buf, BINARY_MAP_MAGIC, 4);
+    put_u32(buf + 4, BINARY_MAP_VERSION);
+    put_u32(buf + 8, state->width);
+    put_u32(buf + 12, state->height);
+    put_u32(buf + 16, state->food_count);
+    for (int i = 0; i < NB_PLAYERS; i++) {
+        put_u32(buf + 20 + 8 * i, state->positions[i].x);
+        put_u32(buf + 24 + 8 * i, state->positions[i].y);
+    }
+
+    memcpy(buf + BINARY_MAP_HEADER, state->map, size);
+    put_u32(buf + 36, fnv1a(buf + BINARY_MAP_HEADER, size));
+
+    swrite(fd, buf, len);
+    free(buf);
+}
@@ -0,0 +1,45 @@
+#ifndef __MAP_BINARY__
+#define __MAP_BINARY__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "game.h"
+
+// A compiled map, as written by pas_mapc. Every field is a little-endian
+// u32 but the tiles, which are bytes so that they can be copied as they are
+// into GameState:
+//
+//   offset  0  magic "PCMB"
+//           4  version (BINARY_MAP_VERSION)
+//           8  width (at most MAP_MAX_WIDTH)
+//          12  height (at most MAP_MAX_HEIGHT)
+//          16  food count (FOOD and SUPERFOOD tiles)
+//          20  x, y of player 1
+//          28  x, y of player 2
+//          36  checksum (FNV-1a of the tiles)
+//          40  tiles: width * height items, row by row, one byte each (0
+//              where a row of the map file was too short)
+//
+// The file is checked like a map read from its text (see parse_map): known
+// tiles only, as many food tiles as counted, and each player on a floor
+// tile of its own.
+//
+// Version 1 stored each tile as a u32, for maps of 30x20 tiles only, and
+// version 2 followed the tiles with the offset of each food tile.
+#define BINARY_MAP_MAGIC "PCMB"
+#define BINARY_MAP_VERSION 3
+#define BINARY_MAP_HEADER 40
+
+// Does the content of a map file start like a compiled map ?
+bool binary_map_detect(const char *text, size_t len);
+
+// Fills 'state' (which must have been initialised) from a compiled map. Returns
+// false, after telling why on stderr, if it is corrupted or does not fit.
+bool binary_map_read(const char *text, size_t len, struct GameState *state);
+
+// Writes the map of 'state' to 'fd' in the compiled format.
+void binary_map_write(const struct GameState *state, FileDescriptor fd);
+
+#endif //__MAP_BINARY__
@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "utils_v3.h"
+#include "map_pool.h"
+#include "trace.h"
+
+struct MapPool {
+    struct PreparedMap *maps;
+    size_t count;
+    // Index of the map the next game is played on
+    size_t next;
+};
+
+// Parses the map once, and encodes the messages which start a game on it
+static bool prepare_map(struct PreparedMap *map, const char *file) {
+    map->file = strdup(file);
+    checkNull(map->file, "strdup");
+    outbox_init(&map->stream);
+    init_gamestate(&map->state);
+
+    int fd = open(file, O_RDONLY);
+    if (fd < 0) {
+        perror(file);
+        return false;
+    }
+    uint64_t start = trace_begin();
+    bool valid     = parse_map(fd, &map->state);
+    trace_end("parse_map", start);
+    close(fd);
+    if (!valid) {
+        fprintf(stderr, "Cannot use map %s\n", file);
+        return false;
+    }
+    send_map_snapshot_to(&map->state, &map->stream);
+    start_game_to(&map->state, &map->stream);
+    return true;
+}
+
+struct MapPool *map_pool_create(const char *files) {
+    struct MapPool *pool = smalloc(sizeof(struct MapPool));
+    memset(pool, 0, sizeof(struct MapPool));
+
+    char *list = strdup(files);
+    checkNull(list, "strdup");
+    char *saveptr = NULL;
+    for (char *file = strtok_r(list, ",", &saveptr); file != NULL; file = strtok_r(NULL, ",", &saveptr)) {
+        pool->maps = realloc(pool->maps, (pool->count + 1) * sizeof(struct PreparedMap));
+        checkNull(pool->maps, "realloc maps");
+        if (!prepare_map(&pool->maps[pool->count++], file)) {
+            free(list);
+            map_pool_destroy(pool);
+            return NULL;
+        }
+    }
+    free(list);
+
+    if (pool->count == 0) {
+        fprintf(stderr, "No map given\n");
+        map_pool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+size_t map_pool_size(const struct MapPool *pool) {
+    return pool->count;
+}
+
+const struct PreparedMap *map_pool_next(struct MapPool *pool) {
+    const struct PreparedMap *map = &pool->maps[pool->next];
+    pool->next = (pool->next + 1) % pool->count;
+    return map;
+}
+
+void map_pool_start(const struct PreparedMap *map, struct GameState *state, struct Outbox *out) {
+    uint64_t start = trace_begin();
+    copy_gamestate(state, &map->state);
+    outbox_push_all(out, map->stream.msgs, map->stream.len);
+    trace_end("map_pool_start", start);
+}
+
+void map_pool_destroy(struct MapPool *pool) {
+    for (size_t i = 0; i < pool->count; i++) {
+        free(pool->maps[i].file);
+        outbox_free(&pool->maps[i].stream);
+        free_gamestate(&pool->maps[i].state);
+    }
+    free(pool->maps);
+    free(pool);
+}
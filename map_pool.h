@@ -0,0 +1,41 @@
+#ifndef __MAP_POOL__
+#define __MAP_POOL__
+
+#include <stddef.h>
+
+#include "game.h"
+
+// A map parsed once and for all: starting a game on it costs a copy of its
+// state and of its initial messages, no parsing nor encoding.
+struct PreparedMap {
+    // The file it was read from
+    char *file;
+    // The state of a game which just started on this map
+    struct GameState state;
+    // Every message needed to draw the map (and the GAME_OVER of a map with
+    // nothing to eat), in the order they must be sent
+    struct Outbox stream;
+};
+
+// The maps a server plays on, in turn.
+struct MapPool;
+
+// Prepares every map of 'files', a comma-separated list of map files.
+// Returns NULL, after telling why on stderr, if one of them cannot be used.
+struct MapPool *map_pool_create(const char *files);
+
+// Number of maps of the pool.
+size_t map_pool_size(const struct MapPool *pool);
+
+// The map the next game is played on: the maps are handed out in turn.
+// Only one thread (or process) may pick the maps of a pool.
+const struct PreparedMap *map_pool_next(struct MapPool *pool);
+
+// Starts a game on 'map': its state is copied to 'state' (which must have
+// been initialised, see init_gamestate), and its initial messages are
+// appended to 'out'.
+void map_pool_start(const struct PreparedMap *map, struct GameState *state, struct Outbox *out);
+
+void map_pool_destroy(struct MapPool *pool);
+
+#endif //__MAP_POOL__
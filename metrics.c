@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "utils_v3.h"
+#include "histogram.h"
+#include "metrics.h"
+
+// Room needed by the page of metrics
+#define METRICS_PAGE 16384
+// Scrapers waiting to be answered
+#define METRICS_BACKLOG 8
+
+static struct Metrics local;
+struct Metrics *metrics = &local;
+
+static const char *phase_names[METRICS_PHASES] = { "idle", "registration", "game" };
+
+static const char *type_names[METRICS_TYPES] = {
+    "registration", "spawn", "movement", "eat_food", "game_over", "map_snapshot", "protocol"
+};
+
+void metrics_init(struct Metrics *m) {
+    memset(m, 0, sizeof(struct Metrics));
+    atomic_store(&m->phase_since_ns, now_ns());
+}
+
+void metrics_count(_Atomic uint64_t *counter, uint64_t n) {
+    atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+}
+
+void metrics_gauge(_Atomic int64_t *gauge, int64_t delta) {
+    atomic_fetch_add_explicit(gauge, delta, memory_order_relaxed);
+}
+
+void metrics_phase(int phase) {
+    uint64_t now = now_ns();
+    int previous = atomic_exchange(&metrics->phase, phase);
+    uint64_t since = atomic_exchange(&metrics->phase_since_ns, now);
+    metrics_count(&metrics->phase_ns[previous], now - since);
+}
+
+void metrics_workers(int count) {
+    if (count > METRICS_WORKERS) {
+        count = METRICS_WORKERS;
+    }
+    int seen = atomic_load(&metrics->workers);
+    while (seen < count && !atomic_compare_exchange_weak(&metrics->workers, &seen, count)) {
+    }
+}
+
+//#############################################################################
+// MESSAGES
+//#############################################################################
+
+// Number of slots taken by the message at the start of 'msgs' (the tiles
+// following a MAP_SNAPSHOT included), at most 'count'
+static size_t message_slots(const union Message *msgs, size_t count) {
+    size_t slots = 1;
+    if (msgs->msgt == MAP_SNAPSHOT) {
+        slots += SNAPSHOT_SLOTS(msgs->snapshot.width, msgs->snapshot.rows);
+    }
+    return slots < count ? slots : count;
+}
+
+static void count_out(uint32_t type, uint64_t messages, uint64_t bytes) {
+    if (type < METRICS_TYPES) {
+        metrics_count(&metrics->messages_out[type], messages);
+        metrics_count(&metrics->bytes_out[type], bytes);
+    }
+}
+
+void metrics_out_v1(const union Message *msgs, size_t count, size_t *tiles_left) {
+    size_t i = 0;
+    if (*tiles_left > 0) {
+        i = *tiles_left < count ? *tiles_left : count;
+        *tiles_left -= i;
+        count_out(MAP_SNAPSHOT, 0, i * sizeof(union Message));
+    }
+    while (i < count) {
+        size_t slots = message_slots(&msgs[i], count - i);
+        if (msgs[i].msgt == MAP_SNAPSHOT) {
+            *tiles_left = SNAPSHOT_SLOTS(msgs[i].snapshot.width, msgs[i].snapshot.rows) - (slots - 1);
+        }
+        count_out(msgs[i].msgt, 1, slots * sizeof(union Message));
+        i += slots;
+    }
+}
+
+size_t metrics_out_v2(struct V2Codec *codec, const union Message *msgs, size_t count, uint8_t *buf) {
+    size_t len = 0;
+    size_t i   = 0;
+    if (codec->slots_left > 0) {
+        i = codec->slots_left < count ? codec->slots_left : count;
+        size_t n = v2_encode(codec, msgs, i, buf);
+        count_out(MAP_SNAPSHOT, 0, n);
+        len += n;
+    }
+    while (i < count) {
+        size_t slots = message_slots(&msgs[i], count - i);
+        size_t n     = v2_encode(codec, &msgs[i], slots, buf + len);
+        count_out(msgs[i].msgt, 1, n);
+        len += n;
+        i   += slots;
+    }
+    return len;
+}
+
+//#############################################################################
+// EXPORT
+//#############################################################################
+
+// Appends to the page, which is silently truncated once full
+static void append(char *buf, size_t cap, size_t *len, const char *format, ...) {
+    if (*len + 1 >= cap) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf + *len, cap - *len, format, args);
+    va_end(args);
+    if (n > 0) {
+        *len = *len + n < cap ? *len + n : cap - 1;
+    }
+}
+
+static void describe(char *buf, size_t cap, size_t *len, const char *name, const char *type, const char *help) {
+    append(buf, cap, len, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+size_t metrics_render(const struct Metrics *m, char *buf, size_t cap) {
+    size_t len = 0;
+    buf[0]     = '\0';
+
+    describe(buf, cap, &len, "pas_connections_accepted_total", "counter", "Connections accepted.");
+    append(buf, cap, &len, "pas_connections_accepted_total %" PRIu64 "\n", atomic_load(&m->connections));
+    describe(buf, cap, &len, "pas_connections_open", "gauge", "Connections currently open.");
+    append(buf, cap, &len, "pas_connections_open %" PRId64 "\n", atomic_load(&m->connections_open));
+    describe(buf, cap, &len, "pas_rooms_open", "gauge", "Rooms waiting for their players or being played.");
+    append(buf, cap, &len, "pas_rooms_open %" PRId64 "\n", atomic_load(&m->rooms_open));
+    describe(buf, cap, &len, "pas_spectators_open", "gauge", "Spectators currently connected.");
+    append(buf, cap, &len, "pas_spectators_open %" PRId64 "\n", atomic_load(&m->spectators_open));
+    describe(buf, cap, &len, "pas_spectator_bytes_out_total", "counter", "Bytes written to the spectators.");
+    append(buf, cap, &len, "pas_spectator_bytes_out_total %" PRIu64 "\n", atomic_load(&m->spectator_bytes_out));
+    describe(buf, cap, &len, "pas_commands_received_total", "counter", "Commands received from the players.");
+    append(buf, cap, &len, "pas_commands_received_total %" PRIu64 "\n", atomic_load(&m->commands_in));
+
+    describe(buf, cap, &len, "pas_messages_sent_total", "counter", "Messages written to the players.");
+    for (int i = 0; i < METRICS_TYPES; i++) {
+        append(buf, cap, &len, "pas_messages_sent_total{type=\"%s\"} %" PRIu64 "\n",
+               type_names[i], atomic_load(&m->messages_out[i]));
+    }
+    describe(buf, cap, &len, "pas_bytes_sent_total", "counter", "Bytes of messages written to the players.");
+    for (int i = 0; i < METRICS_TYPES; i++) {
+        append(buf, cap, &len, "pas_bytes_sent_total{type=\"%s\"} %" PRIu64 "\n",
+               type_names[i], atomic_load(&m->bytes_out[i]));
+    }
+
+    describe(buf, cap, &len, "pas_semaphore_waits_total", "counter", "Waits on a semaphore.");
+    append(buf, cap, &len, "pas_semaphore_waits_total %" PRIu64 "\n", atomic_load(&m->sem_waits));
+    describe(buf, cap, &len, "pas_semaphore_wait_seconds_total", "counter", "Time spent waiting on semaphores.");
+    append(buf, cap, &len, "pas_semaphore_wait_seconds_total %.6f\n", atomic_load(&m->sem_wait_ns) / 1e9);
+    describe(buf, cap, &len, "pas_broadcast_queue_depth", "gauge", "Messages produced by the games and not written to a player yet.");
+    append(buf, cap, &len, "pas_broadcast_queue_depth %" PRId64 "\n", atomic_load(&m->queue_depth));
+
+    // The current phase is not over yet: its time so far is added on the fly
+    int phase      = atomic_load(&m->phase);
+    uint64_t since = atomic_load(&m->phase_since_ns);
+    uint64_t now   = now_ns();
+    describe(buf, cap, &len, "pas_phase", "gauge", "Current phase of the server.");
+    for (int i = 0; i < METRICS_PHASES; i++) {
+        append(buf, cap, &len, "pas_phase{phase=\"%s\"} %d\n", phase_names[i], i == phase);
+    }
+    describe(buf, cap, &len, "pas_phase_seconds_total", "counter", "Time spent in each phase.");
+    for (int i = 0; i < METRICS_PHASES; i++) {
+        uint64_t ns = atomic_load(&m->phase_ns[i]) + (i == phase && now > since ? now - since : 0);
+        append(buf, cap, &len, "pas_phase_seconds_total{phase=\"%s\"} %.3f\n", phase_names[i], ns / 1e9);
+    }
+
+    int workers = atomic_load(&m->workers);
+    if (workers > 0) {
+        describe(buf, cap, &len, "pas_worker_tasks_total", "counter", "Tasks run by each worker thread.");
+        for (int i = 0; i < workers; i++) {
+            append(buf, cap, &len, "pas_worker_tasks_total{worker=\"%d\"} %" PRIu64 "\n",
+                   i, atomic_load(&m->worker_executed[i]));
+        }
+        describe(buf, cap, &len, "pas_worker_tasks_stolen_total", "counter", "Tasks a worker thread took from the queue of another.");
+        for (int i = 0; i < workers; i++) {
+            append(buf, cap, &len, "pas_worker_tasks_stolen_total{worker=\"%d\"} %" PRIu64 "\n",
+                   i, atomic_load(&m->worker_stolen[i]));
+        }
+        describe(buf, cap, &len, "pas_worker_busy_seconds_total", "counter", "Time each worker thread spent running tasks.");
+        for (int i = 0; i < workers; i++) {
+            append(buf, cap, &len, "pas_worker_busy_seconds_total{worker=\"%d\"} %.6f\n",
+                   i, atomic_load(&m->worker_busy_ns[i]) / 1e9);
+        }
+    }
+    return len;
+}
+
+bool metrics_unix_socket(const char *addr) {
+    return addr[0] == '\0' || strspn(addr, "0123456789") != strlen(addr);
+}
+
+FileDescriptor metrics_listen(const char *addr) {
+    FileDescriptor fd;
+    if (!metrics_unix_socket(addr)) {
+        int port = atoi(addr);
+        fd = ssocket();
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        struct sockaddr_in sin;
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family      = AF_INET;
+        sin.sin_port        = htons(port);
+        sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        checkNeg(bind(fd, (struct sockaddr *) &sin, sizeof(sin)), "metrics bind error");
+    } else {
+        struct sockaddr_un sun;
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        if (strlen(addr) >= sizeof(sun.sun_path)) {
+            fprintf(stderr, "Metrics socket path too long: %s\n", addr);
+            exit(EXIT_FAILURE);
+        }
+        strcpy(sun.sun_path, addr);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        checkNeg(fd, "metrics socket error");
+        // A server which did not stop cleanly may have left it behind
+        unlink(addr);
+        checkNeg(bind(fd, (struct sockaddr *) &sun, sizeof(sun)), "metrics bind error");
+    }
+    slisten(fd, METRICS_BACKLOG);
+    return fd;
+}
+
+// Reads the request (whatever it is, only its end matters) and answers it.
+// A client which says nothing is answered after a second anyway.
+static void metrics_answer(FileDescriptor fd, char *page) {
+    struct timeval timeout = { .tv_sec = 1, .tv_usec = 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    char request[1024];
+    size_t got = 0;
+    while (got < sizeof(request) - 1) {
+        ssize_t n = read(fd, request + got, sizeof(request) - 1 - got);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        got += n;
+        request[got] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL) {
+            break;
+        }
+    }
+
+    size_t len = metrics_render(metrics, page, METRICS_PAGE);
+    char header[128];
+    int header_len = snprintf(header, sizeof(header),
+        "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", len);
+    if (send(fd, header, header_len, MSG_NOSIGNAL) == header_len) {
+        send(fd, page, len, MSG_NOSIGNAL);
+    }
+    shutdown(fd, SHUT_WR);
+    close(fd);
+}
+
+void metrics_serve(FileDescriptor listener) {
+    char *page = smalloc(METRICS_PAGE);
+    while (true) {
+        FileDescriptor fd = accept(listener, NULL, NULL);
+        if (fd < 0 && errno == EINTR) {
+            continue;
+        }
+        checkNeg(fd, "metrics accept failure");
+        metrics_answer(fd, page);
+    }
+}
@@ -0,0 +1,100 @@
+#ifndef __METRICS__
+#define __METRICS__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "game.h"
+#include "protocol_v2.h"
+
+// Number of server phases (see ServerPhase) and of message types (see
+// enum MessageType) the metrics are broken down by
+#define METRICS_PHASES 3
+#define METRICS_TYPES 7
+// Worker threads of the epoll server whose counters are exported
+#define METRICS_WORKERS 32
+
+// Counters and gauges of the whole server, as exported by metrics_serve.
+// They hold no pointer, so they can live in shared memory: every process
+// and thread updates them with relaxed atomic operations, and nobody ever
+// takes a lock to do so.
+struct Metrics {
+    // Connections accepted so far, and those still open
+    _Atomic uint64_t connections;
+    _Atomic int64_t connections_open;
+    // Rooms (i.e. games) waiting for their players or being played
+    _Atomic int64_t rooms_open;
+    // Spectators connected, and the bytes written to them
+    _Atomic int64_t spectators_open;
+    _Atomic uint64_t spectator_bytes_out;
+    // Commands received from the players, before any rate limit
+    _Atomic uint64_t commands_in;
+    // Messages written to the players, and the bytes they took on the wire
+    // (tiles of a MAP_SNAPSHOT included, headers of version 2 batches
+    // excluded), per type
+    _Atomic uint64_t messages_out[METRICS_TYPES];
+    _Atomic uint64_t bytes_out[METRICS_TYPES];
+    // Time spent waiting on semaphores, and how many waits it took
+    _Atomic uint64_t sem_waits;
+    _Atomic uint64_t sem_wait_ns;
+    // Messages produced by the games and not written to a player yet
+    _Atomic int64_t queue_depth;
+    // The current phase, since when (see now_ns), and the time spent in
+    // each phase before it
+    _Atomic int phase;
+    _Atomic uint64_t phase_since_ns;
+    _Atomic uint64_t phase_ns[METRICS_PHASES];
+    // Worker threads running the games of the epoll server (the most any
+    // of its processes has), the tasks each of them ran, how many of those
+    // it stole from another worker, and the time it spent running them.
+    // Processes add up the counters of their workers of the same index.
+    _Atomic int workers;
+    _Atomic uint64_t worker_executed[METRICS_WORKERS];
+    _Atomic uint64_t worker_stolen[METRICS_WORKERS];
+    _Atomic uint64_t worker_busy_ns[METRICS_WORKERS];
+};
+
+// Where every part of the server counts. It always points somewhere: to a
+// process-local instance until the server moves it to shared memory.
+extern struct Metrics *metrics;
+
+// Zeroes the metrics, the server being idle from now on.
+void metrics_init(struct Metrics *m);
+
+// Adds 'n' to a counter, or 'delta' to a gauge.
+void metrics_count(_Atomic uint64_t *counter, uint64_t n);
+void metrics_gauge(_Atomic int64_t *gauge, int64_t delta);
+
+// The server enters 'phase' (a ServerPhase).
+void metrics_phase(int phase);
+
+// A process of the server runs its games on 'count' worker threads.
+void metrics_workers(int count);
+
+// Counts 'count' messages written in version 1 of the protocol. A
+// MAP_SNAPSHOT may be split across several calls: '*tiles_left' is the
+// number of its tile slots still to come, 0 at first.
+void metrics_out_v1(const union Message *msgs, size_t count, size_t *tiles_left);
+
+// Encodes 'count' messages like v2_encode does, and counts them.
+size_t metrics_out_v2(struct V2Codec *codec, const union Message *msgs, size_t count, uint8_t *buf);
+
+// Writes the metrics as a Prometheus text page into 'buf', which holds
+// 'cap' bytes. Returns its length (truncated to cap - 1).
+size_t metrics_render(const struct Metrics *m, char *buf, size_t cap);
+
+// Is 'addr' the path of a Unix socket rather than a TCP port ?
+bool metrics_unix_socket(const char *addr);
+
+// Opens the socket the metrics are served on: a TCP port on the loopback
+// interface if 'addr' is a number, else the path of a Unix socket (which
+// the caller removes once done).
+FileDescriptor metrics_listen(const char *addr);
+
+// Answers every HTTP request made on 'listener' with the current page of
+// metrics, one at a time. Never returns.
+void metrics_serve(FileDescriptor listener);
+
+#endif //__METRICS__
@@ -1,6 +1,9 @@
 #include "utils_v3.h"
 #include "game.h"
 #include "pascman.h"
+#include "protocol_v2.h"
+#include "framing.h"
+#include "socket_tuning.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,12 +13,17 @@
 #include <poll.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
 
 #define SERVER_IP "127.0.0.1"
 #define SERVER_PORT 74912
 #define UI_PATH "./pas-cman-ipl"
-#define BUFFER_SIZE 1024
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
+// How many times a player tries to get its seat back after losing the
+// connection, and how long it waits before each attempt
+#define RESUME_ATTEMPTS 10
+#define RESUME_DELAY_US 1000000
 
 // Global variables for cleanup
 int server_socket = -1;
@@ -24,6 +32,7 @@ int client_to_ui_pipe[2] = {-1, -1};
 pid_t ui_pid = -1;
 bool running = true;
 bool test_mode = false;
+bool spectating = false; // Watching a game instead of playing it (see -spectate)
 
 void cleanup() {
     // Close socket
@@ -86,8 +95,11 @@ bool handle_game_over(union Message *msg, int player_id, int client_to_ui_fd, st
     // Display message in terminal with clear visual separation
     printf("\n==================================\n");
     printf("GAME OVER! Player %d wins!\n", winner_id);
+    printf("Final score: %u - %u\n", msg->game_over.scores[0], msg->game_over.scores[1]);
     
-    if (player_id == winner_id) {
+    if (spectating) {
+        printf("*** END OF THE GAME ***\n");
+    } else if (player_id == winner_id) {
         printf("*** YOU WIN! ***\n");
     } else {
         printf("*** YOU LOSE! ***\n");
@@ -100,6 +112,8 @@ bool handle_game_over(union Message *msg, int player_id, int client_to_ui_fd, st
     ui_msg.msgt = GAME_OVER;
     ui_msg.game_over.msgt = GAME_OVER;
     ui_msg.game_over.winner = winner_id;
+    ui_msg.game_over.scores[0] = msg->game_over.scores[0];
+    ui_msg.game_over.scores[1] = msg->game_over.scores[1];
     
     printf("Sending GAME_OVER to UI: player_id=%d, winner=%d\n", 
            player_id, winner_id);
@@ -123,6 +137,209 @@ bool handle_game_over(union Message *msg, int player_id, int client_to_ui_fd, st
     return true;
 }
 
+/**
+ * What the client knows of its conversation with the server
+ */
+struct Session {
+    int player_id;
+    bool game_over;
+    int message_count;
+    // The version of the protocol the server speaks to us, and what the
+    // decoder remembers of the messages received in version 2
+    int version;
+    struct V2Codec codec;
+    // What has been received from the server but not processed yet
+    struct InputBuffer in;
+    // The session token received with REGISTRATION (0 if the server does
+    // not let us resume), and how many times we tried to resume since the
+    // last message of the server
+    uint64_t token;
+    int resume_attempts;
+};
+
+/**
+ * Forward a message to the UI
+ *
+ * The UI always speaks version 1 of the protocol: the tiles of a MAP_SNAPSHOT
+ * follow its header, padded to a whole number of messages.
+ */
+void forward_to_ui(const union Message *msg, const uint8_t *tiles, int client_to_ui_fd) {
+    if (swrite(client_to_ui_fd, msg, sizeof(union Message)) < 0) {
+        perror("Failed to forward message to UI");
+        return;
+    }
+    if (msg->msgt == MAP_SNAPSHOT) {
+        size_t count   = msg->snapshot.width * msg->snapshot.rows;
+        size_t padded  = SNAPSHOT_SLOTS(msg->snapshot.width, msg->snapshot.rows) * sizeof(union Message);
+        char zeros[sizeof(union Message)] = {0};
+        if (swrite(client_to_ui_fd, tiles, count) < 0
+            || (padded > count && swrite(client_to_ui_fd, zeros, padded - count) < 0)) {
+            perror("Failed to forward map snapshot to UI");
+            return;
+        }
+    }
+    fsync(client_to_ui_fd); // Ensure message is sent immediately
+}
+
+/**
+ * Handle a message of the server, whatever the version it was encoded in
+ */
+void process_server_message(struct Session *session, const union Message *msg, const uint8_t *tiles,
+                            int client_to_ui_fd, struct pollfd *server_poll_fd) {
+    session->message_count++;
+    session->resume_attempts = 0;
+    printf("Client received message #%d of type %d\n", session->message_count, msg->msgt);
+
+    // Forward message to UI (always, except for GAME_OVER which we handle
+    // specially, and PROTOCOL which only concerns the connection)
+    if (msg->msgt != GAME_OVER && msg->msgt != PROTOCOL) {
+        if (msg->msgt == SPAWN) {
+            printf("Forwarding SPAWN: id=%u, item=%d, pos=(%u,%u)\n", 
+                   msg->spawn.id, msg->spawn.item, msg->spawn.pos.x, msg->spawn.pos.y);
+        }
+        forward_to_ui(msg, tiles, client_to_ui_fd);
+    }
+
+    // Special handling for certain message types
+    switch (msg->msgt) {
+        case REGISTRATION:
+            session->player_id = msg->registration.player;
+            session->token     = msg->registration.session[0] | (uint64_t) msg->registration.session[1] << 32;
+            printf("Registered as Player %d\n", session->player_id);
+            // Ask for the compact encoding if the server speaks it
+            if (msg->registration.versions & (1u << PROTOCOL_V2)) {
+                uint32_t request = PROTOCOL_V2_REQUEST;
+                if (write(server_socket, &request, sizeof(request)) < 0) {
+                    perror("Failed to request protocol v2");
+                }
+            }
+            break;
+
+        case SPAWN:
+            printf("Received SPAWN: id=%u, item=%d, pos=(%u,%u)\n", 
+                   msg->spawn.id, msg->spawn.item, msg->spawn.pos.x, msg->spawn.pos.y);
+            break;
+
+        case MAP_SNAPSHOT:
+            printf("Received MAP_SNAPSHOT: %ux%u, rows %u to %u\n",
+                   msg->snapshot.width, msg->snapshot.height,
+                   msg->snapshot.y, msg->snapshot.y + msg->snapshot.rows - 1);
+            break;
+
+        case PROTOCOL:
+            printf("Server switched to protocol v%u\n", msg->protocol.version);
+            session->version = msg->protocol.version;
+            v2_init(&session->codec);
+            break;
+
+        case GAME_OVER: {
+            // Acknowledge the final message: the server closes
+            // the connection as soon as it gets it
+            uint32_t ack = GAME_OVER_ACK;
+            if (write(server_socket, &ack, sizeof(ack)) < 0) {
+                perror("Failed to acknowledge GAME_OVER");
+            }
+            // Special handling for game over
+            session->game_over = handle_game_over((union Message *) msg, session->player_id,
+                                                  client_to_ui_fd, server_poll_fd);
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+/**
+ * Handle every complete message received from the server so far
+ *
+ * In version 1, a message is 20 bytes (plus its tiles for a MAP_SNAPSHOT).
+ * In version 2, messages come in batches which are handled once received
+ * whole. Returns false if the server sent something that makes no sense.
+ */
+bool process_server_input(struct Session *session, int client_to_ui_fd, struct pollfd *server_poll_fd) {
+    while (server_poll_fd->fd != -1) {
+        // The version may change with any message, hence a frame at a time
+        bool v2 = session->version == PROTOCOL_V2;
+        ssize_t size;
+        const uint8_t *frame = input_next(&session->in, v2 ? v2_batch_size : v1_message_size, &size);
+        if (frame == NULL) {
+            return size == 0;
+        }
+
+        if (!v2) {
+            union Message msg;
+            memcpy(&msg, frame, sizeof(msg));
+            process_server_message(session, &msg, frame + sizeof(msg), client_to_ui_fd, server_poll_fd);
+            continue;
+        }
+        for (size_t at = V2_BATCH_HEADER; at < (size_t) size && server_poll_fd->fd != -1; ) {
+            union Message msg;
+            const uint8_t *tiles = NULL;
+            ssize_t record = v2_decode(&session->codec, frame + at, size - at, &msg, &tiles);
+            if (record < 0) {
+                return false;
+            }
+            process_server_message(session, &msg, tiles, client_to_ui_fd, server_poll_fd);
+            at += record;
+        }
+    }
+    return true;
+}
+
+/**
+ * Try to get our seat back after losing the connection to the server
+ *
+ * A new connection presents the session token received with REGISTRATION.
+ * The server answers with REGISTRATION and a snapshot of the game, or
+ * closes the connection if our seat is no longer held: the next attempt
+ * then starts when that is noticed. Returns false once every attempt failed.
+ */
+bool resume_session(struct Session *session, const char *server_ip, int server_port, bool low_latency) {
+    if (server_socket != -1) {
+        sclose(server_socket);
+        server_socket = -1;
+    }
+    while (running && session->resume_attempts < RESUME_ATTEMPTS) {
+        session->resume_attempts++;
+        printf("Connection lost, resuming the game (attempt %d/%d)...\n", session->resume_attempts, RESUME_ATTEMPTS);
+        usleep(RESUME_DELAY_US);
+
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port   = htons(server_port);
+        inet_aton(server_ip, &addr.sin_addr);
+        int fd = ssocket();
+        if (low_latency) {
+            socket_low_latency(fd);
+        }
+        if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+            perror("Failed to reconnect");
+            sclose(fd);
+            continue;
+        }
+
+        uint8_t request[RESUME_FRAME_SIZE];
+        uint32_t word = RESUME_REQUEST;
+        memcpy(request, &word, sizeof(word));
+        memcpy(request + sizeof(word), &session->token, sizeof(session->token));
+        if (write(fd, request, sizeof(request)) != sizeof(request)) {
+            perror("Failed to send the session token");
+            sclose(fd);
+            continue;
+        }
+
+        // Everything starts over on the new connection, in version 1
+        server_socket    = fd;
+        session->version = PROTOCOL_V1;
+        input_free(&session->in);
+        input_init(&session->in);
+        return true;
+    }
+    return false;
+}
+
 int main(int argc, char *argv[]) {
     printf("Starting PAS-CMAN client...\n");
     
@@ -136,9 +353,20 @@ int main(int argc, char *argv[]) {
     if (argc >= 3) {
         server_port = atoi(argv[2]);
     }
-    if (argc >= 4 && strcmp(argv[3], "-test") == 0) {
-        test_mode = true;
-        printf("Running in test mode - reading movements from stdin\n");
+    bool low_latency = false;
+    // With -spectate, the port is the one spectators connect to, and the
+    // room to watch follows (0 for the game started last)
+    uint32_t room = 0;
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "-test") == 0) {
+            test_mode = true;
+            printf("Running in test mode - reading movements from stdin\n");
+        } else if (strcmp(argv[i], "-nodelay") == 0) {
+            low_latency = true;
+        } else if (strcmp(argv[i], "-spectate") == 0 && i + 1 < argc) {
+            spectating = true;
+            room = atoi(argv[++i]);
+        }
     }
     
     
@@ -202,8 +430,15 @@ int main(int argc, char *argv[]) {
     // Connect to server
     printf("Connecting to server at %s:%d...\n", server_ip, server_port);
     server_socket = ssocket();
+    if (low_latency) {
+        socket_low_latency(server_socket);
+    }
     sconnect(server_ip, server_port, server_socket);
     printf("Connected to server\n");
+    if (spectating) {
+        printf("Watching room %u\n", room);
+        swrite(server_socket, &room, sizeof(room));
+    }
     
     // Set up polling for server and UI/stdin
     struct pollfd poll_fds[3];  // Make sure we have space for 3 fds
@@ -227,9 +462,12 @@ int main(int argc, char *argv[]) {
     }
     
     // Main client loop
-    bool game_over = false;
-    int player_id = 0;
-    int message_count = 0;
+    struct Session session;
+    memset(&session, 0, sizeof(session));
+    session.version = PROTOCOL_V1;
+    input_init(&session.in);
+    struct InputBuffer ui_in;
+    input_init(&ui_in);
     
     while (running) {
         int poll_result = spoll(poll_fds, poll_count, 500);
@@ -237,9 +475,6 @@ int main(int argc, char *argv[]) {
         if (poll_result > 0) {
             // Check for data from server
             if (poll_fds[0].revents & POLLIN) {
-                union Message msg;
-                memset(&msg, 0, sizeof(union Message));
-                
                 // Try to read the message from server
                 struct sigaction old_action;
                 // Temporarily ignore SIGPIPE
@@ -249,18 +484,25 @@ int main(int argc, char *argv[]) {
                 temp_action.sa_flags = 0;
                 sigaction(SIGPIPE, &temp_action, &old_action);
                 
-                ssize_t bytes_read = read(server_socket, &msg, sizeof(union Message));
+                ssize_t bytes_read = input_fill(&session.in, server_socket);
                 
                 // Restore original signal handling
                 sigaction(SIGPIPE, &old_action, NULL);
                 
                 if (bytes_read <= 0) {
+                    // A player holding a session may get its seat back
+                    if (!session.game_over && session.token != 0
+                        && resume_session(&session, server_ip, server_port, low_latency)) {
+                        poll_fds[0].fd = server_socket;
+                        continue;
+                    }
+
                     // Handle connection reset specially
                     if (errno == ECONNRESET || errno == 0) {
                         printf("Connection reset or closed by server - assuming game is over\n");
                         
                         // If we didn't already see a GAME_OVER message, create one
-                        if (!game_over && poll_fds[0].fd != -1) {
+                        if (!session.game_over && poll_fds[0].fd != -1) {
                             printf("Creating synthetic game over message\n");
                             
                             // Create a synthetic game over message
@@ -270,9 +512,9 @@ int main(int argc, char *argv[]) {
                             synthetic_msg.game_over.msgt = GAME_OVER;
                             
                             // If player_id is set, we might be the winner
-                            if (player_id > 0) {
-                                synthetic_msg.game_over.winner = player_id;
-                                printf("Game ended unexpectedly - Assuming Player %d won\n", player_id);
+                            if (session.player_id > 0) {
+                                synthetic_msg.game_over.winner = session.player_id;
+                                printf("Game ended unexpectedly - Assuming Player %d won\n", session.player_id);
                             } else {
                                 // Default to player 1 if we don't know our player ID
                                 synthetic_msg.game_over.winner = 1;
@@ -280,7 +522,7 @@ int main(int argc, char *argv[]) {
                             }
                             
                             // Use our helper function to handle the game over state
-                            game_over = handle_game_over(&synthetic_msg, player_id, client_to_ui_pipe[1], &poll_fds[0]);
+                            session.game_over = handle_game_over(&synthetic_msg, session.player_id, client_to_ui_pipe[1], &poll_fds[0]);
                             continue;
                         }
                     }
@@ -290,44 +532,11 @@ int main(int argc, char *argv[]) {
                     break;
                 }
                 
-                // Process received message
-                message_count++;
-                printf("Client received message #%d of type %d\n", message_count, msg.msgt);
-                
-                // Forward message to UI (always, except for GAME_OVER which we handle specially)
-                if (msg.msgt != GAME_OVER) {
-                    if (msg.msgt == SPAWN) {
-                        printf("Forwarding SPAWN: id=%u, item=%d, pos=(%u,%u)\n", 
-                               msg.spawn.id, msg.spawn.item, msg.spawn.pos.x, msg.spawn.pos.y);
-                    }
-                    
-                    // Always forward messages to UI regardless of mode
-                    if (swrite(client_to_ui_pipe[1], &msg, sizeof(union Message)) < 0) {
-                        perror("Failed to forward message to UI");
-                    } else {
-                        fsync(client_to_ui_pipe[1]); // Ensure message is sent immediately
-                    }
-                }
-                
-                // Special handling for certain message types
-                switch (msg.msgt) {
-                    case REGISTRATION:
-                        player_id = msg.registration.player;
-                        printf("Registered as Player %d\n", player_id);
-                        break;
-                        
-                    case SPAWN:
-                        printf("Received SPAWN: id=%u, item=%d, pos=(%u,%u)\n", 
-                               msg.spawn.id, msg.spawn.item, msg.spawn.pos.x, msg.spawn.pos.y);
-                        break;
-                        
-                    case GAME_OVER:
-                        // Special handling for game over
-                        game_over = handle_game_over(&msg, player_id, client_to_ui_pipe[1], &poll_fds[0]);
-                        break;
-                        
-                    default:
-                        break;
+                // Process every message received whole
+                if (!process_server_input(&session, client_to_ui_pipe[1], &poll_fds[0])) {
+                    printf("Malformed data received from server\n");
+                    running = false;
+                    break;
                 }
             }
             
@@ -396,8 +605,7 @@ int main(int argc, char *argv[]) {
             // Handle UI input (both in normal and test mode)
             int ui_poll_fd_index = test_mode ? 2 : 1;
             if (poll_fds[ui_poll_fd_index].revents & POLLIN) {
-                enum Direction dir;
-                ssize_t bytes_read = sread(poll_fds[ui_poll_fd_index].fd, &dir, sizeof(enum Direction));
+                ssize_t bytes_read = input_fill(&ui_in, poll_fds[ui_poll_fd_index].fd);
                 
                 if (bytes_read <= 0) {
                     printf("UI disconnected\n");
@@ -405,17 +613,32 @@ int main(int argc, char *argv[]) {
                     break;
                 }
                 
-                // If we're in game over state, any input means "exit"
-                if (game_over || poll_fds[0].fd == -1) {
-                    printf("User pressed key after game over, exiting...\n");
-                    running = false;
-                    break;
+                // Every direction the UI sent since the last wakeup
+                ssize_t size;
+                const uint8_t *frame;
+                while (running && (frame = input_next(&ui_in, command_frame_size, &size)) != NULL) {
+                    // If we're in game over state, any input means "exit"
+                    if (session.game_over || poll_fds[0].fd == -1) {
+                        printf("User pressed key after game over, exiting...\n");
+                        running = false;
+                        break;
+                    }
+
+                    // A spectator has nobody to steer
+                    if (spectating) {
+                        continue;
+                    }
+
+                    // Otherwise forward direction to server
+                    enum Direction dir;
+                    memcpy(&dir, frame, sizeof(dir));
+                    printf("Sending direction %d to server from UI\n", dir);
+                    if (swrite(server_socket, &dir, sizeof(enum Direction)) <= 0) {
+                        perror("Failed to send direction to server");
+                    }
                 }
-                
-                // Otherwise forward direction to server
-                printf("Sending direction %d to server from UI\n", dir);
-                if (swrite(server_socket, &dir, sizeof(enum Direction)) <= 0) {
-                    perror("Failed to send direction to server");
+                if (!running) {
+                    break;
                 }
             }
             
@@ -437,6 +660,8 @@ int main(int argc, char *argv[]) {
         // If poll timeout, just continue to check running periodically
     }
     
+    input_free(&session.in);
+    input_free(&ui_in);
     printf("Client shutting down\n");
     return EXIT_SUCCESS;
 }
\ No newline at end of file
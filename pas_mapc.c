@@ -0,0 +1,38 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "utils_v3.h"
+#include "game.h"
+#include "map_binary.h"
+
+// Compiles a map into the binary format of map_binary.h, which the server
+// copies into its GameState instead of parsing it. The map given may be a
+// text map or an already compiled one (which is then checked and rewritten).
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s map.txt map.pcm\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int in = open(argv[1], O_RDONLY);
+    if (in < 0) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+    struct GameState state;
+    init_gamestate(&state);
+    bool valid = parse_map(in, &state);
+    close(in);
+    if (!valid) {
+        return EXIT_FAILURE;
+    }
+
+    int out = sopen(argv[2], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    binary_map_write(&state, out);
+    sclose(out);
+    printf("%s: %ux%u tiles, %d food\n", argv[2], state.width, state.height, state.food_count);
+    free_gamestate(&state);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "utils_v3.h"
+#include "game.h"
+#include "histogram.h"
+#include "recording.h"
+
+// Time the interface takes to show up, before a paced replay starts (see
+// exemple.c)
+#define REPLAY_UI_DELAY_US 2000000
+
+// Settings of the replay, as given on the command line
+struct ReplayConfig {
+    const char *file;
+    // Player the interface plays as
+    int player;
+    // Playback speed (1 for real time), 0 to replay as fast as possible
+    double speed;
+    // Where the replay starts, in ns since the recording started
+    uint64_t seek_ns;
+};
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s recording.pcr [-player N] [-speed X | -max] [-seek SECONDS]\n", name);
+    fprintf(stderr, "Streams a game recorded by pas_server -record to stdout, e.g. %s game.pcr | pas-cman-ipl\n", name);
+    exit(EXIT_FAILURE);
+}
+
+static void parse_args(int argc, char *argv[], struct ReplayConfig *config) {
+    if (argc < 2) {
+        usage(argv[0]);
+    }
+    config->file    = argv[1];
+    config->player  = 1;
+    config->speed   = 1;
+    config->seek_ns = 0;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-player") == 0 && i + 1 < argc && (atoi(argv[i + 1]) == 1 || atoi(argv[i + 1]) == 2)) {
+            config->player = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-speed") == 0 && i + 1 < argc && atof(argv[i + 1]) > 0) {
+            config->speed = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-max") == 0) {
+            config->speed = 0;
+        } else if (strcmp(argv[i], "-seek") == 0 && i + 1 < argc && atof(argv[i + 1]) >= 0) {
+            config->seek_ns = atof(argv[++i]) * 1e9;
+        } else {
+            usage(argv[0]);
+        }
+    }
+}
+
+// Offset of the header of the last keyframe recorded at or before
+// 'seek_ns', -1 if there is none. Only the record headers are read.
+static long find_keyframe(FILE *file, uint64_t seek_ns) {
+    long found = -1;
+    long offset = ftell(file);
+    struct RecordHeader header;
+    while (recording_next(file, &header) && header.time_ns <= seek_ns) {
+        if (header.type == RECORD_KEYFRAME) {
+            found = offset;
+        }
+        if (fseek(file, recording_payload(&header), SEEK_CUR) != 0) {
+            break;
+        }
+        offset = ftell(file);
+    }
+    return found;
+}
+
+// Waits until the message recorded at 'time_ns' is due
+static void wait_until(const struct ReplayConfig *config, uint64_t wall_start, uint64_t origin_ns, uint64_t time_ns) {
+    if (config->speed <= 0 || time_ns <= origin_ns) {
+        return;
+    }
+    uint64_t due = wall_start + (uint64_t) ((time_ns - origin_ns) / config->speed);
+    uint64_t now = now_ns();
+    if (due > now) {
+        struct timespec delay = { .tv_sec = (due - now) / 1000000000u, .tv_nsec = (due - now) % 1000000000u };
+        while (nanosleep(&delay, &delay) != 0) {
+            continue;
+        }
+    }
+}
+
+// Replays a recording into the interface listening on stdout. Seeking
+// starts from the last keyframe before the seek point: the interface gets
+// the map as it was then, and the messages up to the seek point are
+// written at once.
+int main(int argc, char *argv[]) {
+    struct ReplayConfig config;
+    parse_args(argc, argv, &config);
+
+    FILE *file = fopen(config.file, "rb");
+    if (file == NULL) {
+        perror(config.file);
+        return EXIT_FAILURE;
+    }
+    if (!recording_check(file)) {
+        return EXIT_FAILURE;
+    }
+
+    struct Outbox out;
+    outbox_init_fd(&out, STDOUT_FILENO);
+    send_registered_to(config.player, &out);
+
+    long start = ftell(file);
+    long keyframe = config.seek_ns > 0 ? find_keyframe(file, config.seek_ns) : -1;
+    struct RecordHeader header;
+    if (keyframe >= 0) {
+        struct GameState state;
+        init_gamestate(&state);
+        fseek(file, keyframe, SEEK_SET);
+        if (!recording_next(file, &header) || !recording_keyframe(file, &header, &state)) {
+            fprintf(stderr, "Truncated keyframe\n");
+            return EXIT_FAILURE;
+        }
+        send_map_snapshot_to(&state, &out);
+        free_gamestate(&state);
+        fprintf(stderr, "Starting from the keyframe at %.3f s\n", header.time_ns / 1e9);
+    } else {
+        fseek(file, start, SEEK_SET);
+    }
+
+    if (config.speed > 0) {
+        usleep(REPLAY_UI_DELAY_US);
+    }
+    uint64_t wall_start = now_ns();
+    uint64_t origin_ns  = config.seek_ns;
+    bool first          = config.seek_ns == 0;
+
+    union Message *msgs = NULL;
+    size_t cap          = 0;
+    size_t replayed     = 0;
+    while (recording_next(file, &header)) {
+        if (header.type != RECORD_MESSAGES) {
+            fseek(file, recording_payload(&header), SEEK_CUR);
+            continue;
+        }
+        if (header.count > cap) {
+            cap  = header.count;
+            msgs = realloc(msgs, cap * sizeof(union Message));
+            checkNull(msgs, "realloc messages");
+        }
+        if (fread(msgs, sizeof(union Message), header.count, file) != header.count) {
+            fprintf(stderr, "Truncated recording\n");
+            break;
+        }
+        // Without seeking, the replay starts with the first batch
+        if (first) {
+            origin_ns = header.time_ns;
+            first     = false;
+        }
+        wait_until(&config, wall_start, origin_ns, header.time_ns);
+        swrite(STDOUT_FILENO, msgs, header.count * sizeof(union Message));
+        replayed += header.count;
+    }
+    fprintf(stderr, "%zu messages replayed in %.3f s\n", replayed, (now_ns() - wall_start) / 1e9);
+
+    free(msgs);
+    fclose(file);
+    return EXIT_SUCCESS;
+}
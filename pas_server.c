@@ -1,6 +1,23 @@
 #include "utils_v3.h"
 #include "game.h"
 #include "pascman.h"
+#include "server.h"
+#include "epoll_server.h"
+#include "command_ring.h"
+#include "broadcast_ring.h"
+#include "protocol_v2.h"
+#include "map_pool.h"
+#include "tick.h"
+#include "framing.h"
+#include "rate_limit.h"
+#include "arbiter.h"
+#include "histogram.h"
+#include "socket_tuning.h"
+#include "metrics.h"
+#include "trace.h"
+#include "recording.h"
+#include "event_fds.h"
+#include "handover.h"
 #include <stdlib.h>
 #include <fcntl.h>
 #include <signal.h>
@@ -12,44 +29,77 @@
 #include <stdbool.h>
 #include <poll.h>
 #include <errno.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+#include <sys/eventfd.h>
 
 #define KEY 84937
 #define PERM 0660
 #define SERVER_PORT 74912
-#define BACKLOG 5
-#define REGISTRATION_TIMEOUT 30 // 30 seconds timeout for registration
-#define MAX_CLIENTS 2
-#define DEFAULT_MAP_FILE "./resources/map.txt"
 
 // Semaphores
 #define SEM_KEY 84938
-#define SEM_MUTEX 0
-#define SEM_SYNC 1
+#define SEM_SYNC 0
 
-// Server phases
-typedef enum {
-    PHASE_IDLE,           // Server is waiting for first player to connect
-    PHASE_REGISTRATION,   // Registration phase (after first player connected)
-    PHASE_GAME            // Game in progress
-} ServerPhase;
-
-// Forward declaration for function not exposed in game.h
-void send_game_over(enum Item winner, FileDescriptor fdbcast);
+// Everything the processes of a game share. The state of the game is not
+// part of it: the game owner keeps it to itself, sized to the map (see
+// GameState). Each client handler pushes the commands of its player into
+// its own ring, and the game owner drains them.
+//
+// The other way around, the game owner publishes the messages of the game
+// once in 'broadcast', and each client handler forwards them to its own
+// client at its own pace.
+struct SharedGame {
+    struct CommandRing commands[MAX_CLIENTS];
+    struct BroadcastRing broadcast;
+    // Set by a client handler once its player is gone
+    _Atomic bool left[MAX_CLIENTS];
+    // Set by the game owner once the game is over
+    _Atomic bool over;
+    // Set along with 'over' if the game came to its end (GAME_OVER was
+    // published) rather than being abandoned
+    _Atomic bool finished;
+    // Set by the game owner before it blocks on 'wakeup_fd'
+    _Atomic bool owner_sleeping;
+    // Set by the game owner while it waits for room in 'broadcast' to
+    // stream the map: the client handlers then wake it up once they
+    // forwarded something
+    _Atomic bool owner_streaming;
+};
 
 // Global variables for cleanup
 int sockfd = -1;
+FileDescriptor listeners[MAX_WORKERS]; // One per worker of the epoll server, the first is 'sockfd'
+int listener_count = 0;
+FileDescriptor spectator_listener = -1; // The socket spectators connect to, if any
+FileDescriptor metrics_listener = -1; // Kept open to be handed over
 int shm_id = -1;
+int metrics_shm_id = -1;
 int sem_id = -1;
-int broadcast_pipe[2] = {-1, -1};
-pid_t broadcaster_pid = -1;
+int wakeup_fd = -1;
+int client_wakeup_fds[MAX_CLIENTS] = {-1, -1};
+int signal_fd = -1; // SIGINT and SIGCHLD, once the main process waits for them
+int registration_timer = -1; // Expires REGISTRATION_TIMEOUT after the first player connects
+pid_t game_owner_pid = -1;
 pid_t client_handlers[MAX_CLIENTS] = {-1, -1};
+pid_t metrics_pid = -1;
+pid_t worker_pids[MAX_WORKERS];
+int worker_count = 0;
+char **server_argv = NULL; // Run again by a hand-over
+pid_t server_pid = -1; // The children inherit the atexit handler, not the duty to clean up
 bool running = true;
 bool shutdown_requested = false; // Flag to track if SIGINT was received
-bool registration_timed_out = false; // Flag to track registration timeout
 ServerPhase current_phase = PHASE_IDLE; // Current server phase
 char *g_map_file = DEFAULT_MAP_FILE;
+struct MapPool *map_pool = NULL; // Every map of g_map_file, parsed at startup
+struct Recorder recorder; // Records the game published by the game owner, if any
+const char *metrics_path = NULL; // The Unix socket the metrics are served on, if any
 
 void cleanup() {
+    if (getpid() != server_pid) {
+        return;
+    }
+
     // Block all signals during cleanup to avoid interruptions
     sigset_t mask_all, prev_mask;
     sigfillset(&mask_all);
@@ -82,41 +132,77 @@ void cleanup() {
             client_handlers[i] = -1;
         }
     }
-      // Kill broadcaster
-    if (broadcaster_pid > 0) {
-        skill(broadcaster_pid, SIGTERM);
-        // Use waitpid with error handling
+    // Kill game owner
+    if (game_owner_pid > 0) {
+        skill(game_owner_pid, SIGTERM);
         int status;
         pid_t result;
         int wait_attempts = 0;
         int max_wait_attempts = 5;
-        
+
         do {
-            result = waitpid(broadcaster_pid, &status, WNOHANG);
+            result = waitpid(game_owner_pid, &status, WNOHANG);
             if (result == 0) {
-                // Process still running, give it a moment
                 usleep(50000); // 50ms delay
                 wait_attempts++;
                 if (wait_attempts >= max_wait_attempts) {
-                    // If we've waited too long, forcibly kill the process
-                    printf("Broadcaster not responding, sending SIGKILL\n");
-                    kill(broadcaster_pid, SIGKILL);
+                    printf("Game owner not responding, sending SIGKILL\n");
+                    kill(game_owner_pid, SIGKILL);
                 }
             }
         } while (result == 0 && wait_attempts < max_wait_attempts*2);
-        
-        broadcaster_pid = -1;
+
+        game_owner_pid = -1;
     }
-    
-    // Close pipes
-    if (broadcast_pipe[0] != -1) {
-        sclose(broadcast_pipe[0]);
-        broadcast_pipe[0] = -1;
+    // Kill the workers of the epoll server
+    for (int i = 0; i < worker_count; i++) {
+        if (worker_pids[i] > 0) {
+            skill(worker_pids[i], SIGTERM);
+            waitpid(worker_pids[i], NULL, 0);
+            worker_pids[i] = -1;
+        }
+    }
+    // Kill the metrics server
+    if (metrics_pid > 0) {
+        skill(metrics_pid, SIGTERM);
+        waitpid(metrics_pid, NULL, 0);
+        metrics_pid = -1;
+    }
+    if (metrics_path != NULL) {
+        unlink(metrics_path);
+        metrics_path = NULL;
+    }
+    // Close eventfds
+    if (wakeup_fd != -1) {
+        sclose(wakeup_fd);
+        wakeup_fd = -1;
+    }
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (client_wakeup_fds[i] != -1) {
+            sclose(client_wakeup_fds[i]);
+            client_wakeup_fds[i] = -1;
+        }
     }
-    if (broadcast_pipe[1] != -1) {
-        sclose(broadcast_pipe[1]);
-        broadcast_pipe[1] = -1;
+    if (signal_fd != -1) {
+        sclose(signal_fd);
+        signal_fd = -1;
     }
+    if (registration_timer != -1) {
+        sclose(registration_timer);
+        registration_timer = -1;
+    }
+    if (metrics_listener != -1) {
+        sclose(metrics_listener);
+        metrics_listener = -1;
+    }
+    if (spectator_listener != -1) {
+        sclose(spectator_listener);
+        spectator_listener = -1;
+    }
+    for (int i = 1; i < listener_count; i++) {
+        sclose(listeners[i]);
+    }
+    listener_count = 0;
     
     // Close server socket - try multiple times if needed
     if (sockfd != -1) {
@@ -135,6 +221,10 @@ void cleanup() {
     if (shm_id != -1) {
         sshmdelete(shm_id);
         shm_id = -1;
+    }
+    if (metrics_shm_id != -1) {
+        sshmdelete(metrics_shm_id);
+        metrics_shm_id = -1;
     }        // Clean up semaphores - try multiple times if needed
     if (sem_id != -1) {
         int sem_attempts = 0;
@@ -150,6 +240,11 @@ void cleanup() {
         sem_id = -1;
     }
     
+    if (map_pool != NULL) {
+        map_pool_destroy(map_pool);
+        map_pool = NULL;
+    }
+
     // Set this flag to prevent double cleanup in some error cases
     static int already_cleaned_up = 0;
     already_cleaned_up = 1;
@@ -165,211 +260,821 @@ void sigusr1_handler(int sig) {
     // Do nothing, this is just to wake up processes blocked in system calls
 }
 
-// Signal handler for SIGINT and SIGALRM
+// Handler for SIGUSR2: every process of the server dumps its trace, the
+// main one asking the others to do the same
+void sigusr2_handler(int sig) {
+    trace_dump();
+    if (getpid() != server_pid) {
+        return;
+    }
+    if (game_owner_pid > 0) {
+        kill(game_owner_pid, SIGUSR2);
+    }
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (client_handlers[i] > 0) {
+            kill(client_handlers[i], SIGUSR2);
+        }
+    }
+    for (int i = 0; i < worker_count; i++) {
+        if (worker_pids[i] > 0) {
+            kill(worker_pids[i], SIGUSR2);
+        }
+    }
+}
+
+// The server stops right away if idle, once the current phase completes
+// otherwise. 'cause' says why.
+void stop_after_phase(const char *cause) {
+    // If we already requested shutdown, don't show the message again
+    if (shutdown_requested) {
+        return;
+    }
+
+    const char *phase_name;
+    switch (current_phase) {
+        case PHASE_IDLE:
+            phase_name = "idle";
+            break;
+        case PHASE_REGISTRATION:
+            phase_name = "registration";
+            break;
+        case PHASE_GAME:
+            phase_name = "game";
+            break;
+        default:
+            phase_name = "unknown";
+    }
+      // Set the shutdown flag
+    shutdown_requested = true;
+    
+    // Only set running=false immediately if we're in IDLE phase
+    if (current_phase == PHASE_IDLE) {
+        printf("%s during %s phase, server will stop immediately\n", cause, phase_name);
+        running = false;
+    } else {
+        printf("%s during %s phase, server will stop after current phase completes\n", cause, phase_name);
+        // For other phases, we'll check the shutdown_requested flag 
+        // when transitioning back to IDLE
+          
+        // For game phase, we should let the game complete
+        if (current_phase == PHASE_GAME) {
+            printf("Server will continue running until the game completes naturally.\n");
+            printf("Clients will continue to operate normally.\n");
+        }
+    }
+}
+
+void request_shutdown(void) {
+    stop_after_phase("SIGINT received");
+}
+
+FileDescriptor start_handover(void) {
+    if (shutdown_requested) {
+        printf("SIGHUP received while stopping, no hand-over\n");
+        return -1;
+    }
+    // The order the successor expects them in: see main
+    FileDescriptor fds[MAX_WORKERS + 2];
+    int count = 0;
+    for (int i = 0; i < listener_count; i++) {
+        fds[count++] = listeners[i];
+    }
+    if (spectator_listener != -1) {
+        fds[count++] = spectator_listener;
+    }
+    if (metrics_listener != -1) {
+        fds[count++] = metrics_listener;
+    }
+    return handover_start(server_argv, fds, count);
+}
+
+bool finish_handover(FileDescriptor fd) {
+    if (!handover_outcome(fd)) {
+        printf("The new server did not start, this one goes on serving\n");
+        return false;
+    }
+    // The successor serves the metrics on the same socket, and counts in
+    // a segment of its own
+    if (metrics_pid > 0) {
+        skill(metrics_pid, SIGTERM);
+        waitpid(metrics_pid, NULL, 0);
+        metrics_pid = -1;
+    }
+    metrics_path = NULL;
+    return true;
+}
+
+// Handler for a SIGINT received before the main process waits for it on
+// 'signal_fd'
 void sigint_handler(int sig) {
-    if (sig == SIGINT) {
-        // If we already requested shutdown, don't show the message again
-        if (shutdown_requested) {
-            return;
+    request_shutdown();
+}
+
+// Handles the signals delivered on 'signal_fd' since the last call. A
+// SIGCHLD only wakes the main process up: the caller reaps its children.
+void handle_signals(void) {
+    int sig;
+    while ((sig = signals_next(signal_fd)) != 0) {
+        if (sig == SIGINT) {
+            request_shutdown();
+        } else if (sig == SIGHUP) {
+            printf("SIGHUP ignored: only the epoll server (-epoll) hands its sockets over\n");
+        }
+    }
+}
+
+void print_flush_stats(const char *who, const struct FlushStats *stats) {
+    printf("%s: %" PRIu64 " bytes sent in %" PRIu64 " flushes, %" PRIu64 " write syscalls (%.2f per flush)\n",
+           who, stats->bytes, stats->flushes, stats->syscalls,
+           stats->flushes > 0 ? (double) stats->syscalls / stats->flushes : 0.0);
+}
+
+void print_input_stats(const char *who, const struct InputStats *stats) {
+    printf("%s: %" PRIu64 " commands accepted, %" PRIu64 " coalesced by the rate limit, %" PRIu64 " client(s) disconnected for flooding\n",
+           who, stats->accepted, stats->coalesced, stats->kicked);
+}
+
+void set_phase(ServerPhase phase) {
+    if (phase != current_phase) {
+        current_phase = phase;
+        metrics_phase(phase);
+    }
+}
+
+// Moves the metrics to shared memory, where every process of the server
+// updates them, and starts the process which serves them on 'addr', or on
+// 'inherited' if it is not -1. The segment has no key: a server and its
+// successor (see handover.h) count apart.
+void start_metrics(const char *addr, FileDescriptor inherited) {
+    metrics_shm_id = sshmget(IPC_PRIVATE, sizeof(struct Metrics), IPC_CREAT | PERM);
+    metrics = sshmat(metrics_shm_id);
+    metrics_init(metrics);
+
+    metrics_listener = inherited != -1 ? inherited : metrics_listen(addr);
+    if (metrics_unix_socket(addr)) {
+        metrics_path = addr;
+    }
+    metrics_pid = sfork();
+    if (metrics_pid == 0) {
+        struct sigaction sa_ignore;
+        sa_ignore.sa_handler = SIG_IGN; // Ignore SIGINT
+        sigemptyset(&sa_ignore.sa_mask);
+        sa_ignore.sa_flags = 0;
+        sigaction(SIGINT, &sa_ignore, NULL);
+
+        for (int i = 0; i < listener_count; i++) {
+            sclose(listeners[i]);
         }
+        if (spectator_listener != -1) {
+            sclose(spectator_listener);
+        }
+        metrics_serve(metrics_listener);
+    }
+    printf("Metrics served on %s\n", addr);
+}
 
-        const char *phase_name;
-        switch (current_phase) {
-            case PHASE_IDLE:
-                phase_name = "idle";
-                break;
-            case PHASE_REGISTRATION:
-                phase_name = "registration";
-                break;
-            case PHASE_GAME:
-                phase_name = "game";
-                break;
-            default:
-                phase_name = "unknown";
+// Opens a socket listening on 'port'. The epoll workers each open one with
+// 'reuse_port' set: the kernel then spreads the connections across them.
+FileDescriptor open_listener(int port, bool reuse_port, int backlog, bool low_latency) {
+    FileDescriptor fd = ssocket();
+    
+    // Set SO_REUSEADDR to allow binding to a recently closed socket
+    int option_value = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &option_value, sizeof(int)) < 0) {
+        perror("Error setting socket options");
+    }
+    if (reuse_port && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &option_value, sizeof(int)) < 0) {
+        perror("Error setting SO_REUSEPORT");
+        exit(EXIT_FAILURE);
+    }
+      
+    // Try to bind with timeout in case previous instance didn't fully release the port
+    int bind_attempts = 0;
+    int max_attempts = 5;
+    while (bind_attempts < max_attempts) {
+        // Try to use sbind from utils_v3
+        int bind_result = sbind(port, fd);
+        
+        if (bind_result == 0) {
+            break; // Successfully bound
         }
-          // Set the shutdown flag
-        shutdown_requested = true;
         
-        // Only set running=false immediately if we're in IDLE phase
-        if (current_phase == PHASE_IDLE) {
-            printf("SIGINT received during %s phase, server will stop immediately\n", phase_name);
-            running = false;
-        } else {
-            printf("SIGINT received during %s phase, server will stop after current phase completes\n", phase_name);
-            // For other phases, we'll check the shutdown_requested flag 
-            // when transitioning back to IDLE
-              
-            // For game phase, we should let the game complete
-            if (current_phase == PHASE_GAME) {
-                printf("Server will continue running until the game completes naturally.\n");
-                printf("Clients will continue to operate normally.\n");
+        // If binding failed, check if it was an "Address already in use" error
+        if (errno != EADDRINUSE) {
+            // This is not the error we're trying to handle, so report it and exit
+            fprintf(stderr, "Failed to bind to port %d: %s\n", port, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        
+        // If binding failed with EADDRINUSE, wait a bit and try again
+        printf("Port %d is in use (attempt %d/%d), waiting 2 seconds...\n", 
+               port, bind_attempts + 1, max_attempts);
+        sleep(2); // Wait longer between attempts
+        bind_attempts++;
+    }
+    
+    if (bind_attempts == max_attempts) {
+        printf("Failed to bind to port %d after %d attempts. Try killing any existing server process.\n", 
+               port, max_attempts);
+        exit(EXIT_FAILURE);
+    }
+    
+    if (low_latency) {
+        socket_low_latency(fd);
+    }
+    slisten(fd, backlog);
+    return fd;
+}
+
+// Starts the worker which accepts on listeners[i]
+void spawn_worker(struct ServerConfig *config, int i) {
+    fflush(stdout);
+    worker_pids[i] = sfork();
+    if (worker_pids[i] == 0) {
+        for (int j = 0; j < listener_count; j++) {
+            if (j != i) {
+                sclose(listeners[j]);
             }
         }
-    } else if (sig == SIGALRM) {
-        printf("Registration timeout: Not enough players connected within 30 seconds\n");
-        registration_timed_out = true; // Set the flag when the alarm occurs
+        char name[32];
+        snprintf(name, sizeof(name), "worker %d", i + 1);
+        trace_process(name);
+        config->worker = i;
+        run_epoll_server(listeners[i], signal_fd, config);
+        exit(EXIT_SUCCESS);
     }
 }
 
-// Custom poll function that handles EINTR (interrupted by signal)
-int poll_with_retry(struct pollfd *fds, nfds_t nfds, int timeout) {
-    int ret;
-    while ((ret = poll(fds, nfds, timeout)) == -1 && errno == EINTR) {
-        // If interrupted by a signal, check if it was SIGALRM during registration
-        if (registration_timed_out) {
-            // Return 0 to indicate timeout, which will cause the main loop to process the timeout
-            return 0;
+// Asks every worker to stop once its games complete. 'cause' says why.
+void stop_workers(const char *cause) {
+    if (!shutdown_requested) {
+        printf("%s, the workers will stop once their games complete\n", cause);
+    }
+    shutdown_requested = true;
+    for (int i = 0; i < worker_count; i++) {
+        if (worker_pids[i] > 0) {
+            kill(worker_pids[i], SIGINT);
         }
-        
-        printf("Poll interrupted by signal, retrying...\n");
+    }
+}
+
+// Runs the epoll server in 'config->workers' processes, each accepting on
+// its own listening socket. This process only relays SIGINT to them, hands
+// the sockets over on SIGHUP and waits for them to exit. A worker which
+// dies is started again: the connections the kernel gives its socket would
+// wait forever otherwise.
+void run_workers(struct ServerConfig *config) {
+    for (int i = 0; i < config->workers; i++) {
+        spawn_worker(config, i);
+        worker_count++;
+    }
+    printf("%d workers accept on port %d\n", config->workers, config->port);
+
+    int workers_left  = worker_count;
+    FileDescriptor handover = -1;
+    while (workers_left > 0) {
+        // poll skips the handover entry while it is -1
+        struct pollfd fds[2] = {
+            { .fd = signal_fd, .events = POLLIN },
+            { .fd = handover,  .events = POLLIN },
+        };
+        int ready = poll(fds, 2, -1);
+        if (ready < 0 && errno == EINTR) {
+            continue; // SIGUSR2
+        }
+        checkNeg(ready, "poll failure");
+
+        int sig;
+        while ((sig = signals_next(signal_fd)) != 0) {
+            if (sig == SIGINT) {
+                stop_workers("SIGINT received");
+            } else if (sig == SIGHUP && handover == -1) {
+                handover = start_handover();
+            }
+        }
+        if (fds[1].revents != 0) {
+            if (finish_handover(handover)) {
+                stop_workers("Handed over to the new server");
+            }
+            handover = -1;
+        }
+        for (int i = 0; i < worker_count; i++) {
+            int status;
+            if (worker_pids[i] <= 0 || waitpid(worker_pids[i], &status, WNOHANG) != worker_pids[i]) {
+                continue;
+            }
+            if (!shutdown_requested) {
+                printf("Worker %d died (status %d), starting it again\n", i + 1, status);
+                spawn_worker(config, i);
+                continue;
+            }
+            printf("Worker %d exited\n", i + 1);
+            worker_pids[i] = -1;
+            workers_left--;
+        }
+    }
+    if (handover != -1) {
+        sclose(handover);
+    }
+}
+
+// Prepares the shared segment for a new game
+void reset_shared_game(struct SharedGame *game) {
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        ring_init(&game->commands[i]);
+        atomic_store(&game->left[i], false);
+    }
+    broadcast_init(&game->broadcast);
+    atomic_store(&game->over, false);
+    atomic_store(&game->finished, false);
+    atomic_store(&game->owner_sleeping, false);
+    atomic_store(&game->owner_streaming, false);
+}
+
+// Wakes the game owner up, but only if it is actually sleeping: as long as
+// it keeps finding commands in the rings, pushing one costs no syscall.
+void wake_game_owner(struct SharedGame *game) {
+    if (atomic_exchange(&game->owner_sleeping, false)) {
+        uint64_t one = 1;
+        swrite(wakeup_fd, &one, sizeof(one));
+    }
+}
+
+// Publishes 'count' messages (produced by commands received at 'input_ns'
+// at the earliest, 0 if none), which brought the game to 'state', and wakes
+// up the client handlers which were waiting for them
+void publish_messages(struct SharedGame *game, const struct GameState *state, const union Message *msgs,
+                      size_t count, uint64_t input_ns) {
+    uint64_t start = trace_begin();
+    broadcast_publish(&game->broadcast, msgs, count, input_ns);
+    recorder_write(&recorder, msgs, count, state);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (broadcast_wake(&game->broadcast, i)) {
+            uint64_t one = 1;
+            swrite(client_wakeup_fds[i], &one, sizeof(one));
+        }
+    }
+    trace_end("broadcast_publish", start);
+}
+
+// Publishes every message accumulated in 'out' (see publish_messages)
+void publish_to_clients(struct SharedGame *game, const struct GameState *state, struct Outbox *out,
+                        uint64_t input_ns) {
+    publish_messages(game, state, out->msgs, out->len, input_ns);
+    outbox_clear(out);
+}
+
+// Is there nothing left for the game owner to do ?
+bool game_owner_idle(struct SharedGame *game) {
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (!ring_empty(&game->commands[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Have all the players left ?
+bool all_players_left(struct SharedGame *game) {
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (!atomic_load(&game->left[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Blocks the game owner until a client handler pushes a command or leaves
+void game_owner_wait(struct SharedGame *game) {
+    atomic_store(&game->owner_sleeping, true);
+    // Something may have been pushed before the flag was raised
+    if (!game_owner_idle(game) || all_players_left(game)) {
+        atomic_store(&game->owner_sleeping, false);
+        return;
+    }
+
+    uint64_t count;
+    while (read(wakeup_fd, &count, sizeof(count)) < 0 && errno == EINTR) {
         continue;
     }
-    
-    // For other errors, use the standard error checking
-    checkNeg(ret, "poll failure");
-    return ret;
 }
 
-// Broadcaster process - reads messages from pipe and forwards to clients
-void broadcaster_process(void* pipe_read_fd) {
-    int read_fd = (int)(long)pipe_read_fd;
-    
-    // Set up polling for the broadcast pipe
-    struct pollfd poll_fd;
-    poll_fd.fd = read_fd;
-    poll_fd.events = POLLIN;
-    
-    while (1) {
-        // Poll for incoming messages
-        int poll_result = poll_with_retry(&poll_fd, 1, -1);
-        
-        if (poll_result > 0 && (poll_fd.revents & POLLIN)) {
-            // Nous allons lire le message complet
-            union Message msg;
-            memset(&msg, 0, sizeof(union Message));
-            ssize_t bytes_read = sread(read_fd, &msg, sizeof(union Message));
-            
-            if (bytes_read <= 0) {
-                break;  // Pipe closed
+// Can 'count' more messages be published without overwriting any that a
+// client handler still there did not forward yet ?
+bool broadcast_has_room(struct SharedGame *game, size_t count) {
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (!atomic_load(&game->left[i]) && !broadcast_fits(&game->broadcast, i, count)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Blocks the game owner until 'count' more messages fit in the broadcast
+// ring (see broadcast_has_room)
+void game_owner_wait_room(struct SharedGame *game, size_t count) {
+    atomic_store(&game->owner_streaming, true);
+    while (!broadcast_has_room(game, count)) {
+        atomic_store(&game->owner_sleeping, true);
+        // A handler may have forwarded something before the flag was raised
+        if (broadcast_has_room(game, count)) {
+            atomic_store(&game->owner_sleeping, false);
+            break;
+        }
+        uint64_t wakeups;
+        while (read(wakeup_fd, &wakeups, sizeof(wakeups)) < 0 && errno == EINTR) {
+            continue;
+        }
+    }
+    atomic_store(&game->owner_streaming, false);
+}
+
+// Publishes the messages which start the game on 'state', accumulated in
+// 'out'. However large the map, they never overrun the broadcast ring: they
+// are published one MAP_SNAPSHOT chunk at a time (see send_map_snapshot_to),
+// each once the client handlers forwarded enough of the previous ones.
+void stream_to_clients(struct SharedGame *game, const struct GameState *state, struct Outbox *out) {
+    for (size_t start = 0; start < out->len;) {
+        size_t len = snapshot_chunk_len(out->msgs + start, out->len - start);
+        game_owner_wait_room(game, len);
+        publish_messages(game, state, out->msgs + start, len, 0);
+        start += len;
+    }
+    outbox_clear(out);
+}
+
+// Runs the game at a fixed timestep: the game owner sleeps until each tick,
+// drains the commands pushed since the previous one (the last direction of
+// each player wins), moves the players and publishes what the tick produced
+// at once. It never needs to be woken up by the client handlers.
+void game_owner_ticks(struct SharedGame *game, struct GameState *state, struct Arbiter *arbiter,
+                      struct Outbox *out, int tick_rate) {
+    struct TickClock clock;
+    struct Ticker ticker;
+    tick_clock_start(&clock, tick_rate);
+    ticker_init(&ticker);
+
+    while (!state->game_over) {
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &clock.next, NULL) == EINTR) {
+            continue;
+        }
+        if (all_players_left(game)) {
+            printf("All players left, the game is abandoned\n");
+            return;
+        }
+
+        // The oldest command drained, to which this tick answers
+        uint64_t now   = now_ns();
+        uint64_t input = 0;
+        for (int i = 0; i < MAX_CLIENTS; i++) {
+            enum Direction dir;
+            uint64_t received;
+            while (ring_pop(&game->commands[i], &dir, &received)) {
+                arbiter_record(arbiter, i, received, now);
+                ticker_input(&ticker, i, dir);
+                input = input == 0 || received < input ? received : input;
             }
-            
-            printf("Broadcaster: received message type %d\n", msg.msgt);
-            
-            // Dans le broadcaster, nous ne pouvons pas directement envoyer aux clients
-            // car les sockets clients sont gérés par le processus principal
-            // Nous allons donc juste traiter et afficher les messages
-            
-            switch (msg.msgt) {
-                case SPAWN:
-                    printf("Broadcaster: received SPAWN message for item %d at position (%u,%u)\n",
-                          msg.spawn.item, msg.spawn.pos.x, msg.spawn.pos.y);
-                    break;
-                    
-                case MOVEMENT:
-                    printf("Broadcaster: received MOVEMENT message for item %u to position (%u,%u)\n",
-                          msg.movement.id, msg.movement.pos.x, msg.movement.pos.y);
-                    break;
-                    
-                case EAT_FOOD:
-                    printf("Broadcaster: received EAT_FOOD message, eater %u ate food %u\n",
-                          msg.eat_food.eater, msg.eat_food.food);
-                    break;
-                    
-                case GAME_OVER:
-                    printf("Broadcaster: received GAME_OVER message, winner is Player %d\n",
-                          msg.game_over.winner);
-                    break;
-                    
-                default:
-                    printf("Broadcaster: received unhandled message type %d\n", msg.msgt);
-                    break;
+        }
+        for (unsigned due = tick_clock_due(&clock); due > 0 && !state->game_over; due--) {
+            ticker_step(&ticker, arbiter, state, out);
+        }
+        if (out->len > 0) {
+            publish_to_clients(game, state, out, input);
+        }
+    }
+}
+
+// Game owner process: the only one which updates the game state. It starts
+// the game on 'map', then applies the commands of both players in rounds of
+// one command per player (see arbiter.h), or at each tick if 'tick_rate' is
+// not 0. Everything it publishes is recorded to 'record_path', unless it is
+// NULL.
+void game_owner(const struct PreparedMap *map, int tick_rate, const char *record_path) {
+    int shm_id = sshmget(KEY, sizeof(struct SharedGame), 0);
+    struct SharedGame *game = sshmat(shm_id);
+    if (record_path != NULL && recorder_open(&recorder, record_path)) {
+        printf("Recording the game to %s\n", record_path);
+    }
+    int sem_id = sem_get(SEM_KEY, 1);
+    struct Outbox out;
+    outbox_init(&out);
+    struct Arbiter arbiter;
+    arbiter_init(&arbiter);
+    struct GameState state;
+    init_gamestate(&state);
+
+    // The registration message of each player must reach it before the map
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        uint64_t start = now_ns();
+        sem_down(sem_id, SEM_SYNC);
+        metrics_count(&metrics->sem_waits, 1);
+        metrics_count(&metrics->sem_wait_ns, now_ns() - start);
+        trace_end("sem_down", start);
+    }
+
+    printf("Starting the game on map %s\n", map->file);
+    map_pool_start(map, &state, &out);
+    stream_to_clients(game, &state, &out);
+    printf("Map sent to clients\n");
+
+    bool game_running = tick_rate <= 0;
+    if (!game_running) {
+        game_owner_ticks(game, &state, &arbiter, &out, tick_rate);
+    }
+    while (game_running) {
+        int served = 0;
+        // The oldest command which produced a message of this round
+        uint64_t input = 0;
+        for (int k = 0; k < MAX_CLIENTS && game_running; k++) {
+            int i = arbiter_player(&arbiter, k);
+            enum Direction dir;
+            uint64_t received;
+            if (ring_pop(&game->commands[i], &dir, &received)) {
+                served++;
+                arbiter_record(&arbiter, i, received, now_ns());
+                size_t before  = out.len;
+                uint64_t start = trace_begin();
+                game_running   = !process_user_command_to(&state, i == 0 ? PLAYER1 : PLAYER2, dir, &out);
+                trace_end("process_user_command", start);
+                if (out.len > before && (input == 0 || received < input)) {
+                    input = received;
+                }
+            }
+        }
+        arbiter_next_round(&arbiter, served);
+        bool idle = served == 0;
+        publish_to_clients(game, &state, &out, input);
+        if (game_running && idle) {
+            if (all_players_left(game)) {
+                printf("All players left, the game is abandoned\n");
+                break;
             }
+            game_owner_wait(game);
         }
     }
-    
-    sclose(read_fd);
+
+    if (state.game_over) {
+        // Determine the winner based on scores according to game rules
+        enum Item winner_item = state.scores[0] > state.scores[1] ? PLAYER1 : PLAYER2;
+
+        // The final scores have been published along with the last move
+        printf("Game over - Player %d wins with score %d vs %d\n",
+            winner_item == PLAYER1 ? 1 : 2,
+            state.scores[winner_item == PLAYER1 ? 0 : 1],
+            state.scores[winner_item == PLAYER1 ? 1 : 0]);
+    }
+    arbiter_print("Game", &arbiter);
+    // The client handlers leave once they have forwarded everything: wake
+    // them up so that they notice
+    atomic_store(&game->finished, state.game_over);
+    atomic_store(&game->over, true);
+    publish_to_clients(game, &state, &out, 0);
+    recorder_close(&recorder, &state);
+
+    outbox_free(&out);
+    free_gamestate(&state);
+    sshmdt(game);
+    // Its spans would be lost with it
+    trace_dump();
     exit(EXIT_SUCCESS);
 }
 
-// Structure pour stocker les messages à diffuser
-struct BroadcastMessage {
-    union Message msg;
-    int client_count;
-    int client_sockets[MAX_CLIENTS];
-};
+// Writes everything published since 'cursor' to the client with a single
+// sendmsg (unless the socket is full). In version 1 of the protocol, the
+// messages are written straight from the shared ring. In version 2, they
+// are first encoded as one batch with 'codec' into 'scratch', which must
+// hold V2_MAX_SIZE(BROADCAST_RING_SIZE) bytes ('codec' is NULL in version 1).
+//
+// Once the messages are written, the time since the oldest command they
+// answer was received is recorded in 'latency'.
+//
+// Returns false if the client is gone or lagged so far behind that it
+// missed some messages.
+bool forward_to_client(struct SharedGame *game, int client_num, int client_socket, uint64_t *cursor,
+                       struct V2Codec *codec, uint8_t *scratch, struct FlushStats *stats,
+                       struct Histogram *latency) {
+    struct iovec iov[2];
+    struct msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = iov;
 
-// Fonction pour diffuser un message à tous les clients connectés
-void broadcast_to_clients(union Message *msg, int client_sockets[], int client_count) {
-    for (int i = 0; i < client_count; i++) {
-        if (client_sockets[i] != -1) {
-            swrite(client_sockets[i], msg, sizeof(union Message));
+    int iovcnt;
+    ssize_t count = broadcast_peek(&game->broadcast, *cursor, iov, &iovcnt);
+    if (count > 0 && codec != NULL) {
+        size_t len = 0;
+        for (int i = 0; i < iovcnt; i++) {
+            len += metrics_out_v2(codec, iov[i].iov_base, iov[i].iov_len / sizeof(union Message),
+                                  scratch + V2_BATCH_HEADER + len);
+        }
+        v2_batch_header(scratch, len);
+        iov[0].iov_base = scratch;
+        iov[0].iov_len  = V2_BATCH_HEADER + len;
+        iovcnt = 1;
+    } else if (count > 0) {
+        size_t tiles_left = 0;
+        for (int i = 0; i < iovcnt; i++) {
+            metrics_out_v1(iov[i].iov_base, iov[i].iov_len / sizeof(union Message), &tiles_left);
         }
     }
-    
-    // Pour GAME_OVER, envoyer deux fois pour assurer la livraison
-    if (msg->msgt == GAME_OVER) {
-        usleep(100000); // Attendre 100ms
-        for (int i = 0; i < client_count; i++) {
-            if (client_sockets[i] != -1) {
-                swrite(client_sockets[i], msg, sizeof(union Message));
+    // The messages wait in the queue for as long as the socket is full
+    metrics_gauge(&metrics->queue_depth, count > 0 ? count : 0);
+    uint64_t start = trace_begin();
+    if (count > 0) {
+        stats->flushes++;
+        hdr.msg_iovlen = iovcnt;
+        size_t len = 0;
+        for (int i = 0; i < iovcnt; i++) {
+            len += iov[i].iov_len;
+        }
+        while (len > 0) {
+            ssize_t sent = sendmsg(client_socket, &hdr, MSG_NOSIGNAL);
+            stats->syscalls++;
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+            if (sent < 0) {
+                perror("Failed to forward message to client");
+                metrics_gauge(&metrics->queue_depth, -count);
+                trace_end("forward_to_client", start);
+                return false;
+            }
+            stats->bytes += sent;
+            len          -= sent;
+
+            // Skips what has been written already
+            while (hdr.msg_iovlen > 0 && (size_t) sent >= hdr.msg_iov->iov_len) {
+                sent -= hdr.msg_iov->iov_len;
+                hdr.msg_iov++;
+                hdr.msg_iovlen--;
+            }
+            if (hdr.msg_iovlen > 0) {
+                hdr.msg_iov->iov_base = (char *) hdr.msg_iov->iov_base + sent;
+                hdr.msg_iov->iov_len -= sent;
+            }
+        }
+    }
+    metrics_gauge(&metrics->queue_depth, count > 0 ? -count : 0);
+    if (count > 0) {
+        trace_end("forward_to_client", start);
+    }
+    uint64_t input = count > 0 ? broadcast_input_ns(&game->broadcast, *cursor, count) : 0;
+    if (count < 0 || broadcast_overrun(&game->broadcast, *cursor)) {
+        printf("Client %d is too slow and missed some messages\n", client_num);
+        return false;
+    }
+    if (input != 0) {
+        histogram_record(latency, now_ns() - input);
+    }
+    *cursor += count;
+    if (count > 0) {
+        broadcast_ack(&game->broadcast, client_num - 1, *cursor);
+        // The game owner may be waiting for room to stream the map
+        if (atomic_load(&game->owner_streaming)) {
+            wake_game_owner(game);
+        }
+    }
+    return true;
+}
+
+// Waits (at most GAME_OVER_ACK_TIMEOUT seconds) for the client to
+// acknowledge GAME_OVER, or to hang up. Whatever else it sends meanwhile
+// is ignored. 'in' holds what the client sent and has not been handled yet.
+void wait_game_over_ack(int client_num, int client_socket, struct InputBuffer *in) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += GAME_OVER_ACK_TIMEOUT;
+
+    struct pollfd poll_fd;
+    poll_fd.fd     = client_socket;
+    poll_fd.events = POLLIN;
+
+    while (true) {
+        ssize_t size;
+        const uint8_t *frame;
+        while ((frame = input_next(in, command_frame_size, &size)) != NULL) {
+            uint32_t word;
+            memcpy(&word, frame, sizeof(word));
+            if (word == GAME_OVER_ACK) {
+                printf("Client %d acknowledged GAME_OVER\n", client_num);
+                return;
             }
         }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long timeout = (deadline.tv_sec - now.tv_sec) * 1000 + (deadline.tv_nsec - now.tv_nsec) / 1000000;
+        if (timeout <= 0) {
+            printf("Client %d did not acknowledge GAME_OVER, closing\n", client_num);
+            return;
+        }
+
+        int poll_result = poll(&poll_fd, 1, timeout);
+        if (poll_result < 0 && errno == EINTR) {
+            continue;
+        }
+        checkNeg(poll_result, "poll failure");
+        if (poll_result == 0) {
+            continue;
+        }
+
+        if (input_fill(in, client_socket) <= 0) {
+            printf("Client %d disconnected after GAME_OVER\n", client_num);
+            return;
+        }
     }
 }
 
-// Client handler process
-void client_handler(int client_num, int client_socket) {
+// Client handler process: reads the commands of its player and pushes them
+// to the game owner, at most 'rate_limit' per second (if not 0), and
+// forwards to its player every message the game owner publishes.
+void client_handler(int client_num, int client_socket, int rate_limit) {
     // Register with the game interface
     send_registered(client_num, client_socket);
-    
+    union Message registration = { .registration = { .msgt = REGISTRATION } };
+    size_t no_tiles = 0;
+    metrics_out_v1(&registration, 1, &no_tiles);
+
     // Attach to shared memory
-    int shm_id = sshmget(KEY, sizeof(struct GameState), 0);
-    struct GameState *state = sshmat(shm_id);
-    
-    // Set up semaphores
-    int sem_id = sem_get(SEM_KEY, 2);
-    
-    enum Item player = (client_num == 1) ? PLAYER1 : PLAYER2;
-    char direction_buffer[4];
-    int game_running = 1;
-    
-    // Wait for both clients to be ready before Player 1 loads the map
-    if (client_num == 1) {
-        printf("Player 1 waiting for Player 2 to connect...\n");
-        sem_down(sem_id, SEM_SYNC);  // Wait for Player 2 to signal
-        
-        // Add a small delay to ensure both clients are fully ready
-        usleep(100000);  // 100ms
-        
-        // Load map and broadcast initial state
-        printf("Loading map from %s\n", g_map_file);
-        FileDescriptor map_fd = sopen(g_map_file, O_RDONLY, 0);
-        if (map_fd >= 0) {
-            load_map(map_fd, broadcast_pipe[1], state);
-            sclose(map_fd);
-            printf("Map loaded and sent to clients\n");
-        } else {
-            perror("Failed to open map file");
-            exit(EXIT_FAILURE);
+    int shm_id = sshmget(KEY, sizeof(struct SharedGame), 0);
+    struct SharedGame *game = sshmat(shm_id);
+    struct CommandRing *ring = &game->commands[client_num - 1];
+    int reader = client_num - 1;
+    uint64_t cursor = 0;
+    struct FlushStats stats;
+    memset(&stats, 0, sizeof(stats));
+    // From the reception of a command to the moment what it produced left
+    // the socket
+    struct Histogram latency;
+    histogram_init(&latency);
+
+    // Set once the client switched to version 2 of the protocol
+    struct V2Codec v2;
+    struct V2Codec *codec = NULL;
+    uint8_t *scratch      = NULL;
+
+    // Tell the game owner this player is registered
+    int sem_id = sem_get(SEM_KEY, 1);
+    sem_up(sem_id, SEM_SYNC);
+
+    struct pollfd fds[2];
+    fds[0].fd     = client_socket;
+    fds[0].events = POLLIN;
+    fds[1].fd     = client_wakeup_fds[reader];
+    fds[1].events = POLLIN;
+
+    // Everything the player sent and this handler did not handle yet
+    struct InputBuffer in;
+    input_init(&in);
+    struct InputLimiter limiter;
+    limiter_init(&limiter, rate_limit);
+    bool kicked  = false;
+    bool leaving = false;
+    while (running && !leaving) {
+        // An iteration spans everything done between two sleeps
+        uint64_t iteration = trace_begin();
+
+        // A command held over the rate limit goes once its token is there
+        enum Direction held;
+        if (limiter_release(&limiter, &held)) {
+            if (!ring_push(ring, held, now_ns())) {
+                printf("Client %d: command queue full, command dropped\n", client_num);
+            }
+            wake_game_owner(game);
         }
-    } else {
-        // Player 2 signals readiness to player 1
-        printf("Player 2 signaling readiness to Player 1\n");
-        sem_up(sem_id, SEM_SYNC);  // Signal to Player 1
-    }
-      while (game_running && running) {
-        // Wait for direction input from client - handle EINTR specially
-        ssize_t bytes_read;
-        do {
-            bytes_read = read(client_socket, direction_buffer, sizeof(direction_buffer));
-            if (bytes_read < 0 && errno == EINTR) {
-                // If interrupted by signal, just try again
-                printf("Client %d read was interrupted by signal, retrying...\n", client_num);
-                continue;
+
+        // Once the game is over, whatever was published before is forwarded
+        // and the handler leaves
+        bool over = atomic_load(&game->over);
+        if (!forward_to_client(game, client_num, client_socket, &cursor, codec, scratch, &stats, &latency)) {
+            break;
+        }
+        if (over) {
+            if (atomic_load(&game->finished)) {
+                wait_game_over_ack(client_num, client_socket, &in);
             }
-        } while (bytes_read < 0 && errno == EINTR);
-        
-        // Check for other errors
+            break;
+        }
+
+        // Sleep until the player sends a command or the game owner publishes
+        // something (unless it did in the meantime)
+        bool sleep = broadcast_sleep(&game->broadcast, reader, cursor) && !atomic_load(&game->over);
+        trace_end("client_handler", iteration);
+        int poll_result = poll(fds, 2, sleep ? limiter_wait_ms(&limiter) : 0);
+        if (poll_result < 0 && errno == EINTR) {
+            continue;
+        }
+        checkNeg(poll_result, "poll failure");
+
+        if (fds[1].revents & POLLIN) {
+            uint64_t count;
+            sread(client_wakeup_fds[reader], &count, sizeof(count));
+        }
+        if (!(fds[0].revents & (POLLIN | POLLHUP | POLLERR))) {
+            continue;
+        }
+
+        // Everything the player sent since the last wakeup is read at once
+        ssize_t bytes_read = input_fill(&in, client_socket);
         if (bytes_read <= 0) {
             // Client disconnected or error
             if (bytes_read < 0) {
@@ -378,45 +1083,88 @@ void client_handler(int client_num, int client_socket) {
             printf("Client %d disconnected\n", client_num);
             break;
         }
-        
-        // Convert input to direction
-        enum Direction dir;
-        memcpy(&dir, direction_buffer, sizeof(dir));
-        
-        // Lock access to shared memory
-        sem_down(sem_id, SEM_MUTEX);
-        
-        // Process the command and update game state
-        game_running = !process_user_command(state, player, dir, broadcast_pipe[1]);
-        
-        // If game ended, send game over message
-        if (!game_running || state->game_over) {
-            // Determine the winner based on scores according to game rules
-            enum Item winner_item = state->scores[0] > state->scores[1] ? PLAYER1 : PLAYER2;
-            
-            printf("Game over - Player %d wins with score %d vs %d\n", 
-                winner_item == PLAYER1 ? 1 : 2,
-                state->scores[winner_item == PLAYER1 ? 0 : 1],
-                state->scores[winner_item == PLAYER1 ? 1 : 0]);
-                
-            // Envoyer le message GAME_OVER deux fois pour s'assurer qu'il est bien reçu
-            send_game_over(winner_item, broadcast_pipe[1]);
-            
-            // Petit délai pour s'assurer que le premier message est traité
-            usleep(100000);  // 100ms
-            
-            // Renvoyer le message pour s'assurer qu'il est bien reçu
-            send_game_over(winner_item, broadcast_pipe[1]);
-            
-            game_running = 0;
+
+        uint64_t received = now_ns();
+        ssize_t size;
+        const uint8_t *frame;
+        while (!leaving && (frame = input_next(&in, command_frame_size, &size)) != NULL) {
+            // The client may acknowledge GAME_OVER before this handler
+            // noticed the game is over
+            uint32_t word;
+            memcpy(&word, frame, sizeof(word));
+            if (word == GAME_OVER_ACK) {
+                printf("Client %d acknowledged GAME_OVER\n", client_num);
+                leaving = true;
+                break;
+            }
+
+            // Whatever has been published so far goes in version 1, then
+            // the PROTOCOL message, then everything else in version 2
+            if (word == PROTOCOL_V2_REQUEST) {
+                if (codec != NULL) {
+                    continue;
+                }
+                if (!forward_to_client(game, client_num, client_socket, &cursor, NULL, NULL, &stats, &latency)) {
+                    leaving = true;
+                    break;
+                }
+                union Message msg = { .protocol = { .msgt = PROTOCOL, .version = PROTOCOL_V2 } };
+                stats.syscalls++;
+                if (send(client_socket, &msg, sizeof(msg), MSG_NOSIGNAL) != sizeof(msg)) {
+                    perror("Failed to switch client to protocol v2");
+                    leaving = true;
+                    break;
+                }
+                stats.bytes += sizeof(msg);
+                metrics_out_v1(&msg, 1, &no_tiles);
+                v2_init(&v2);
+                codec   = &v2;
+                scratch = smalloc(V2_MAX_SIZE(BROADCAST_RING_SIZE));
+                printf("Client %d switched to protocol v2\n", client_num);
+                continue;
+            }
+
+            // Hand the command over to the game owner, unless it is no
+            // direction or the player sends more than it may
+            enum Direction dir;
+            memcpy(&dir, frame, sizeof(dir));
+            if (!valid_direction(dir)) {
+                continue;
+            }
+            metrics_count(&metrics->commands_in, 1);
+            enum LimitVerdict verdict = limiter_input(&limiter, &dir);
+            if (verdict == LIMIT_KICK) {
+                printf("Client %d keeps flooding the server, disconnecting\n", client_num);
+                kicked  = true;
+                leaving = true;
+                break;
+            }
+            if (verdict == LIMIT_PASS && !ring_push(ring, dir, received)) {
+                printf("Client %d: command queue full, command dropped\n", client_num);
+            }
         }
-        
-        // Unlock access to shared memory
-        sem_up(sem_id, SEM_MUTEX);
+        // A single wakeup for the whole burst
+        wake_game_owner(game);
     }
-    
-    sshmdt(state);
+
+    atomic_store(&game->left[client_num - 1], true);
+    wake_game_owner(game);
+
+    char who[32];
+    snprintf(who, sizeof(who), "Client %d", client_num);
+    print_flush_stats(who, &stats);
+    limiter_close(&limiter);
+    struct InputStats input = { .accepted = limiter.accepted, .coalesced = limiter.coalesced, .kicked = kicked };
+    print_input_stats(who, &input);
+    char label[64];
+    snprintf(label, sizeof(label), "%s, input to broadcast", who);
+    histogram_print(label, &latency);
+    free(scratch);
+    input_free(&in);
+
+    sshmdt(game);
     sclose(client_socket);
+    trace_dump();
     exit(EXIT_SUCCESS);
 }
 
@@ -431,15 +1179,102 @@ int main(int argc, char *argv[]) {
     if (argc > 2) {
         g_map_file = argv[2];
     }
+
+    // Optional flags come after the port and the map
+    struct ServerConfig config = {
+        .port         = port,
+        .maps         = NULL,
+        .epoll_mode   = false,
+        .max_rooms    = DEFAULT_MAX_ROOMS,
+        .threads      = DEFAULT_THREADS,
+        .tick_rate    = DEFAULT_TICK_RATE,
+        .rate_limit   = DEFAULT_RATE_LIMIT,
+        .low_latency  = false,
+        .metrics_addr = NULL,
+        .trace_path   = NULL,
+        .record_dir   = NULL,
+        .spectator_port = 0,
+        .spectator_fd = -1,
+        .grace        = DEFAULT_GRACE,
+        .workers      = DEFAULT_WORKERS,
+        .worker       = 0,
+    };
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "-epoll") == 0) {
+            config.epoll_mode = true;
+        } else if (strcmp(argv[i], "-rooms") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            config.max_rooms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc && atoi(argv[i + 1]) >= 0) {
+            config.threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-tick") == 0 && i + 1 < argc && atoi(argv[i + 1]) >= 0) {
+            config.tick_rate = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-rate") == 0 && i + 1 < argc && atoi(argv[i + 1]) >= 0) {
+            config.rate_limit = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-nodelay") == 0) {
+            config.low_latency = true;
+        } else if (strcmp(argv[i], "-metrics") == 0 && i + 1 < argc) {
+            config.metrics_addr = argv[++i];
+        } else if (strcmp(argv[i], "-trace") == 0 && i + 1 < argc) {
+            config.trace_path = argv[++i];
+        } else if (strcmp(argv[i], "-record") == 0 && i + 1 < argc) {
+            config.record_dir = argv[++i];
+        } else if (strcmp(argv[i], "-spectate") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            config.spectator_port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-grace") == 0 && i + 1 < argc && atoi(argv[i + 1]) >= 0) {
+            config.grace = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-workers") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0 && atoi(argv[i + 1]) <= MAX_WORKERS) {
+            config.workers = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            fprintf(stderr, "Usage: %s [port] [map_file[,map_file...]] [-tick HZ] [-rate N] [-nodelay] [-metrics PORT|PATH] [-trace FILE] [-record DIR] [-epoll [-rooms N] [-threads N] [-spectate PORT] [-grace SECONDS] [-workers N]]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
     
-    printf("Starting PAS-CMAN server on port %d using map %s...\n", port, g_map_file);
+    // The forked server only ever serves the two players of its game, and
+    // a client handler leaves with its player
+    if (config.spectator_port > 0 && !config.epoll_mode) {
+        fprintf(stderr, "Spectators are only supported by the epoll server (-epoll)\n");
+        exit(EXIT_FAILURE);
+    }
+    if (config.grace > 0 && !config.epoll_mode) {
+        fprintf(stderr, "Resuming a game is only supported by the epoll server (-epoll)\n");
+        exit(EXIT_FAILURE);
+    }
+    // A spectator or a resuming player must reach the process of its game,
+    // while the kernel picks a worker by hashing the address of the client
+    if (config.workers > 0 && !config.epoll_mode) {
+        fprintf(stderr, "Workers are only supported by the epoll server (-epoll)\n");
+        exit(EXIT_FAILURE);
+    }
+    if (config.workers > 1 && (config.spectator_port > 0 || config.grace > 0)) {
+        fprintf(stderr, "Spectators and resuming a game need a single worker\n");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Starting PAS-CMAN server on port %d using map %s%s...\n", 
+           port, g_map_file, config.epoll_mode ? " (epoll mode)" : "");
+
+    // Started first, so that parsing the maps is traced as well
+    if (config.trace_path != NULL) {
+        trace_init(config.trace_path);
+        printf("Tracing to %s, dumped on SIGUSR2\n", config.trace_path);
+    }
+
+    // Every map is parsed once and for all: a malformed one is reported
+    // now, and games then start without reading any file
+    map_pool = map_pool_create(g_map_file);
+    if (map_pool == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    config.maps = map_pool;
+    printf("%zu map(s) ready, played in turn\n", map_pool_size(map_pool));
       // Set up signal handlers
     struct sigaction sa;
     sa.sa_handler = sigint_handler;
     sigemptyset(&sa.sa_mask);
     sa.sa_flags = 0;
     sigaction(SIGINT, &sa, NULL);
-    sigaction(SIGALRM, &sa, NULL);
     
     // Set up SIGUSR1 handler
     struct sigaction sa_usr1;
@@ -447,134 +1282,103 @@ int main(int argc, char *argv[]) {
     sigemptyset(&sa_usr1.sa_mask);
     sa_usr1.sa_flags = 0;
     sigaction(SIGUSR1, &sa_usr1, NULL);
+
+    // SIGUSR2 dumps the trace. A dump should disturb the server as little
+    // as possible: interrupted system calls are restarted.
+    struct sigaction sa_usr2;
+    sa_usr2.sa_handler = sigusr2_handler;
+    sigemptyset(&sa_usr2.sa_mask);
+    sa_usr2.sa_flags = SA_RESTART;
+    sigaction(SIGUSR2, &sa_usr2, NULL);
     
     // Register atexit handler
+    server_pid = getpid();
     atexit(cleanup);
     
-    // Initialize semaphore - two semaphores: mutex and sync
-    sem_id = sem_create(SEM_KEY, 2, PERM, 1);
-    sem_down(sem_id, SEM_SYNC);  // Initialize sync semaphore to 0
-    
-    // Set up shared memory
-    shm_id = sshmget(KEY, sizeof(struct GameState), IPC_CREAT | PERM);
-    struct GameState *state = sshmat(shm_id);
-    reset_gamestate(state);
-    
-    // Create the broadcast pipe
-    spipe(broadcast_pipe);    // Create and set up server socket
-    sockfd = ssocket();
-    
-    // Set SO_REUSEADDR to allow binding to a recently closed socket
-    int option_value = 1;
-    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &option_value, sizeof(int)) < 0) {
-        perror("Error setting socket options");
+    server_argv = argv;
+
+    // A server started by a hand-over (see handover.h) inherits its
+    // listening sockets, in this order: one per worker (or the only one),
+    // the spectators' one and the metrics' one
+    int listener_wanted = config.workers > 0 ? config.workers : 1;
+    int socket_wanted   = listener_wanted + (config.spectator_port > 0) + (config.metrics_addr != NULL);
+    FileDescriptor inherited[HANDOVER_MAX_FDS];
+    int inherited_count = handover_inherited(inherited, HANDOVER_MAX_FDS);
+    if (inherited_count > 0 && inherited_count != socket_wanted) {
+        fprintf(stderr, "Inherited %d sockets, the command line needs %d\n", inherited_count, socket_wanted);
+        exit(EXIT_FAILURE);
     }
-      
-    // Try to bind with timeout in case previous instance didn't fully release the port
-    int bind_attempts = 0;
-    int max_attempts = 5;
-    while (bind_attempts < max_attempts) {
-        // Try to use sbind from utils_v3
-        int bind_result = sbind(port, sockfd);
-        
-        if (bind_result == 0) {
-            break; // Successfully bound
-        }
-        
-        // If binding failed, check if it was an "Address already in use" error
-        if (errno != EADDRINUSE) {
-            // This is not the error we're trying to handle, so report it and exit
-            fprintf(stderr, "Failed to bind to port %d: %s\n", port, strerror(errno));
-            exit(EXIT_FAILURE);
-        }
-        
-        // If binding failed with EADDRINUSE, wait a bit and try again
-        printf("Port %d is in use (attempt %d/%d), waiting 2 seconds...\n", 
-               port, bind_attempts + 1, max_attempts);
-        sleep(2); // Wait longer between attempts
-        bind_attempts++;
+
+    // The epoll server hosts many rooms, whose players may all connect at
+    // once: it gets the longest backlog the system allows
+    int backlog = config.epoll_mode ? SOMAXCONN : BACKLOG;
+    for (int i = 0; i < listener_wanted; i++) {
+        listeners[i] = inherited_count > 0 ? inherited[i]
+                                           : open_listener(port, config.workers > 0, backlog, config.low_latency);
+        listener_count++;
     }
-    
-    if (bind_attempts == max_attempts) {
-        printf("Failed to bind to port %d after %d attempts. Try killing any existing server process.\n", 
-               port, max_attempts);
-        exit(EXIT_FAILURE);
+    sockfd = listeners[0];
+    if (config.spectator_port > 0) {
+        spectator_listener = inherited_count > 0 ? inherited[listener_wanted]
+                                                 : open_listener(config.spectator_port, false, SOMAXCONN, false);
+        config.spectator_fd = spectator_listener;
     }
     
-    slisten(sockfd, BACKLOG);
+    if (inherited_count > 0) {
+        printf("Server took over port %d from the previous one, waiting for clients...\n", port);
+    } else {
+        printf("Server started on port %d, waiting for clients...\n", port);
+    }
+    handover_ready();
+
+    if (config.metrics_addr != NULL) {
+        start_metrics(config.metrics_addr, inherited_count > 0 ? inherited[inherited_count - 1] : -1);
+    }
+
+    // From now on, SIGINT, SIGCHLD and SIGHUP are read from 'signal_fd' by
+    // the loop of the main process, along with its sockets and timers.
+    // Blocked here, before any worker thread exists, they are blocked in
+    // every thread.
+    signal_fd = signals_open();
+
+    // In epoll mode, a single process handles everything (but the metrics):
+    // no fork, no semaphore, no shared memory and no broadcast pipe. It also
+    // hosts as many concurrent games as it has rooms. With workers, as many
+    // processes each run it, the kernel spreading the connections.
+    if (config.epoll_mode && config.workers > 0) {
+        run_workers(&config);
+        return EXIT_SUCCESS;
+    }
+    if (config.epoll_mode) {
+        run_epoll_server(sockfd, signal_fd, &config);
+        return EXIT_SUCCESS;
+    }
+
+    // Initialize the sync semaphore to 0: the game owner waits on it until
+    // every player is registered
+    sem_id = sem_create(SEM_KEY, 1, PERM, 0);
     
-    printf("Server started on port %d, waiting for clients...\n", port);
+    // Set up shared memory
+    shm_id = sshmget(KEY, sizeof(struct SharedGame), IPC_CREAT | PERM);
+    struct SharedGame *game = sshmat(shm_id);
+    reset_shared_game(game);
+
+    // Client handlers use it to wake the game owner up when it sleeps
+    wakeup_fd = eventfd(0, 0);
+    checkNeg(wakeup_fd, "eventfd");
     
-    // Create a pipe for intercepting and forwarding broadcast messages
-    int intercept_pipe[2];
-    spipe(intercept_pipe);
-      // Start broadcaster process - now it will write to intercept_pipe
-    broadcaster_pid = sfork();
-    if (broadcaster_pid == 0) {        // Child process (broadcaster) - ignore SIGINT to avoid multiple handlers
-        struct sigaction sa_ignore;
-        sa_ignore.sa_handler = SIG_IGN; // Ignore SIGINT
-        sigemptyset(&sa_ignore.sa_mask);
-        sa_ignore.sa_flags = 0;
-        sigaction(SIGINT, &sa_ignore, NULL);
-        
-        // Set up SIGUSR1 handler for broadcaster
-        struct sigaction sa_usr1;
-        sa_usr1.sa_handler = sigusr1_handler;
-        sigemptyset(&sa_usr1.sa_mask);
-        sa_usr1.sa_flags = 0;
-        sigaction(SIGUSR1, &sa_usr1, NULL);
-        
-        sclose(broadcast_pipe[1]);  // Close write end
-        sclose(intercept_pipe[0]);  // Close read end of intercept pipe
-        
-        // Set up polling for the broadcast pipe
-        struct pollfd poll_fd;
-        poll_fd.fd = broadcast_pipe[0];
-        poll_fd.events = POLLIN;
-        
-        while (1) {
-            // Poll for incoming messages
-            int poll_result = poll_with_retry(&poll_fd, 1, -1);
-              if (poll_result > 0 && (poll_fd.revents & POLLIN)) {
-                // Nous allons lire le message complet
-                union Message msg;
-                memset(&msg, 0, sizeof(union Message));
-                
-                // Handle EINTR for read operations
-                ssize_t bytes_read;
-                do {
-                    bytes_read = read(broadcast_pipe[0], &msg, sizeof(union Message));
-                    if (bytes_read < 0 && errno == EINTR) {
-                        // If interrupted by signal, just try again
-                        printf("Broadcaster read was interrupted by signal, retrying...\n");
-                        continue;
-                    }
-                } while (bytes_read < 0 && errno == EINTR);
-                
-                if (bytes_read <= 0) {
-                    if (bytes_read < 0) {
-                        perror("Broadcaster read error");
-                    }
-                    break;  // Pipe closed or error
-                }
-                
-                // Log le message reçu
-                printf("Broadcaster: received message type %d\n", msg.msgt);
-                
-                // Et le transférer au processus principal via le pipe d'interception
-                swrite(intercept_pipe[1], &msg, sizeof(union Message));
-            }
-        }
-        
-        sclose(broadcast_pipe[0]);
-        sclose(intercept_pipe[1]);
-        exit(EXIT_SUCCESS);
+    // The game owner uses them to wake the client handlers up when they
+    // sleep
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        client_wakeup_fds[i] = eventfd(0, 0);
+        checkNeg(client_wakeup_fds[i], "eventfd");
     }
     
-    // Parent process continues
-    sclose(broadcast_pipe[0]);  // Close read end of broadcast_pipe
-    sclose(intercept_pipe[1]);  // Close write end of intercept_pipe
-      while (running) {
+    registration_timer = timer_open();
+
+    // Number of games started so far, which numbers their recordings
+    uint32_t games_started = 0;
+    while (running) {
         // At the start of each main loop, check if we need to exit (we're in IDLE phase)
         if (shutdown_requested && current_phase == PHASE_IDLE) {
             printf("Shutdown requested while server is idle, exiting\n");
@@ -587,24 +1391,29 @@ int main(int argc, char *argv[]) {
         // Game registration phase (30 seconds timeout)
         int client_sockets[MAX_CLIENTS] = {-1, -1};
         int client_count = 0;
-        
-        // Reset the timeout flag before starting a new registration phase
-        registration_timed_out = false;
+        bool registration_timed_out = false;
         
         // Set the server phase to IDLE (waiting for first player)
-        current_phase = PHASE_IDLE;
+        set_phase(PHASE_IDLE);
         
-        // Set a 30-second alarm for registration phase, but only after first player connects
-        alarm(0); // Clear any previous alarm
-          // Accept client connections
+        // Accept client connections. The loop sleeps until a client
+        // connects, a signal arrives or the registration times out, and
+        // reacts to each of them right away.
+        struct pollfd poll_fds[3] = {
+            { .fd = sockfd,             .events = POLLIN },
+            { .fd = signal_fd,          .events = POLLIN },
+            { .fd = registration_timer, .events = POLLIN },
+        };
         while (client_count < MAX_CLIENTS && running && !registration_timed_out) {
-            // We'll use poll with a timeout to check running flag periodically
-            struct pollfd poll_fd;
-            poll_fd.fd = sockfd;
-            poll_fd.events = POLLIN;
-            
-            // Use a short poll timeout to check the running flag regularly
-            int poll_result = poll_with_retry(&poll_fd, 1, 1000); // 1 second timeout
+            int poll_result = poll(poll_fds, 3, -1);
+            if (poll_result < 0 && errno == EINTR) {
+                continue; // SIGUSR2
+            }
+            checkNeg(poll_result, "poll failure");
+
+            if (poll_fds[1].revents & POLLIN) {
+                handle_signals();
+            }
             
             // Check if we need to stop due to SIGINT when we're in IDLE phase
             // We only set running=false immediately if in IDLE phase with no players
@@ -614,53 +1423,60 @@ int main(int argc, char *argv[]) {
             }
             
             // Check if registration timed out
-            if (registration_timed_out) {
+            if ((poll_fds[2].revents & POLLIN) && timer_expired(registration_timer)) {
+                printf("Registration timeout: Not enough players connected within %d seconds\n", REGISTRATION_TIMEOUT);
                 printf("Registration phase timed out, disconnecting players and restarting\n");
+                registration_timed_out = true;
                 break; // Exit the connection loop to handle timeout
             }
             
-            // If no activity on the socket, continue polling
-            if (poll_result == 0) {
-                continue;
-            }
-            
             // Accept connection if available
-            if (poll_result > 0 && (poll_fd.revents & POLLIN)) {
+            if (poll_fds[0].revents & POLLIN) {
                 int client_socket = saccept(sockfd);
+                if (config.low_latency) {
+                    socket_low_latency(client_socket);
+                }
                 
                 client_sockets[client_count] = client_socket;
                 client_count++;
+                metrics_count(&metrics->connections, 1);
+                metrics_gauge(&metrics->connections_open, 1);
                 
                 printf("Client %d connected\n", client_count);
                 
                 // Start the 30-second timer after first player connects
                 if (client_count == 1) {
                     // Change phase to REGISTRATION after first player connects
-                    current_phase = PHASE_REGISTRATION;
+                    set_phase(PHASE_REGISTRATION);
+                    metrics_gauge(&metrics->rooms_open, 1);
                     printf("First player connected. Registration phase started: %d seconds timeout\n", REGISTRATION_TIMEOUT);
-                    alarm(REGISTRATION_TIMEOUT);
+                    timer_arm_in(registration_timer, REGISTRATION_TIMEOUT);
                 }
                 
-                // If we've got all required clients, cancel the alarm
+                // If we've got all required clients, cancel the timeout
                 if (client_count == MAX_CLIENTS) {
-                    alarm(0);  // Cancel the alarm
+                    timer_arm(registration_timer, NULL);
                     printf("All players connected, registration phase complete\n");
                 }
             }
         }
         
-        // Cancel alarm in case we're exiting the loop for another reason
-        alarm(0);
+        // Cancel the timeout in case we're exiting the loop for another reason
+        timer_arm(registration_timer, NULL);
         
-        // If we didn't get enough clients or received SIGALRM, disconnect and restart
+        // If we didn't get enough clients or the registration timed out, disconnect and restart
         if (client_count < MAX_CLIENTS || registration_timed_out) {
             printf("Not enough players connected. Disconnecting players and restarting registration.\n");
             for (int i = 0; i < client_count; i++) {
                 sclose(client_sockets[i]);
                 client_sockets[i] = -1;
+                metrics_gauge(&metrics->connections_open, -1);
+            }
+            if (client_count > 0) {
+                metrics_gauge(&metrics->rooms_open, -1);
             }
               // Reset back to IDLE phase
-            current_phase = PHASE_IDLE;
+            set_phase(PHASE_IDLE);
             
             // Check if shutdown was requested during any previous phase
             if (shutdown_requested) {
@@ -673,87 +1489,11 @@ int main(int argc, char *argv[]) {
         }
         
         // Change to GAME phase
-        current_phase = PHASE_GAME;
+        set_phase(PHASE_GAME);
         printf("Entering GAME phase\n");
         
         // Reset game state for new game
-        reset_gamestate(state);
-        
-        // Fork a process to handle the interception and forwarding of messages to clients
-        pid_t forwarder_pid = sfork();
-          if (forwarder_pid == 0) {            // Child process (forwarder) - ignore SIGINT to avoid multiple handlers
-            struct sigaction sa_ignore;
-            sa_ignore.sa_handler = SIG_IGN; // Ignore SIGINT
-            sigemptyset(&sa_ignore.sa_mask);
-            sa_ignore.sa_flags = 0;
-            sigaction(SIGINT, &sa_ignore, NULL);
-            
-            // Set up SIGUSR1 handler for forwarder
-            struct sigaction sa_usr1;
-            sa_usr1.sa_handler = sigusr1_handler;
-            sigemptyset(&sa_usr1.sa_mask);
-            sa_usr1.sa_flags = 0;
-            sigaction(SIGUSR1, &sa_usr1, NULL);
-            
-            printf("Message forwarder started\n");
-            
-            // Set up polling for interceptor pipe
-            struct pollfd poll_fd;
-            poll_fd.fd = intercept_pipe[0];
-            poll_fd.events = POLLIN;
-            
-            while (1) {                int poll_result = poll_with_retry(&poll_fd, 1, -1);
-                
-                if (poll_result > 0 && (poll_fd.revents & POLLIN)) {
-                    union Message msg;
-                    memset(&msg, 0, sizeof(union Message));
-                    
-                    // Handle EINTR for read operations
-                    ssize_t bytes_read;
-                    do {
-                        bytes_read = read(intercept_pipe[0], &msg, sizeof(union Message));
-                        if (bytes_read < 0 && errno == EINTR) {
-                            // If interrupted by signal, just try again
-                            printf("Forwarder read was interrupted by signal, retrying...\n");
-                            continue;
-                        }
-                    } while (bytes_read < 0 && errno == EINTR);
-                    
-                    if (bytes_read <= 0) {
-                        if (bytes_read < 0) {
-                            perror("Forwarder read error");
-                        }
-                        break;  // Pipe closed or error
-                    }
-                    
-                    // Envoyer le message à tous les clients
-                    printf("Forwarder: transmitting message type %d to clients\n", msg.msgt);
-                    
-                    for (int i = 0; i < client_count; i++) {
-                        if (client_sockets[i] != -1) {
-                            if (swrite(client_sockets[i], &msg, sizeof(union Message)) < 0) {
-                                perror("Failed to forward message to client");
-                            }
-                        }
-                    }
-                    
-                    // Pour GAME_OVER, on envoie deux fois avec un délai
-                    if (msg.msgt == GAME_OVER) {
-                        usleep(100000); // 100ms
-                        
-                        for (int i = 0; i < client_count; i++) {
-                            if (client_sockets[i] != -1) {
-                                swrite(client_sockets[i], &msg, sizeof(union Message));
-                            }
-                        }
-                        
-                        printf("Forwarder: sent GAME_OVER message again\n");
-                    }
-                }
-            }
-            
-            exit(EXIT_SUCCESS);
-        }
+        reset_shared_game(game);
         
         // Create handler processes for each client
         for (int i = 0; i < client_count; i++) {
@@ -771,6 +1511,7 @@ int main(int argc, char *argv[]) {
                 sigemptyset(&sa_usr1.sa_mask);
                 sa_usr1.sa_flags = 0;
                 sigaction(SIGUSR1, &sa_usr1, NULL);
+                signals_restore();
 
                 // Dans le processus fils, on ferme les sockets des autres clients
                 for (int j = 0; j < client_count; j++) {
@@ -779,81 +1520,122 @@ int main(int argc, char *argv[]) {
                     }
                 }
                 
-                // Et on ferme aussi le pipe d'interception qui est géré par le forwarder
-                sclose(intercept_pipe[0]);
-                
-                client_handler(player_id, client_sockets[i]);
+                trace_process(player_id == 1 ? "client handler 1" : "client handler 2");
+                client_handler(player_id, client_sockets[i], config.rate_limit);
                 exit(EXIT_SUCCESS);
             }
+        }
+
+        // Create the game owner process, which applies the commands pushed
+        // by the client handlers
+        const struct PreparedMap *map = map_pool_next(map_pool);
+        char record_path[4096];
+        games_started++;
+        if (config.record_dir != NULL) {
+            recording_path(record_path, sizeof(record_path), config.record_dir, games_started);
+        }
+        game_owner_pid = sfork();
+        if (game_owner_pid == 0) {
+            struct sigaction sa_ignore;
+            sa_ignore.sa_handler = SIG_IGN; // Ignore SIGINT
+            sigemptyset(&sa_ignore.sa_mask);
+            sa_ignore.sa_flags = 0;
+            sigaction(SIGINT, &sa_ignore, NULL);
+
+            struct sigaction sa_usr1;
+            sa_usr1.sa_handler = sigusr1_handler;
+            sigemptyset(&sa_usr1.sa_mask);
+            sa_usr1.sa_flags = 0;
+            sigaction(SIGUSR1, &sa_usr1, NULL);
+            signals_restore();
+
+            // The game owner never talks to the clients directly
+            for (int j = 0; j < client_count; j++) {
+                sclose(client_sockets[j]);
+            }
+
+            trace_process("game owner");
+            game_owner(map, config.tick_rate, config.record_dir != NULL ? record_path : NULL);
+            exit(EXIT_SUCCESS);
         }          // Wait for client handlers to finish - this will be the game phase
         printf("Game is now running. It will continue until completion even if shutdown is requested.\n");
         
         // Use a flag to track if the game ended naturally with a "game over"
         // or if it was interrupted by SIGINT
         bool game_interrupted = false;
-        
-        for (int i = 0; i < MAX_CLIENTS; i++) {
-            if (client_handlers[i] > 0) {
-                // Use waitpid directly with error handling for EINTR
+
+        // The exit of a client handler arrives as a SIGCHLD on 'signal_fd',
+        // as does a SIGINT, which lets the game complete
+        int handlers_left = client_count;
+        struct pollfd signal_poll = { .fd = signal_fd, .events = POLLIN };
+        while (handlers_left > 0) {
+            for (int i = 0; i < MAX_CLIENTS; i++) {
+                if (client_handlers[i] <= 0) {
+                    continue;
+                }
                 int status;
-                pid_t result;
-                do {
-                    result = waitpid(client_handlers[i], &status, 0);
-                    if (result == -1 && errno == EINTR) {
-                        if (shutdown_requested) {
-                            // SIGINT was received, but we should let the game continue
-                            printf("Waitpid was interrupted by SIGINT, but we'll keep waiting for game to complete...\n");
-                            game_interrupted = true;
-                        } else {
-                            printf("Waitpid was interrupted by signal, retrying...\n");
-                        }
-                    }
-                } while (result == -1 && errno == EINTR);
-                
-                // Only report errors that aren't caused by interrupted system call
-                if (result == -1 && errno != EINTR) {
-                    perror("Error waiting for client handler");
+                pid_t result = waitpid(client_handlers[i], &status, WNOHANG);
+                if (result == 0) {
+                    continue;
                 }
-                
-                // Check exit status of client handler to verify if it exited normally or was terminated
-                if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+                if (result == -1) {
+                    perror("Error waiting for client handler");
+                } else if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+                    // Check exit status of client handler to verify if it exited normally or was terminated
                     printf("Client handler %d exited normally\n", i+1);
                 } else {
                     printf("Client handler %d terminated abnormally\n", i+1);
                     game_interrupted = true;
                 }
-                
                 client_handlers[i] = -1;
+                handlers_left--;
+            }
+            if (handlers_left == 0) {
+                break;
+            }
+            int ready = poll(&signal_poll, 1, -1);
+            if (ready < 0 && errno == EINTR) {
+                continue; // SIGUSR2
+            }
+            checkNeg(ready, "poll failure");
+            bool was_requested = shutdown_requested;
+            handle_signals();
+            if (shutdown_requested && !was_requested) {
+                // SIGINT was received, but we should let the game continue
+                game_interrupted = true;
             }
         }
         
+        // The game owner stops once the game is over or both players left.
+        // A handler which died did not say it left, hence the flags.
+        for (int i = 0; i < MAX_CLIENTS; i++) {
+            atomic_store(&game->left[i], true);
+        }
+        wake_game_owner(game);
+        int owner_status;
+        pid_t owner_result;
+        do {
+            owner_result = waitpid(game_owner_pid, &owner_status, 0);
+        } while (owner_result == -1 && errno == EINTR);
+        game_owner_pid = -1;
+
         if (!game_interrupted) {
             printf("Game has ended naturally with a game over.\n");
         } else {
             printf("Game was interrupted by SIGINT but handled gracefully.\n");
         }
         
-        // Kill forwarder
-        skill(forwarder_pid, SIGTERM);
-        // Use waitpid directly with error handling for EINTR
-        int fw_status;
-        pid_t fw_result;
-        do {
-            fw_result = waitpid(forwarder_pid, &fw_status, 0);
-            if (fw_result == -1 && errno == EINTR) {
-                printf("Waitpid for forwarder was interrupted by signal, retrying...\n");
-            }
-        } while (fw_result == -1 && errno == EINTR);
-        
         // Close client sockets
         for (int i = 0; i < client_count; i++) {
             if (client_sockets[i] != -1) {
                 sclose(client_sockets[i]);
                 client_sockets[i] = -1;
+                metrics_gauge(&metrics->connections_open, -1);
             }
         }
+        metrics_gauge(&metrics->rooms_open, -1);
           // Set the server phase back to IDLE after game completes
-        current_phase = PHASE_IDLE;
+        set_phase(PHASE_IDLE);
         
         // After a game is complete, check if shutdown was requested during any phase
         if (shutdown_requested) {
@@ -864,7 +1646,7 @@ int main(int argc, char *argv[]) {
     }
     
     // Clean up
-    sshmdt(state);
+    sshmdt(game);
     
     return EXIT_SUCCESS;
 }
\ No newline at end of file
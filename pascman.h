@@ -10,19 +10,19 @@
 #include <stdbool.h>
 #include <stdint.h>
 
-/// Par définition, on considere que la map qu'on crée dans notre jeu a une
-/// dimension de 30 colonnes et 20 lignes
-#define WIDTH 30
-
-/// Par définition, on considere que la map qu'on crée dans notre jeu a une
-/// dimension de 30 colonnes et 20 lignes
-#define HEIGHT 20
-
-/// Une map est constituée de 30 x 20 tuiles. Chacunes de ces tuiles peut etre
-/// soit un mur, soit du sol. Il n'est possible de placer de la nourriture que
-/// sur les cases de qui sont du sol. Il n'est aussi possible de se déplacer 
-/// que sur des cases qui sont du sol.
-#define MAP_SIZE (30*20)
+/// Les dimensions d'une map sont celles du fichier dont elle est lue: sa
+/// largeur est celle de sa plus longue ligne, et sa hauteur son nombre de
+/// lignes. Elles ne peuvent toutefois pas dépasser 4096 colonnes et 4096
+/// lignes (ce qui laisse les identifiants des items tenir sur 32 bits et les
+/// dimensions sur 16 bits dans la version 2 du protocole).
+#define MAP_MAX_WIDTH 4096
+#define MAP_MAX_HEIGHT 4096
+
+/// Une map est constituée de width x height tuiles. Chacunes de ces tuiles
+/// peut etre soit un mur, soit du sol. Il n'est possible de placer de la
+/// nourriture que sur les cases de qui sont du sol. Il n'est aussi possible
+/// de se déplacer que sur des cases qui sont du sol.
+#define MAP_MAX_SIZE (MAP_MAX_WIDTH * MAP_MAX_HEIGHT)
 
 /// Lorsqu'un utilisateur utilisera les flèches de son clavier au sein de
 /// l'interface graphique, celle-ci écrira une direction (haut, bas, gauche, droite)
@@ -38,7 +38,7 @@ enum Direction {
 
 /// Une position représente la position d'un item sur la map. Il s'agit donc 
 /// d'une position qui peut aller de {x: 0, y: 0} (coin supérieur gauche) à
-/// {x: 29, y: 19} (coin inférieur droit).
+/// {x: width - 1, y: height - 1} (coin inférieur droit).
 struct Position {
     uint32_t x;
     uint32_t y;
@@ -68,6 +68,10 @@ enum MessageType {
     EAT_FOOD = 3,
     /// To tell that the game is over
     GAME_OVER = 4,
+    /// To introduce a whole map at once
+    MAP_SNAPSHOT = 5,
+    /// To tell which version of the protocol comes next
+    PROTOCOL = 6,
 };
 
 
@@ -75,8 +79,17 @@ enum MessageType {
 struct Registration {
     /// Ce messagetype devra toujours avoir la valeur REGISTRATION
     enum MessageType msgt;
-    /// L'identifiant du joueur
+    /// L'identifiant du joueur, 0 pour un spectateur (qui regarde la partie
+    /// sans y jouer)
     uint32_t player;
+    /// Les versions du protocole que le serveur sait parler (le bit n est
+    /// levé si la version n est supportée). Vaut 0 pour un ancien serveur,
+    /// qui ne parle que la version 1.
+    uint32_t versions;
+    /// Le jeton de session (64 bits, poids faible d'abord) qui permet au
+    /// joueur de reprendre sa place s'il perd la connexion (voir
+    /// RESUME_REQUEST). Vaut 0 si le serveur ne permet pas de reprendre.
+    uint32_t session[2];
 };
 
 /// Spawn est le message qui sert à introduire un item dans le jeu.
@@ -120,6 +133,48 @@ struct GameOver {
     /// Ce messagetype devra toujours avoir la valeur GAME_OVER
     enum MessageType msgt;
     uint32_t winner;
+    /// Le score final de chacun des deux joueurs
+    uint32_t scores[2];
+};
+
+/// MapSnapshot introduit d'un coup toutes les tuiles de 'rows' lignes de la
+/// carte, à partir de la ligne 'y'. Il remplace les SPAWN de chaque tuile au
+/// début d'une partie.
+///
+/// Ce message est immédiatement suivi de width * rows octets (un par tuile,
+/// ligne par ligne), complétés par des zéros jusqu'à occuper un nombre entier
+/// de messages (voir SNAPSHOT_SLOTS). Chaque octet contient l'item qui occupe
+/// la tuile: WALL, FLOOR, FOOD, SUPERFOOD, PLAYER1 ou PLAYER2 (une tuile où se
+/// trouve un joueur ou de la nourriture est implicitement du sol).
+///
+/// Une grande carte est décrite par plusieurs MapSnapshot successifs, qui
+/// couvrent chacun quelques lignes, dans l'ordre: le client peut dessiner
+/// chaque morceau dès qu'il le reçoit.
+///
+/// Les identifiants des items sont ceux qu'auraient donné les SPAWN: la
+/// position de la tuile (y * width + x) pour la nourriture, et
+/// 3 * width * height (+ 1 pour le joueur 2) pour les joueurs.
+struct MapSnapshot {
+    /// Ce messagetype devra toujours avoir la valeur MAP_SNAPSHOT
+    enum MessageType msgt;
+    /// Les dimensions de la carte complète
+    uint32_t width;
+    uint32_t height;
+    /// La première ligne décrite par ce message
+    uint32_t y;
+    /// Le nombre de lignes décrites par ce message
+    uint32_t rows;
+};
+
+/// Protocol indique que tous les messages qui suivent sont encodés dans une
+/// autre version du protocole. Il est toujours encodé dans la version 1,
+/// et n'est envoyé qu'à un client qui a demandé à changer de version après
+/// avoir reçu son message REGISTRATION.
+struct Protocol {
+    /// Ce messagetype devra toujours avoir la valeur PROTOCOL
+    enum MessageType msgt;
+    /// La version dans laquelle les messages suivants sont encodés
+    uint32_t version;
 };
 
 /// Cette union encapsule tous les messages que vous pourriez vouloir envoyer à l'interface
@@ -131,6 +186,13 @@ union Message {
     struct Movement movement;
     struct EatFood eat_food;
     struct GameOver game_over;
+    struct MapSnapshot snapshot;
+    struct Protocol protocol;
 };
 
+/// Le nombre de messages qu'occupent les tuiles qui suivent un MapSnapshot
+/// décrivant 'rows' lignes d'une carte de largeur 'width'.
+#define SNAPSHOT_SLOTS(width, rows) \
+    (((width) * (rows) + sizeof(union Message) - 1) / sizeof(union Message))
+
 #endif //__PASCMAN__
\ No newline at end of file
@@ -0,0 +1,316 @@
+#include <string.h>
+
+#include "protocol_v2.h"
+
+static uint8_t *put_u8(uint8_t *buf, uint8_t value) {
+    *buf = value;
+    return buf + 1;
+}
+
+static uint8_t *put_u16(uint8_t *buf, uint16_t value) {
+    buf[0] = value & 0xFF;
+    buf[1] = value >> 8;
+    return buf + 2;
+}
+
+static uint8_t *put_u32(uint8_t *buf, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        buf[i] = (value >> (8 * i)) & 0xFF;
+    }
+    return buf + 4;
+}
+
+static uint16_t get_u16(const uint8_t *buf) {
+    return buf[0] | (buf[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *buf) {
+    return (uint32_t) buf[0] | ((uint32_t) buf[1] << 8) | ((uint32_t) buf[2] << 16) | ((uint32_t) buf[3] << 24);
+}
+
+void v2_init(struct V2Codec *codec) {
+    memset(codec, 0, sizeof(struct V2Codec));
+}
+
+//#############################################################################
+// TRACKED ITEMS
+//#############################################################################
+
+// Slot of the item in the table, -1 if it is not tracked
+static int tracked_slot(const struct V2Codec *codec, uint32_t id) {
+    for (size_t i = 0; i < codec->tracked; i++) {
+        if (codec->ids[i] == id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Records the position of the item, which takes the next free slot if it
+// was not tracked yet (and is never tracked once the table is full)
+static void track(struct V2Codec *codec, uint32_t id, struct Position pos) {
+    int slot = tracked_slot(codec, id);
+    if (slot < 0 && codec->tracked < V2_TRACKED) {
+        slot = codec->tracked++;
+        codec->ids[slot] = id;
+    }
+    if (slot >= 0) {
+        codec->positions[slot] = pos;
+    }
+}
+
+// The players found among the tiles of a snapshot are tracked under the ids
+// documented with MapSnapshot
+static void track_tiles(struct V2Codec *codec, const struct MapSnapshot *snapshot,
+                        size_t first, const uint8_t *tiles, size_t count) {
+    uint32_t player1 = 3 * snapshot->width * snapshot->height;
+    for (size_t i = 0; i < count; i++) {
+        if (tiles[i] == PLAYER1 || tiles[i] == PLAYER2) {
+            struct Position pos = {
+                .x = (first + i) % snapshot->width,
+                .y = snapshot->y + (first + i) / snapshot->width
+            };
+            track(codec, tiles[i] == PLAYER1 ? player1 : player1 + 1, pos);
+        }
+    }
+}
+
+// The direction of a single tile move from 'from' to 'to', -1 if it is not
+static int step_direction(struct Position from, struct Position to) {
+    if (from.x == to.x && from.y + 1 == to.y) {
+        return DOWN;
+    }
+    if (from.x + 1 == to.x && from.y == to.y) {
+        return RIGHT;
+    }
+    if (from.x == to.x + 1 && from.y == to.y) {
+        return LEFT;
+    }
+    if (from.x == to.x && from.y == to.y + 1) {
+        return UP;
+    }
+    return -1;
+}
+
+static struct Position step(struct Position from, enum Direction dir) {
+    switch (dir) {
+    case DOWN:  from.y++; break;
+    case RIGHT: from.x++; break;
+    case LEFT:  from.x--; break;
+    case UP:    from.y--; break;
+    }
+    return from;
+}
+
+//#############################################################################
+// ENCODING
+//#############################################################################
+
+static uint8_t *encode_movement(struct V2Codec *codec, const struct Movement *mvmt, uint8_t *buf) {
+    int slot = tracked_slot(codec, mvmt->id);
+    int dir  = slot < 0 ? -1 : step_direction(codec->positions[slot], mvmt->pos);
+    track(codec, mvmt->id, mvmt->pos);
+    if (dir >= 0) {
+        buf = put_u8(buf, V2_STEP);
+        return put_u8(buf, (slot << 2) | dir);
+    }
+    buf = put_u8(buf, V2_MOVEMENT);
+    buf = put_u32(buf, mvmt->id);
+    buf = put_u16(buf, mvmt->pos.x);
+    return put_u16(buf, mvmt->pos.y);
+}
+
+// Copies the tiles held by a slot following a MAP_SNAPSHOT, without the
+// padding of the last one
+static uint8_t *encode_tiles(struct V2Codec *codec, const union Message *slot, uint8_t *buf) {
+    size_t count = codec->tiles_left < sizeof(union Message) ? codec->tiles_left : sizeof(union Message);
+    memcpy(buf, slot, count);
+    track_tiles(codec, &codec->snapshot, codec->tile, buf, count);
+    codec->tile       += count;
+    codec->tiles_left -= count;
+    codec->slots_left--;
+    return buf + count;
+}
+
+size_t v2_encode(struct V2Codec *codec, const union Message *msgs, size_t count, uint8_t *buf) {
+    uint8_t *start = buf;
+    for (size_t i = 0; i < count; i++) {
+        const union Message *msg = &msgs[i];
+        if (codec->slots_left > 0) {
+            buf = encode_tiles(codec, msg, buf);
+            continue;
+        }
+
+        switch (msg->msgt) {
+        case REGISTRATION:
+            buf = put_u8(buf, V2_REGISTRATION);
+            buf = put_u32(buf, msg->registration.player);
+            buf = put_u32(buf, msg->registration.versions);
+            break;
+        case SPAWN:
+            if (msg->spawn.item == PLAYER1 || msg->spawn.item == PLAYER2) {
+                track(codec, msg->spawn.id, msg->spawn.pos);
+            }
+            buf = put_u8(buf, V2_SPAWN);
+            buf = put_u32(buf, msg->spawn.id);
+            buf = put_u8(buf, msg->spawn.item);
+            buf = put_u16(buf, msg->spawn.pos.x);
+            buf = put_u16(buf, msg->spawn.pos.y);
+            break;
+        case MOVEMENT:
+            buf = encode_movement(codec, &msg->movement, buf);
+            break;
+        case EAT_FOOD:
+            buf = put_u8(buf, V2_EAT_FOOD);
+            buf = put_u32(buf, msg->eat_food.eater);
+            buf = put_u32(buf, msg->eat_food.food);
+            break;
+        case GAME_OVER:
+            buf = put_u8(buf, V2_GAME_OVER);
+            buf = put_u32(buf, msg->game_over.winner);
+            buf = put_u32(buf, msg->game_over.scores[0]);
+            buf = put_u32(buf, msg->game_over.scores[1]);
+            break;
+        case MAP_SNAPSHOT:
+            buf = put_u8(buf, V2_MAP_SNAPSHOT);
+            buf = put_u16(buf, msg->snapshot.width);
+            buf = put_u16(buf, msg->snapshot.height);
+            buf = put_u16(buf, msg->snapshot.y);
+            buf = put_u16(buf, msg->snapshot.rows);
+            codec->snapshot   = msg->snapshot;
+            codec->tile       = 0;
+            codec->tiles_left = msg->snapshot.width * msg->snapshot.rows;
+            codec->slots_left = SNAPSHOT_SLOTS(msg->snapshot.width, msg->snapshot.rows);
+            break;
+        case PROTOCOL:
+            buf = put_u8(buf, V2_PROTOCOL);
+            buf = put_u32(buf, msg->protocol.version);
+            break;
+        }
+    }
+    return buf - start;
+}
+
+void v2_batch_header(uint8_t *buf, size_t len) {
+    buf = put_u8(buf, V2_BATCH);
+    put_u32(buf, len);
+}
+
+//#############################################################################
+// DECODING
+//#############################################################################
+
+ssize_t v1_message_size(const uint8_t *buf, size_t len) {
+    union Message msg;
+    if (len < sizeof(msg)) {
+        return 0;
+    }
+    memcpy(&msg, buf, sizeof(msg));
+    size_t size = sizeof(msg);
+    if (msg.msgt == MAP_SNAPSHOT) {
+        size += SNAPSHOT_SLOTS(msg.snapshot.width, msg.snapshot.rows) * sizeof(union Message);
+    }
+    return len < size ? 0 : (ssize_t) size;
+}
+
+ssize_t v2_batch_size(const uint8_t *buf, size_t len) {
+    if (len < V2_BATCH_HEADER) {
+        return 0;
+    }
+    if (buf[0] != V2_BATCH) {
+        return -1;
+    }
+    size_t size = V2_BATCH_HEADER + get_u32(buf + 1);
+    return len < size ? 0 : (ssize_t) size;
+}
+
+// Size of the record of the given type, tiles of a MAP_SNAPSHOT excluded
+static size_t record_size(uint8_t type) {
+    switch (type) {
+    case V2_REGISTRATION: return 9;
+    case V2_SPAWN:        return 10;
+    case V2_MOVEMENT:     return 9;
+    case V2_EAT_FOOD:     return 9;
+    case V2_GAME_OVER:    return 13;
+    case V2_MAP_SNAPSHOT: return 9;
+    case V2_PROTOCOL:     return 5;
+    case V2_STEP:         return 2;
+    default:              return 0;
+    }
+}
+
+ssize_t v2_decode(struct V2Codec *codec, const uint8_t *buf, size_t len,
+                  union Message *msg, const uint8_t **tiles) {
+    size_t size = len > 0 ? record_size(buf[0]) : 0;
+    if (size == 0 || len < size) {
+        return -1;
+    }
+
+    memset(msg, 0, sizeof(union Message));
+    const uint8_t *field = buf + 1;
+    switch (buf[0]) {
+    case V2_REGISTRATION:
+        msg->registration.msgt     = REGISTRATION;
+        msg->registration.player   = get_u32(field);
+        msg->registration.versions = get_u32(field + 4);
+        break;
+    case V2_SPAWN:
+        msg->spawn.msgt  = SPAWN;
+        msg->spawn.id    = get_u32(field);
+        msg->spawn.item  = field[4];
+        msg->spawn.pos.x = get_u16(field + 5);
+        msg->spawn.pos.y = get_u16(field + 7);
+        if (msg->spawn.item == PLAYER1 || msg->spawn.item == PLAYER2) {
+            track(codec, msg->spawn.id, msg->spawn.pos);
+        }
+        break;
+    case V2_MOVEMENT:
+        msg->movement.msgt  = MOVEMENT;
+        msg->movement.id    = get_u32(field);
+        msg->movement.pos.x = get_u16(field + 4);
+        msg->movement.pos.y = get_u16(field + 6);
+        track(codec, msg->movement.id, msg->movement.pos);
+        break;
+    case V2_STEP: {
+        size_t slot = field[0] >> 2;
+        if (slot >= codec->tracked) {
+            return -1;
+        }
+        msg->movement.msgt = MOVEMENT;
+        msg->movement.id   = codec->ids[slot];
+        msg->movement.pos  = step(codec->positions[slot], field[0] & 3);
+        codec->positions[slot] = msg->movement.pos;
+        break;
+    }
+    case V2_EAT_FOOD:
+        msg->eat_food.msgt  = EAT_FOOD;
+        msg->eat_food.eater = get_u32(field);
+        msg->eat_food.food  = get_u32(field + 4);
+        break;
+    case V2_GAME_OVER:
+        msg->game_over.msgt      = GAME_OVER;
+        msg->game_over.winner    = get_u32(field);
+        msg->game_over.scores[0] = get_u32(field + 4);
+        msg->game_over.scores[1] = get_u32(field + 8);
+        break;
+    case V2_MAP_SNAPSHOT:
+        msg->snapshot.msgt   = MAP_SNAPSHOT;
+        msg->snapshot.width  = get_u16(field);
+        msg->snapshot.height = get_u16(field + 2);
+        msg->snapshot.y      = get_u16(field + 4);
+        msg->snapshot.rows   = get_u16(field + 6);
+        size_t count = msg->snapshot.width * msg->snapshot.rows;
+        if (len < size + count) {
+            return -1;
+        }
+        *tiles = buf + size;
+        track_tiles(codec, &msg->snapshot, 0, *tiles, count);
+        size += count;
+        break;
+    case V2_PROTOCOL:
+        msg->protocol.msgt    = PROTOCOL;
+        msg->protocol.version = get_u32(field);
+        break;
+    }
+    return size;
+}
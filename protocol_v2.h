@@ -0,0 +1,101 @@
+#ifndef __PROTOCOL_V2__
+#define __PROTOCOL_V2__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "pascman.h"
+
+// Version 2 of the wire protocol. Version 1 sends each message as a raw
+// 20-byte union Message, in the byte order of the sender. Version 2 sends
+// each message as a record: a one-byte type followed by fixed-width fields
+// in little-endian order, with only as many bytes as the message needs.
+//
+// Records always travel in batches: a BATCH header (its type and the u32
+// length of the records that follow), then the records. A receiver applies
+// a batch once it has it whole.
+//
+//   REGISTRATION  u32 player, u32 versions                      9 bytes
+//   SPAWN         u32 id, u8 item, u16 x, u16 y                10 bytes
+//   MOVEMENT      u32 id, u16 x, u16 y                          9 bytes
+//   EAT_FOOD      u32 eater, u32 food                           9 bytes
+//   GAME_OVER     u32 winner, u32 score1, u32 score2           13 bytes
+//   MAP_SNAPSHOT  u16 width, u16 height, u16 y, u16 rows,
+//                 then width * rows tiles (no padding)     9 bytes + tiles
+//   PROTOCOL      u32 version                                   5 bytes
+//   STEP          u8 (slot << 2 | direction)                    2 bytes
+//
+// A REGISTRATION record carries no session token: the server only ever
+// sends REGISTRATION in version 1, before the client asks to switch.
+//
+// STEP is a MOVEMENT of a single tile. Both ends keep the same small table
+// of the items they have seen move or spawn as players: 'slot' is the index
+// of the item in that table.
+enum V2Record {
+    V2_REGISTRATION = REGISTRATION,
+    V2_SPAWN        = SPAWN,
+    V2_MOVEMENT     = MOVEMENT,
+    V2_EAT_FOOD     = EAT_FOOD,
+    V2_GAME_OVER    = GAME_OVER,
+    V2_MAP_SNAPSHOT = MAP_SNAPSHOT,
+    V2_PROTOCOL     = PROTOCOL,
+    V2_STEP         = 7,
+    V2_BATCH        = 8,
+};
+
+#define PROTOCOL_V1 1
+#define PROTOCOL_V2 2
+
+// Number of moving items whose position is tracked for STEP records
+#define V2_TRACKED 4
+
+// Size of the BATCH header
+#define V2_BATCH_HEADER 5
+
+// Room needed to encode 'count' messages as a batch (a record is never
+// larger than the message it encodes)
+#define V2_MAX_SIZE(count) (V2_BATCH_HEADER + (count) * sizeof(union Message))
+
+// What each end of a connection remembers of the messages it went through.
+// An encoder and the decoder on the other side start from the same (empty)
+// codec when the connection switches to version 2.
+struct V2Codec {
+    // Last known position of the tracked items
+    uint32_t ids[V2_TRACKED];
+    struct Position positions[V2_TRACKED];
+    size_t tracked;
+    // Encoder side: the MAP_SNAPSHOT whose tiles are being encoded, and how
+    // many of its tiles and padded slots are still to come
+    struct MapSnapshot snapshot;
+    size_t tile;
+    size_t tiles_left;
+    size_t slots_left;
+};
+
+void v2_init(struct V2Codec *codec);
+
+// Encodes 'count' v1 messages (as published by the game, tiles of a
+// MAP_SNAPSHOT included) as records into 'buf', and returns the number of
+// bytes written. A MAP_SNAPSHOT may be split across several calls.
+size_t v2_encode(struct V2Codec *codec, const union Message *msgs, size_t count, uint8_t *buf);
+
+// Writes the header of a batch of 'len' bytes of records. 'buf' is where
+// the batch starts, the records being at buf + V2_BATCH_HEADER.
+void v2_batch_header(uint8_t *buf, size_t len);
+
+// Size of the version 1 message at the start of 'buf' (the tiles following
+// a MAP_SNAPSHOT included). Returns 0 if it has not been received whole yet.
+ssize_t v1_message_size(const uint8_t *buf, size_t len);
+
+// Size of the batch at the start of 'buf', header included. Returns 0 if it
+// has not been received whole yet, -1 if 'buf' does not start with a batch.
+ssize_t v2_batch_size(const uint8_t *buf, size_t len);
+
+// Decodes the record at the start of 'buf' (which holds 'len' bytes) as a
+// v1 message. For a MAP_SNAPSHOT, '*tiles' points to its tiles in 'buf'.
+// Returns the size of the record, or -1 if it is malformed or truncated.
+ssize_t v2_decode(struct V2Codec *codec, const uint8_t *buf, size_t len,
+                  union Message *msg, const uint8_t **tiles);
+
+#endif //__PROTOCOL_V2__
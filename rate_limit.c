@@ -0,0 +1,85 @@
+#include <string.h>
+
+#include "rate_limit.h"
+
+void limiter_init(struct InputLimiter *limiter, int rate) {
+    memset(limiter, 0, sizeof(struct InputLimiter));
+    limiter->rate   = rate > 0 ? rate : 0;
+    limiter->tokens = limiter->rate;
+    clock_gettime(CLOCK_MONOTONIC, &limiter->last);
+}
+
+// Gives the tokens (and pays back the debt) earned since the last call
+static void refill(struct InputLimiter *limiter) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - limiter->last.tv_sec) + (now.tv_nsec - limiter->last.tv_nsec) / 1e9;
+    limiter->last  = now;
+
+    double earned    = elapsed * limiter->rate;
+    limiter->tokens += earned;
+    if (limiter->tokens > limiter->rate) {
+        limiter->tokens = limiter->rate;
+    }
+    limiter->debt = limiter->debt > earned ? limiter->debt - earned : 0;
+}
+
+enum LimitVerdict limiter_input(struct InputLimiter *limiter, enum Direction *dir) {
+    if (limiter->rate == 0) {
+        limiter->accepted++;
+        return LIMIT_PASS;
+    }
+
+    refill(limiter);
+    // A held command is replaced by the latest one, whatever happens
+    if (limiter->has_pending) {
+        limiter->has_pending = false;
+        limiter->coalesced++;
+    }
+    if (limiter->tokens >= 1) {
+        limiter->tokens -= 1;
+        limiter->accepted++;
+        return LIMIT_PASS;
+    }
+
+    limiter->has_pending = true;
+    limiter->pending     = *dir;
+    limiter->debt       += 1;
+    return limiter->debt > LIMIT_KICK_SECONDS * limiter->rate ? LIMIT_KICK : LIMIT_HELD;
+}
+
+bool limiter_release(struct InputLimiter *limiter, enum Direction *dir) {
+    if (!limiter->has_pending) {
+        return false;
+    }
+    refill(limiter);
+    if (limiter->tokens < 1) {
+        return false;
+    }
+    limiter->tokens     -= 1;
+    limiter->has_pending = false;
+    limiter->accepted++;
+    *dir = limiter->pending;
+    return true;
+}
+
+int limiter_wait_ms(const struct InputLimiter *limiter) {
+    if (!limiter->has_pending) {
+        return -1;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - limiter->last.tv_sec) + (now.tv_nsec - limiter->last.tv_nsec) / 1e9;
+    double missing = 1 - (limiter->tokens + elapsed * limiter->rate);
+    if (missing <= 0) {
+        return 0;
+    }
+    return (int) (missing / limiter->rate * 1000) + 1;
+}
+
+void limiter_close(struct InputLimiter *limiter) {
+    if (limiter->has_pending) {
+        limiter->has_pending = false;
+        limiter->coalesced++;
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef __RATE_LIMIT__
+#define __RATE_LIMIT__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "game.h"
+
+// A client whose debt (the commands it sent beyond its rate, which it pays
+// back at that same rate) exceeds that many seconds worth of commands is
+// disconnected. It takes about 5 seconds at three times the rate.
+#define LIMIT_KICK_SECONDS 5
+
+// What becomes of a command sent by a client
+enum LimitVerdict {
+    LIMIT_PASS,  // It may be applied right away
+    LIMIT_HELD,  // It is over the limit: it is held (see limiter_release)
+    LIMIT_KICK   // The client keeps flooding and must be disconnected
+};
+
+// Limits the commands of a client with a token bucket: it may send up to
+// 'rate' commands per second, and a second's worth of them at once.
+//
+// Commands over the limit are coalesced: only the latest one is held, and
+// it is released as soon as a token is available. The older ones are
+// dropped and counted.
+struct InputLimiter {
+    // Commands per second, 0 if there is no limit
+    double rate;
+    double tokens;
+    double debt;
+    struct timespec last;
+    // The latest command held over the limit
+    bool has_pending;
+    enum Direction pending;
+    // Commands applied, and commands dropped because a later one replaced
+    // them (or because the client left before they were released)
+    uint64_t accepted;
+    uint64_t coalesced;
+};
+
+// Starts with a full bucket. 'rate' is 0 for no limit at all.
+void limiter_init(struct InputLimiter *limiter, int rate);
+
+// Accounts for a command of the client. On LIMIT_PASS, '*dir' is the
+// command to apply.
+enum LimitVerdict limiter_input(struct InputLimiter *limiter, enum Direction *dir);
+
+// Releases the held command if a token is available by now. Returns false
+// if there is none, or if it has to wait.
+bool limiter_release(struct InputLimiter *limiter, enum Direction *dir);
+
+// Number of milliseconds before the held command can be released (rounded
+// up), -1 if there is none.
+int limiter_wait_ms(const struct InputLimiter *limiter);
+
+// The client left: its held command, if any, is counted as dropped.
+void limiter_close(struct InputLimiter *limiter);
+
+#endif //__RATE_LIMIT__
@@ -0,0 +1,120 @@
+#include <string.h>
+#include <time.h>
+
+#include "histogram.h"
+#include "recording.h"
+
+void recording_path(char *path, size_t len, const char *dir, uint32_t game_id) {
+    time_t now = time(NULL);
+    struct tm date;
+    localtime_r(&now, &date);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &date);
+    snprintf(path, len, "%s/game-%s-%u.pcr", dir, stamp, game_id);
+}
+
+bool recorder_open(struct Recorder *rec, const char *path) {
+    memset(rec, 0, sizeof(struct Recorder));
+    rec->file = fopen(path, "wb");
+    if (rec->file == NULL) {
+        perror(path);
+        return false;
+    }
+    uint32_t header[4];
+    memcpy(&header[0], RECORDING_MAGIC, sizeof(uint32_t));
+    header[1] = RECORDING_VERSION;
+    header[2] = sizeof(union Message);
+    header[3] = sizeof(struct RecordedState);
+    fwrite(header, sizeof(header), 1, rec->file);
+    rec->start_ns = now_ns();
+    return true;
+}
+
+static void record_keyframe(struct Recorder *rec, const struct GameState *state, uint64_t now) {
+    size_t tiles = (size_t) state->width * state->height;
+    struct RecordHeader header = { .type = RECORD_KEYFRAME, .count = tiles, .time_ns = now - rec->start_ns };
+    struct RecordedState recorded = {
+        .width      = state->width,
+        .height     = state->height,
+        .scores     = { state->scores[0], state->scores[1] },
+        .food_count = state->food_count,
+        .positions  = { state->positions[0], state->positions[1] },
+        .game_over  = state->game_over,
+    };
+    fwrite(&header, sizeof(header), 1, rec->file);
+    fwrite(&recorded, sizeof(recorded), 1, rec->file);
+    fwrite(state->map, 1, tiles, rec->file);
+    rec->keyframe_ns = now;
+    // A recording is readable up to its last keyframe, even if the server
+    // crashes
+    fflush(rec->file);
+}
+
+void recorder_write(struct Recorder *rec, const union Message *msgs, size_t count, const struct GameState *state) {
+    if (rec->file == NULL || count == 0) {
+        return;
+    }
+    uint64_t now = now_ns();
+    struct RecordHeader header = { .type = RECORD_MESSAGES, .count = count, .time_ns = now - rec->start_ns };
+    fwrite(&header, sizeof(header), 1, rec->file);
+    fwrite(msgs, sizeof(union Message), count, rec->file);
+    if (rec->keyframe_ns == 0 || now - rec->keyframe_ns >= RECORDING_KEYFRAME_NS) {
+        record_keyframe(rec, state, now);
+    }
+}
+
+void recorder_close(struct Recorder *rec, const struct GameState *state) {
+    if (rec->file == NULL) {
+        return;
+    }
+    record_keyframe(rec, state, now_ns());
+    fclose(rec->file);
+    rec->file = NULL;
+}
+
+bool recording_check(FILE *file) {
+    uint32_t header[4];
+    if (fread(header, sizeof(header), 1, file) != 1 || memcmp(&header[0], RECORDING_MAGIC, sizeof(uint32_t)) != 0) {
+        fprintf(stderr, "Not a recording\n");
+        return false;
+    }
+    if (header[1] != RECORDING_VERSION) {
+        fprintf(stderr, "Unsupported recording version %u\n", header[1]);
+        return false;
+    }
+    if (header[2] != sizeof(union Message) || header[3] != sizeof(struct RecordedState)) {
+        fprintf(stderr, "Recording made by an incompatible server\n");
+        return false;
+    }
+    return true;
+}
+
+bool recording_next(FILE *file, struct RecordHeader *header) {
+    return fread(header, sizeof(struct RecordHeader), 1, file) == 1;
+}
+
+size_t recording_payload(const struct RecordHeader *header) {
+    return header->type == RECORD_KEYFRAME ? sizeof(struct RecordedState) + header->count
+                                           : header->count * sizeof(union Message);
+}
+
+bool recording_keyframe(FILE *file, const struct RecordHeader *header, struct GameState *state) {
+    struct RecordedState recorded;
+    if (fread(&recorded, sizeof(recorded), 1, file) != 1 || recorded.width > MAP_MAX_WIDTH
+        || recorded.height > MAP_MAX_HEIGHT || (size_t) recorded.width * recorded.height != header->count) {
+        return false;
+    }
+    for (int i = 0; i < NB_PLAYERS; i++) {
+        if (recorded.positions[i].x >= recorded.width || recorded.positions[i].y >= recorded.height) {
+            return false;
+        }
+    }
+    resize_gamestate(state, recorded.width, recorded.height);
+    for (int i = 0; i < NB_PLAYERS; i++) {
+        state->scores[i]    = recorded.scores[i];
+        state->positions[i] = recorded.positions[i];
+    }
+    state->food_count = recorded.food_count;
+    state->game_over  = recorded.game_over;
+    return fread(state->map, 1, header->count, file) == header->count;
+}
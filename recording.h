@@ -0,0 +1,90 @@
+#ifndef __RECORDING__
+#define __RECORDING__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "game.h"
+
+// A recording of a game: every message the game broadcast, in batches
+// stamped with the time they were published at, and a keyframe of the
+// GameState every RECORDING_KEYFRAME_NS. A replay may start from any
+// keyframe instead of the first batch.
+//
+// Everything is written in the byte order of the server, the messages as
+// in version 1 of the protocol:
+//
+//   header   magic "PCMR", u32 version, u32 sizeof(union Message),
+//            u32 sizeof(struct RecordedState)
+//   records  u32 type, u32 count, u64 ns since the recording started,
+//            then 'count' messages (RECORD_MESSAGES) or a RecordedState
+//            followed by its 'count' tiles (RECORD_KEYFRAME)
+#define RECORDING_MAGIC "PCMR"
+#define RECORDING_VERSION 2
+#define RECORDING_KEYFRAME_NS 1000000000ull
+
+enum RecordType {
+    RECORD_MESSAGES = 1,
+    RECORD_KEYFRAME = 2,
+};
+
+struct RecordHeader {
+    uint32_t type;
+    uint32_t count;
+    uint64_t time_ns;
+};
+
+// A GameState as recorded in a keyframe, without its tiles: they follow it,
+// one byte each, row by row.
+struct RecordedState {
+    uint32_t width;
+    uint32_t height;
+    int32_t scores[NB_PLAYERS];
+    int32_t food_count;
+    struct Position positions[NB_PLAYERS];
+    uint32_t game_over;
+};
+
+// Writes the recording of a game. A recorder which is not open (or failed
+// to) silently records nothing.
+struct Recorder {
+    FILE *file;
+    uint64_t start_ns;
+    // When the last keyframe was written, 0 if none was
+    uint64_t keyframe_ns;
+};
+
+// Writes into 'path' (which holds 'len' bytes) the path of the recording
+// of game 'game_id' in 'dir', stamped with the current date.
+void recording_path(char *path, size_t len, const char *dir, uint32_t game_id);
+
+// Starts recording to 'path' (which is truncated). Returns false, after
+// telling why on stderr, if it cannot be created.
+bool recorder_open(struct Recorder *rec, const char *path);
+
+// Records a batch of 'count' messages just published, then a keyframe of
+// 'state' (which they brought the game to) if one is due.
+void recorder_write(struct Recorder *rec, const union Message *msgs, size_t count, const struct GameState *state);
+
+// Ends the recording, with a last keyframe of 'state'.
+void recorder_close(struct Recorder *rec, const struct GameState *state);
+
+// Checks the header of a recording. Returns false, after telling why on
+// stderr, if it was not written by a compatible server.
+bool recording_check(FILE *file);
+
+// Reads the header of the next record. Returns false at the end of the
+// recording.
+bool recording_next(FILE *file, struct RecordHeader *header);
+
+// Size of the payload following a record header.
+size_t recording_payload(const struct RecordHeader *header);
+
+// Reads the payload of a keyframe, whose header was just read, into
+// 'state' (which must have been initialised). Returns false if it is
+// truncated or corrupted.
+bool recording_keyframe(FILE *file, const struct RecordHeader *header, struct GameState *state);
+
+#endif //__RECORDING__
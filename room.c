@@ -0,0 +1,215 @@
+#include "utils_v3.h"
+#include "room.h"
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct Room *room_create(uint32_t id, int timeout) {
+    struct Room *room = smalloc(sizeof(struct Room));
+    memset(room, 0, sizeof(struct Room));
+    room->id    = id;
+    room->phase = ROOM_WAITING;
+    room->task.arg = room;
+    for (int i = 0; i < NB_PLAYERS; i++) {
+        room->players[i] = -1;
+    }
+    init_gamestate(&room->state);
+    arbiter_init(&room->arbiter);
+    histogram_init(&room->latency);
+    outbox_init(&room->out);
+    clock_gettime(CLOCK_MONOTONIC, &room->deadline);
+    room->deadline.tv_sec += timeout;
+    return room;
+}
+
+void room_destroy(struct Room *room) {
+    recorder_close(&room->recorder, &room->state);
+    outbox_free(&room->out);
+    free_gamestate(&room->state);
+    free(room->inbox.cmds);
+    free(room->staged.cmds);
+    free(room->spectators);
+    free(room);
+}
+
+void commands_push(struct CommandList *list, int player, enum Direction dir, uint64_t received_ns) {
+    if (list->len == list->cap) {
+        list->cap  = list->cap == 0 ? 16 : 2 * list->cap;
+        list->cmds = realloc(list->cmds, list->cap * sizeof(struct Command));
+        checkNull(list->cmds, "realloc commands");
+    }
+    list->cmds[list->len].player      = player;
+    list->cmds[list->len].dir         = dir;
+    list->cmds[list->len].received_ns = received_ns;
+    list->len++;
+}
+
+bool room_is_full(const struct Room *room) {
+    return room->player_count == NB_PLAYERS;
+}
+
+int room_add_player(struct Room *room, int slot) {
+    for (int i = 0; i < NB_PLAYERS; i++) {
+        if (room->players[i] == -1) {
+            room->players[i] = slot;
+            room->player_count++;
+            return i;
+        }
+    }
+    return -1;
+}
+
+void room_remove_player(struct Room *room, int player) {
+    if (room->players[player] != -1) {
+        room->players[player] = -1;
+        room->player_count--;
+    }
+}
+
+void room_hold_seat(struct Room *room, int player, int grace) {
+    room->held[player] = true;
+    clock_gettime(CLOCK_MONOTONIC, &room->held_until[player]);
+    room->held_until[player].tv_sec += grace;
+}
+
+void room_resume_seat(struct Room *room, int player, int slot) {
+    room->held[player]    = false;
+    room->players[player] = slot;
+    room->player_count++;
+}
+
+void room_release_seat(struct Room *room, int player) {
+    room->held[player] = false;
+}
+
+bool room_paused(const struct Room *room) {
+    for (int i = 0; i < NB_PLAYERS; i++) {
+        if (room->held[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void room_add_spectator(struct Room *room, int slot) {
+    if (room->spectator_count == room->spectator_cap) {
+        room->spectator_cap = room->spectator_cap == 0 ? 16 : 2 * room->spectator_cap;
+        room->spectators    = realloc(room->spectators, room->spectator_cap * sizeof(int));
+        checkNull(room->spectators, "realloc spectators");
+    }
+    room->spectators[room->spectator_count++] = slot;
+}
+
+void room_remove_spectator(struct Room *room, int slot) {
+    for (size_t i = 0; i < room->spectator_count; i++) {
+        if (room->spectators[i] == slot) {
+            room->spectators[i] = room->spectators[--room->spectator_count];
+            return;
+        }
+    }
+}
+
+void room_start(struct Room *room, const struct PreparedMap *map, int tick_rate) {
+    room->phase       = ROOM_PLAYING;
+    room->map_to_load = map;
+    room->tick_rate   = tick_rate;
+    ticker_init(&room->ticker);
+    if (tick_rate > 0) {
+        tick_clock_start(&room->clock, tick_rate);
+    }
+}
+
+bool room_ticking(const struct Room *room) {
+    return room->tick_rate > 0;
+}
+
+// Remembers that the messages of the outbox answer a command received at
+// 'received_ns'
+static void room_answer(struct Room *room, uint64_t received_ns) {
+    if (room->input_ns == 0 || received_ns < room->input_ns) {
+        room->input_ns = received_ns;
+    }
+}
+
+// Applies the command sent by its player. Returns true if the game is over.
+static bool room_command(struct Room *room, const struct Command *cmd) {
+    if (room->state.game_over) {
+        return true;
+    }
+    size_t before  = room->out.len;
+    uint64_t start = trace_begin();
+    bool over      = process_user_command_to(&room->state, cmd->player == 0 ? PLAYER1 : PLAYER2, cmd->dir, &room->out);
+    trace_end("process_user_command", start);
+    if (room->out.len > before) {
+        room_answer(room, cmd->received_ns);
+    }
+    return over;
+}
+
+// Applies the commands of the inbox in rounds (see arbiter.h): the order in
+// which they arrived only matters between the commands of a same player.
+static void room_apply_inbox(struct Room *room) {
+    uint64_t now = now_ns();
+    // Where to look for the next command of each player
+    size_t next[NB_PLAYERS] = {0};
+    size_t left = room->inbox.len;
+    while (left > 0) {
+        int served = 0;
+        for (int k = 0; k < NB_PLAYERS; k++) {
+            int player = arbiter_player(&room->arbiter, k);
+            while (next[player] < room->inbox.len && room->inbox.cmds[next[player]].player != player) {
+                next[player]++;
+            }
+            if (next[player] == room->inbox.len) {
+                continue;
+            }
+            struct Command *cmd = &room->inbox.cmds[next[player]++];
+            arbiter_record(&room->arbiter, player, cmd->received_ns, now);
+            room_command(room, cmd);
+            served++;
+            left--;
+        }
+        arbiter_next_round(&room->arbiter, served);
+    }
+    room->inbox.len = 0;
+}
+
+void room_step(struct Room *room) {
+    uint64_t start = trace_begin();
+    if (room->map_to_load != NULL) {
+        map_pool_start(room->map_to_load, &room->state, &room->out);
+        room->map_to_load = NULL;
+    }
+    if (!room_ticking(room)) {
+        room_apply_inbox(room);
+        recorder_write(&room->recorder, room->out.msgs, room->out.len, &room->state);
+        trace_end("room_step", start);
+        return;
+    }
+
+    // The ticks answer the oldest command drained, if they move anything
+    uint64_t now   = now_ns();
+    uint64_t input = 0;
+    for (size_t i = 0; i < room->inbox.len; i++) {
+        struct Command *cmd = &room->inbox.cmds[i];
+        arbiter_record(&room->arbiter, cmd->player, cmd->received_ns, now);
+        ticker_input(&room->ticker, cmd->player, cmd->dir);
+        input = input == 0 || cmd->received_ns < input ? cmd->received_ns : input;
+    }
+    room->inbox.len = 0;
+    size_t before = room->out.len;
+    for (; room->ticks_due > 0; room->ticks_due--) {
+        if (!room->state.game_over) {
+            ticker_step(&room->ticker, &room->arbiter, &room->state, &room->out);
+        }
+    }
+    if (room->out.len > before && input != 0) {
+        room_answer(room, input);
+    }
+    recorder_write(&room->recorder, room->out.msgs, room->out.len, &room->state);
+    trace_end("room_step", start);
+}
+
+bool room_game_over(const struct Room *room) {
+    return room->state.game_over || (room->player_count == 0 && !room_paused(room));
+}
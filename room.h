@@ -0,0 +1,175 @@
+#ifndef __ROOM__
+#define __ROOM__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "game.h"
+#include "map_pool.h"
+#include "tick.h"
+#include "arbiter.h"
+#include "histogram.h"
+#include "recording.h"
+#include "worker_pool.h"
+
+// Lifecycle of a room
+enum RoomPhase {
+    ROOM_WAITING,   // The room is waiting for its players
+    ROOM_PLAYING,   // The game is in progress
+    ROOM_CLOSING    // The game is over, the last messages are being flushed
+};
+
+// A direction sent by one of the players of a room
+struct Command {
+    // Index of the player in the room (0 for PLAYER1, 1 for PLAYER2)
+    int player;
+    enum Direction dir;
+    // When it was received (see now_ns)
+    uint64_t received_ns;
+};
+
+// A growable list of commands
+struct CommandList {
+    struct Command *cmds;
+    size_t len;
+    size_t cap;
+};
+
+// A room hosts one game: its players, its own GameState and its own
+// broadcast channel. Rooms never share anything, so a server can host as
+// many of them as it wants.
+//
+// A room knows nothing about sockets: the server which owns it is in charge
+// of feeding its inbox and of delivering what accumulates in 'out' to every
+// player of the room.
+//
+// The game itself is run by room_step, either by the event loop or by a
+// worker of a pool (see worker_pool.h). In the latter case the room is
+// 'away' and the event loop must only touch the fields it owns.
+struct Room {
+    //-------------------------------------------------------------------------
+    // Owned by the event loop
+    //-------------------------------------------------------------------------
+    uint32_t id;
+    enum RoomPhase phase;
+    // Connection slot (server specific) of each player, -1 if there is none
+    int players[NB_PLAYERS];
+    int player_count;
+    // Session token of each player (see RESUME_REQUEST), 0 if it cannot
+    // resume
+    uint64_t tokens[NB_PLAYERS];
+    // Is the seat of a player who lost its connection held for it, and
+    // until when ? The game is paused meanwhile.
+    bool held[NB_PLAYERS];
+    struct timespec held_until[NB_PLAYERS];
+    // When does the room give up waiting for its players ?
+    struct timespec deadline;
+    // Is a worker currently running the room ?
+    bool away;
+    // Is the room waiting for the end of the loop iteration to be run ?
+    bool ready;
+    // Commands received while the room was away
+    struct CommandList staged;
+    // What the pool runs when the room is submitted to it
+    struct PoolTask task;
+    // Ticks per second of the game, 0 if it only moves on commands
+    int tick_rate;
+    // When the next tick of the game is due
+    struct TickClock clock;
+    // From the reception of a command to the moment what it produced left
+    // the sockets of the players
+    struct Histogram latency;
+    // Connection slots (server specific) of the spectators of the game
+    int *spectators;
+    size_t spectator_count;
+    size_t spectator_cap;
+
+    //-------------------------------------------------------------------------
+    // Owned by whoever runs the room
+    //-------------------------------------------------------------------------
+    // The map to start the game on at the next step, NULL if the game
+    // already started
+    const struct PreparedMap *map_to_load;
+    // Commands to apply on the next step, in the order they were received
+    struct CommandList inbox;
+    // Ticks to run on the next step, and where the players are heading
+    unsigned ticks_due;
+    struct Ticker ticker;
+    // Who is served first, and how long the commands of each player wait
+    struct Arbiter arbiter;
+    // The state of the game played in this room
+    struct GameState state;
+    // Messages produced by the game which still have to be broadcast
+    struct Outbox out;
+    // When the oldest command behind the messages of 'out' was received, 0
+    // if they answer no command
+    uint64_t input_ns;
+    // Records what each step produces, if the game is recorded
+    struct Recorder recorder;
+};
+
+// Appends a command to the list.
+void commands_push(struct CommandList *list, int player, enum Direction dir, uint64_t received_ns);
+
+// Allocates an empty room waiting for its players. The registration
+// deadline is set 'timeout' seconds from now.
+struct Room *room_create(uint32_t id, int timeout);
+
+// Frees the room. Its players must have been detached already.
+void room_destroy(struct Room *room);
+
+// Is the room full ?
+bool room_is_full(const struct Room *room);
+
+// Seats a player in the first free slot of the room and returns its index
+// in 'players' (i.e. 0 for PLAYER1, 1 for PLAYER2).
+int room_add_player(struct Room *room, int slot);
+
+// Removes the player from the room.
+void room_remove_player(struct Room *room, int player);
+
+// Holds the seat of a player who lost its connection for 'grace' seconds:
+// the game is paused until it resumes or the seat is released.
+void room_hold_seat(struct Room *room, int player, int grace);
+
+// Gives the held seat of a player back to it, on connection slot 'slot'.
+void room_resume_seat(struct Room *room, int player, int slot);
+
+// Releases the seat of a player who did not come back in time.
+void room_release_seat(struct Room *room, int player);
+
+// Is the game paused, waiting for a player to come back ?
+bool room_paused(const struct Room *room);
+
+// Adds a spectator to the room. Spectators only watch: the server sends
+// them what it sends the players, and ignores whatever they send.
+void room_add_spectator(struct Room *room, int slot);
+
+// Removes the spectator from the room.
+void room_remove_spectator(struct Room *room, int slot);
+
+// Starts the game: the room enters the playing phase and the next step
+// starts the game on 'map', which pushes every message needed to draw it to
+// the room outbox. The registration messages are not part of it as they are
+// specific to each player.
+//
+// If 'tick_rate' is not 0, the game runs at that many ticks per second
+// (see tick.h) instead of moving a player each time it sends a command.
+void room_start(struct Room *room, const struct PreparedMap *map, int tick_rate);
+
+// Is the game played at a fixed timestep ?
+bool room_ticking(const struct Room *room);
+
+// Runs whatever the room has been asked to do since its last step: loading
+// the map and/or applying every command of its inbox, in the order the
+// arbiter of the room decides. A ticking room turns the commands into
+// headings, then runs the ticks which are due. What the step produced is
+// recorded, if the game is.
+void room_step(struct Room *room);
+
+// Is the game over (either because it ended or because nobody plays it
+// anymore, nor may come back) ?
+bool room_game_over(const struct Room *room);
+
+#endif //__ROOM__
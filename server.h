@@ -0,0 +1,134 @@
+#ifndef __SERVER__
+#define __SERVER__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "game.h"
+#include "map_pool.h"
+
+#define BACKLOG 5
+#define REGISTRATION_TIMEOUT 30 // 30 seconds timeout for registration
+#define GAME_OVER_ACK_TIMEOUT 5 // 5 seconds for the clients to acknowledge GAME_OVER
+#define MAX_CLIENTS 2
+#define DEFAULT_MAP_FILE "./resources/map.txt"
+#define DEFAULT_MAX_ROOMS 256
+#define DEFAULT_THREADS 0
+#define DEFAULT_TICK_RATE 0
+#define DEFAULT_RATE_LIMIT 0
+#define DEFAULT_GRACE 0
+#define DEFAULT_WORKERS 0
+// A player who connects while the seat of another is held may be that one
+// coming back: it has this long to say so before it is seated as a new one
+#define RESUME_WINDOW_MS 1000
+// Most processes the epoll server may be run in
+#define MAX_WORKERS 32
+
+// Server phases
+typedef enum {
+    PHASE_IDLE,           // Server is waiting for first player to connect
+    PHASE_REGISTRATION,   // Registration phase (after first player connected)
+    PHASE_GAME            // Game in progress
+} ServerPhase;
+
+// Settings of the server, as given on the command line
+struct ServerConfig {
+    int port;
+    // The maps games are played on, in turn
+    struct MapPool *maps;
+    // Run the single-process epoll server instead of the forked one
+    bool epoll_mode;
+    // How many rooms (i.e. games) the epoll server hosts at most
+    int max_rooms;
+    // Number of worker threads running the games of the epoll server, 0 to
+    // run them on the event loop itself
+    int threads;
+    // Ticks per second of the games, which then run at a fixed timestep
+    // (see tick.h). 0 to move a player each time it sends a command.
+    int tick_rate;
+    // Commands per second a client may send (see rate_limit.h), 0 for no
+    // limit
+    int rate_limit;
+    // Tune the accepted sockets for latency rather than throughput (see
+    // socket_tuning.h)
+    bool low_latency;
+    // Where the metrics are served (see metrics_listen), NULL if they are
+    // not
+    const char *metrics_addr;
+    // Where the trace is dumped on SIGUSR2 (see trace.h), NULL if nothing is
+    // traced
+    const char *trace_path;
+    // Directory every game is recorded in (see recording.h), NULL if they
+    // are not
+    const char *record_dir;
+    // Port the epoll server accepts spectators on, 0 if it does not, and
+    // the socket listening on it
+    int spectator_port;
+    FileDescriptor spectator_fd;
+    // Seconds the epoll server holds the seat of a player who lost its
+    // connection, the game being paused meanwhile. 0 if players may not
+    // resume.
+    int grace;
+    // Number of processes running the epoll server, each with a listening
+    // socket of its own on the same port (SO_REUSEPORT), 0 to run it in the
+    // main process. 'worker' is the index of the current one.
+    int workers;
+    int worker;
+};
+
+// Counters of the path which writes messages to the clients
+struct FlushStats {
+    // Number of times pending messages were flushed to a socket
+    uint64_t flushes;
+    // Number of write syscalls (send, sendmsg...) these flushes took
+    uint64_t syscalls;
+    // Number of bytes written
+    uint64_t bytes;
+};
+
+// Prints the counters, prefixed by 'who'. Defined in pas_server.c.
+void print_flush_stats(const char *who, const struct FlushStats *stats);
+
+// Counters of the commands received from the clients
+struct InputStats {
+    // Commands applied (or handed over to the game)
+    uint64_t accepted;
+    // Commands dropped by the rate limit, a later one being kept instead
+    uint64_t coalesced;
+    // Clients disconnected because they kept flooding the server
+    uint64_t kicked;
+};
+
+// Prints the counters, prefixed by 'who'. Defined in pas_server.c.
+void print_input_stats(const char *who, const struct InputStats *stats);
+
+// Enters a new phase: updates current_phase and the metrics. Defined in
+// pas_server.c.
+void set_phase(ServerPhase phase);
+
+// Winds the server down: it stops right away if idle, once the current
+// phase completes otherwise. 'cause' says why. Defined in pas_server.c.
+void stop_after_phase(const char *cause);
+
+// Reacts to a SIGINT, read from the signalfd every server mode waits on
+// (see event_fds.h): updates the flags below. Defined in pas_server.c.
+void request_shutdown(void);
+
+// Reacts to a SIGHUP by starting a successor (see handover.h), which is
+// handed every listening socket of the server. Returns the descriptor the
+// outcome is read from, -1 if no successor was started. Defined in
+// pas_server.c.
+FileDescriptor start_handover(void);
+
+// Reads the outcome of the hand-over started by start_handover. Once the
+// successor serves, this server stops serving the metrics, the caller
+// winds it down, and it returns true. Defined in pas_server.c.
+bool finish_handover(FileDescriptor fd);
+
+// These flags are defined in pas_server.c and updated by request_shutdown.
+// Every server mode checks them after handling its signals.
+extern bool running;
+extern bool shutdown_requested;
+extern ServerPhase current_phase;
+
+#endif //__SERVER__
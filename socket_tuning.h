@@ -0,0 +1,21 @@
+#ifndef __SOCKET_TUNING__
+#define __SOCKET_TUNING__
+
+#include "game.h"
+
+// Size of the send and receive buffers of a low-latency socket. Messages
+// are tiny: a smaller buffer keeps less of them queued in the kernel when
+// the peer lags, while a whole map still fits in it.
+#define LOW_LATENCY_BUFFER (32 * 1024)
+
+// Switches a TCP socket to low-latency mode: TCP_NODELAY (Nagle's algorithm
+// no longer holds small writes back until the previous ones are
+// acknowledged) and LOW_LATENCY_BUFFER-byte buffers. Call it before connect,
+// or on both the listening socket (before listen) and the accepted ones: the
+// buffer sizes are only taken into account by the TCP handshake if they are
+// set beforehand.
+//
+// A failure is reported on stderr but is not fatal.
+void socket_low_latency(FileDescriptor fd);
+
+#endif //__SOCKET_TUNING__
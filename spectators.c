@@ -0,0 +1,115 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+#include "utils_v3.h"
+#include "spectators.h"
+
+struct SharedBatch *batch_create(const union Message *msgs, size_t count) {
+    size_t len = count * sizeof(union Message);
+    struct SharedBatch *batch = smalloc(sizeof(struct SharedBatch) + len);
+    batch->refs = 1;
+    batch->len  = len;
+    memcpy(batch->data, msgs, len);
+    return batch;
+}
+
+void batch_release(struct SharedBatch *batch) {
+    if (--batch->refs == 0) {
+        free(batch);
+    }
+}
+
+void spectator_queue_init(struct SpectatorQueue *queue) {
+    memset(queue, 0, sizeof(struct SpectatorQueue));
+}
+
+bool spectator_queue_push(struct SpectatorQueue *queue, struct SharedBatch *batch) {
+    if (queue->bytes + batch->len > SPECTATOR_MAX_BACKLOG + queue->snapshot) {
+        return false;
+    }
+    if (queue->len == queue->cap) {
+        // The ring is unrolled into the new array, its head at index 0
+        size_t cap = queue->cap == 0 ? 16 : 2 * queue->cap;
+        struct SharedBatch **batches = smalloc(cap * sizeof(struct SharedBatch *));
+        for (size_t i = 0; i < queue->len; i++) {
+            batches[i] = queue->batches[(queue->head + i) % queue->cap];
+        }
+        free(queue->batches);
+        queue->batches = batches;
+        queue->head    = 0;
+        queue->cap     = cap;
+    }
+    queue->batches[(queue->head + queue->len) % queue->cap] = batch;
+    queue->len++;
+    queue->bytes += batch->len;
+    batch->refs++;
+    return true;
+}
+
+void spectator_queue_start(struct SpectatorQueue *queue, struct SharedBatch *batch) {
+    queue->snapshot += batch->len;
+    spectator_queue_push(queue, batch);
+}
+
+// Forgets the first 'sent' bytes of the queue
+static void spectator_queue_consume(struct SpectatorQueue *queue, size_t sent) {
+    queue->bytes    -= sent;
+    queue->snapshot -= sent < queue->snapshot ? sent : queue->snapshot;
+    while (sent > 0) {
+        struct SharedBatch *first = queue->batches[queue->head];
+        size_t left = first->len - queue->offset;
+        if (sent < left) {
+            queue->offset += sent;
+            return;
+        }
+        sent -= left;
+        queue->offset = 0;
+        queue->head   = (queue->head + 1) % queue->cap;
+        queue->len--;
+        batch_release(first);
+    }
+}
+
+ssize_t spectator_queue_send(struct SpectatorQueue *queue, int fd) {
+    size_t done = 0;
+    while (queue->len > 0) {
+        struct iovec iov[SPECTATOR_IOV];
+        int iovcnt = 0;
+        for (size_t i = 0; i < queue->len && iovcnt < SPECTATOR_IOV; i++) {
+            struct SharedBatch *batch = queue->batches[(queue->head + i) % queue->cap];
+            size_t skip = i == 0 ? queue->offset : 0;
+            iov[iovcnt].iov_base = batch->data + skip;
+            iov[iovcnt].iov_len  = batch->len - skip;
+            iovcnt++;
+        }
+        struct msghdr hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.msg_iov    = iov;
+        hdr.msg_iovlen = iovcnt;
+        ssize_t n = sendmsg(fd, &hdr, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        spectator_queue_consume(queue, n);
+        done += n;
+    }
+    return done;
+}
+
+void spectator_queue_free(struct SpectatorQueue *queue) {
+    while (queue->len > 0) {
+        batch_release(queue->batches[queue->head]);
+        queue->head = (queue->head + 1) % queue->cap;
+        queue->len--;
+    }
+    free(queue->batches);
+    spectator_queue_init(queue);
+}
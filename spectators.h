@@ -0,0 +1,70 @@
+#ifndef __SPECTATORS__
+#define __SPECTATORS__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "game.h"
+
+// Most bytes a spectator may have waiting to be sent. A spectator which lags
+// further behind is dropped: the players never wait for the spectators,
+// and a slow one never makes the server hold the whole game in memory.
+#define SPECTATOR_MAX_BACKLOG (1 << 20)
+
+// Most batches written by a single sendmsg
+#define SPECTATOR_IOV 64
+
+// Messages of a game, copied once and shared by the queues of every
+// spectator watching it, whatever their number. A batch goes away with the
+// last queue which refers to it.
+//
+// Batches are only ever touched by the event loop, hence the plain counter.
+struct SharedBatch {
+    int refs;
+    size_t len;
+    char data[];
+};
+
+// Copies 'count' messages into a new batch, held by the caller.
+struct SharedBatch *batch_create(const union Message *msgs, size_t count);
+
+// Gives up a reference to the batch.
+void batch_release(struct SharedBatch *batch);
+
+// What is still to be sent to a spectator: a ring of references to shared
+// batches, the first of which may have been sent in part.
+struct SpectatorQueue {
+    struct SharedBatch **batches;
+    size_t head;
+    size_t len;
+    size_t cap;
+    // Bytes of the first batch already sent
+    size_t offset;
+    // Bytes still to be sent
+    size_t bytes;
+    // Bytes of the snapshot the spectator joined with still to be sent: a
+    // large map does not count as lagging behind
+    size_t snapshot;
+};
+
+void spectator_queue_init(struct SpectatorQueue *queue);
+
+// Queues a reference to the batch. Returns false, queueing nothing, if the
+// spectator would then lag more than SPECTATOR_MAX_BACKLOG bytes behind.
+bool spectator_queue_push(struct SpectatorQueue *queue, struct SharedBatch *batch);
+
+// Queues a reference to the snapshot of the game the spectator joins,
+// whatever its size: the backlog counts from the end of it.
+void spectator_queue_start(struct SpectatorQueue *queue, struct SharedBatch *batch);
+
+// Writes as much of the queue as 'fd' accepts without blocking, with a
+// single sendmsg per SPECTATOR_IOV batches. Returns the number of bytes
+// written, or -1 if the spectator is gone.
+ssize_t spectator_queue_send(struct SpectatorQueue *queue, int fd);
+
+// Releases every batch still queued.
+void spectator_queue_free(struct SpectatorQueue *queue);
+
+#endif //__SPECTATORS__
@@ -8,7 +8,8 @@
 
 use bracket_lib::terminal::Point;
 
-/// Le joueur qui joue une partie.
+/// Le joueur qui joue une partie (1 ou 2, 0 pour un spectateur). C'est aussi
+/// le composant qui dit quel joueur est un personnage.
 #[derive(Debug, Clone, Copy)]
 pub struct Player(pub u32);
 
@@ -51,10 +52,6 @@ impl Position {
     pub fn into_point(self) -> Point {
         Point::new(self.x, self.y)
     }
-
-    pub fn is_valid(self) -> bool {
-        self.x < 30 && self.y < 20
-    }
 }
 
 /// This are the stuffs on the floor which the hero is trying to eat
@@ -12,14 +12,14 @@ use std::sync::mpsc::Receiver;
 use legion::{world::World, Resources, Schedule};
 use crate::{pascman_protocol::Item, *};
 
-use self::pascman_protocol::MessageType;
+use self::pascman_protocol::{MapSnapshot, MessageType, Packet};
 
 #[derive(Debug, Clone, Copy)]
 pub enum GameStatus {
     NotStarted,
     Registered,
     Running,
-    Over{winner: u32},
+    Over{winner: u32, scores: [u32; 2]},
 }
 
 pub struct State {
@@ -31,7 +31,7 @@ pub struct State {
 }
 
 impl State {
-    pub fn new(channel: std::sync::mpsc::Receiver<pascman_protocol::Message>) -> Self {
+    pub fn new(channel: std::sync::mpsc::Receiver<Packet>) -> Self {
         let ecs = World::default();
         let running = run_game_schedule();
         let over = game_over_schedule();
@@ -40,11 +40,65 @@ impl State {
         resources.insert(rng);
         resources.insert(Player(0));
         resources.insert(GameStatus::NotStarted);
-        resources.insert(Map{width: 30, height: 20, tiles: vec![TileType::Floor;30*20] });
+        resources.insert(Map::new(VIEW_WIDTH, VIEW_HEIGHT));
+        resources.insert(Camera::default());
         resources.insert(channel);
         Self { ecs, resources, running, over, map_file: String::new() }
     }
 
+    fn process_packet(
+            ecs: &mut World, 
+            map: &mut Map, 
+            status: &mut GameStatus, 
+            player: &mut Player,
+            packet: Packet
+    ) {
+        match packet {
+            Packet::Message(msg) => Self::process_message(ecs, map, status, player, msg),
+            Packet::Snapshot(header, tiles) => Self::apply_snapshot(ecs, map, header, &tiles),
+        }
+    }
+
+    /// Introduces all the tiles (and the items they hold) of a map snapshot at once
+    fn apply_snapshot(ecs: &mut World, map: &mut Map, header: MapSnapshot, tiles: &[u8]) {
+        let (width, height) = (header.width as usize, header.height as usize);
+        if map.width != width || map.height != height {
+            *map = Map::new(width, height);
+        }
+        let player1 = 3 * (width * height) as u32;
+        let player2 = player1 + 1;
+
+        for (i, tile) in tiles.iter().take(width * header.rows as usize).enumerate() {
+            let pos = Position { x: i % width, y: header.y as usize + i / width };
+            let idx = pos.y * width + pos.x;
+            if idx >= map.tiles.len() {
+                break;
+            }
+            let id = idx as u32;
+            match *tile {
+                t if t == Item::WALL as u8 => map.tiles[idx] = TileType::Wall,
+                t if t == Item::FLOOR as u8 => map.tiles[idx] = TileType::Floor,
+                t if t == Item::FOOD as u8 => {
+                    map.tiles[idx] = TileType::Floor;
+                    spawn_seed(ecs, id, pos);
+                },
+                t if t == Item::SUPERFOOD as u8 => {
+                    map.tiles[idx] = TileType::Floor;
+                    spawn_superfood(ecs, id, pos);
+                },
+                t if t == Item::PLAYER1 as u8 => {
+                    map.tiles[idx] = TileType::Floor;
+                    spawn_player1(ecs, player1, pos);
+                },
+                t if t == Item::PLAYER2 as u8 => {
+                    map.tiles[idx] = TileType::Floor;
+                    spawn_player2(ecs, player2, pos);
+                },
+                _ => { /* no tile there */ },
+            }
+        }
+    }
+
     fn process_message(
             ecs: &mut World, 
             map: &mut Map, 
@@ -60,26 +114,32 @@ impl State {
                 },
                 MessageType::SPAWN => {
                     let spawn = msg.spawn;
+                    let pos = Position { x: spawn.pos.x as usize, y: spawn.pos.y as usize };
+                    // the size of the map is not known beforehand: it grows
+                    // as its tiles are introduced
+                    if !map.fit(pos.x, pos.y) {
+                        return;
+                    }
                     match spawn.item {
                         Item::FLOOR   => {
-                            let idx = map.point2d_to_index(Point::new(spawn.pos.x, spawn.pos.y));
+                            let idx = map.point2d_to_index(pos.into_point());
                             map.tiles[idx] = TileType::Floor;
                         },
                         Item::WALL    => {
-                            let idx = map.point2d_to_index(Point::new(spawn.pos.x, spawn.pos.y));
+                            let idx = map.point2d_to_index(pos.into_point());
                             map.tiles[idx] = TileType::Wall;
                         },
                         Item::FOOD    => {
-                            spawn_seed(ecs, spawn.id, Position { x: spawn.pos.x as usize, y: spawn.pos.y as usize});
+                            spawn_seed(ecs, spawn.id, pos);
                         },
                         Item::SUPERFOOD => {
-                            spawn_superfood(ecs, spawn.id, Position { x: spawn.pos.x as usize, y: spawn.pos.y as usize});
+                            spawn_superfood(ecs, spawn.id, pos);
                         },
                         Item::PLAYER1   => {
-                            spawn_player1(ecs, spawn.id, Position { x: spawn.pos.x as usize, y: spawn.pos.y as usize});
+                            spawn_player1(ecs, spawn.id, pos);
                         },
                         Item::PLAYER2   => {
-                            spawn_player2(ecs, spawn.id, Position { x: spawn.pos.x as usize, y: spawn.pos.y as usize});
+                            spawn_player2(ecs, spawn.id, pos);
                         },
                     }
                 },
@@ -110,7 +170,14 @@ impl State {
                 },
                 MessageType::GAME_OVER => {
                     let winner = msg.game_over.winner;
-                    *status = GameStatus::Over { winner };
+                    let scores = msg.game_over.scores;
+                    *status = GameStatus::Over { winner, scores };
+                },
+                MessageType::MAP_SNAPSHOT => {
+                    /* the tiles come along with the header, see process_packet */
+                },
+                MessageType::PROTOCOL => {
+                    /* only concerns the connection to the server */
                 }
             }
         }
@@ -139,7 +206,7 @@ impl GameState for State {
         { // fetch messages
             let ecs = &mut self.ecs;
             let resources = &self.resources;
-            let mut rx = resources.get_mut::<Receiver<pascman_protocol::Message>>();
+            let mut rx = resources.get_mut::<Receiver<Packet>>();
             let rx = rx.as_deref_mut().unwrap();
 
             let mut map = resources.get_mut::<Map>();
@@ -151,8 +218,8 @@ impl GameState for State {
             let mut player = resources.get_mut::<Player>();
             let player = player.as_deref_mut().unwrap();
 
-            while let Ok(msg) = rx.try_recv() {
-                Self::process_message(ecs, map, status, player, msg);
+            while let Ok(packet) = rx.try_recv() {
+                Self::process_packet(ecs, map, status, player, packet);
             }
         }
 
@@ -167,7 +234,7 @@ impl GameState for State {
             }
             GameStatus::Running => {
                 self.running.execute(&mut self.ecs, &mut self.resources)},
-            GameStatus::Over { winner: _} => 
+            GameStatus::Over { .. } => 
                 self.over.execute(&mut self.ecs, &mut self.resources),
         }
         // 
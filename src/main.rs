@@ -3,23 +3,38 @@ use std::str::FromStr;
 use std::{io::{stdin, Read}, thread};
 
 use legion::Schedule;
-use pas_cman_ipl::{main_loop, render_map_system, BResult, BTermBuilder, State};
+use pas_cman_ipl::{main_loop, render_map_system, BResult, BTermBuilder, State, VIEW_HEIGHT, VIEW_WIDTH};
+use pas_cman_ipl::pascman_protocol::{snapshot_slots, Message, MessageType, Packet};
 
 fn main() -> BResult<()> {
-    let w = 30;
-    let h = 20;
+    // the map scrolls when it is larger than the screen
+    let w = VIEW_WIDTH;
+    let h = VIEW_HEIGHT;
 
     let resources = env::var("PAS_RESOURCES").unwrap_or(String::from_str("resources/").unwrap());
     let (sx, rx) = std::sync::mpsc::channel();
     let mut state = State::new(rx);
     
     thread::spawn(move || {
-        let mut buffer = [0_u8; std::mem::size_of::<pas_cman_ipl::pascman_protocol::Message>()];
+        let mut buffer = [0_u8; std::mem::size_of::<Message>()];
         while stdin().read_exact(&mut buffer).is_ok() {
-            unsafe {
-                let message = buffer.as_mut_ptr() as *mut pas_cman_ipl::pascman_protocol::Message;
-                sx.send(*message).expect("error sending message on the channel");
-            }
+            // the tiles of a snapshot are raw bytes: they must be read along
+            // with their header, before they are mistaken for messages
+            let msgt = u32::from_ne_bytes([buffer[0], buffer[1], buffer[2], buffer[3]]);
+            let packet = unsafe {
+                let message = *(buffer.as_ptr() as *const Message);
+                if msgt == MessageType::MAP_SNAPSHOT as u32 {
+                    let header = message.snapshot;
+                    let mut tiles = vec![0_u8; snapshot_slots(header.width, header.rows) * buffer.len()];
+                    if stdin().read_exact(&mut tiles).is_err() {
+                        break;
+                    }
+                    Packet::Snapshot(header, tiles)
+                } else {
+                    Packet::Message(message)
+                }
+            };
+            sx.send(packet).expect("error sending message on the channel");
         }
     });
 
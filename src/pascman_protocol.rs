@@ -5,11 +5,16 @@
 //! Date:    March 2023
 //! Licence: MIT 
 
-/// Une map est constituée de 30 x 20 tuiles. Chacunes de ces tuiles peut etre
-/// soit un mur, soit du sol. Il n'est possible de placer de la nourriture que
-/// sur les cases de qui sont du sol. Il n'est aussi possible de se déplacer 
-/// que sur des cases qui sont du sol.
-pub const MAP_SIZE: usize = 30*20; 
+/// Les dimensions d'une map sont celles du fichier dont elle est lue (voir
+/// MapSnapshot), sans dépasser 4096 colonnes et 4096 lignes.
+pub const MAP_MAX_WIDTH: usize = 4096;
+pub const MAP_MAX_HEIGHT: usize = 4096;
+
+/// Une map est constituée de width x height tuiles. Chacunes de ces tuiles
+/// peut etre soit un mur, soit du sol. Il n'est possible de placer de la
+/// nourriture que sur les cases de qui sont du sol. Il n'est aussi possible
+/// de se déplacer que sur des cases qui sont du sol.
+pub const MAP_MAX_SIZE: usize = MAP_MAX_WIDTH * MAP_MAX_HEIGHT;
 
 /// Lorsqu'un utilisateur utilisera les flèches de son clavier au sein de
 /// l'interface graphique, celle-ci écrira une direction (haut, bas, gauche, droite)
@@ -27,7 +32,7 @@ pub enum Direction {
 
 /// Une position représente la position d'un item sur la map. Il s'agit donc 
 /// d'une position qui peut aller de {x: 0, y: 0} (coin supérieur gauche) à
-/// {x: 29, y: 19} (coin inférieur droit).
+/// {x: width-1, y: height-1} (coin inférieur droit).
 #[repr(C)]
 #[derive(Debug, Clone, Copy)]
 pub struct Position {
@@ -64,6 +69,10 @@ pub enum MessageType {
     EAT_FOOD = 3,
     /// To indicate that game is over
     GAME_OVER = 4,
+    /// To introduce a whole map at once
+    MAP_SNAPSHOT = 5,
+    /// To tell which version of the protocol comes next
+    PROTOCOL = 6,
 }
 
 /// Registration est le message qui sert à dire au jeu qu'on est un joueur en particulier.
@@ -73,6 +82,8 @@ pub struct Registration {
     /// Ce messagetype devra toujours avoir la valeur REGISTRATION
     pub msgt: MessageType,
     pub player: u32,
+    /// Les versions du protocole que le serveur sait parler (bit n = version n)
+    pub versions: u32,
 }
 
 /// Spawn est le message qui sert à introduire un item dans le jeu.
@@ -125,6 +136,38 @@ pub struct GameOver {
     /// Ce messagetype devra toujours avoir la valeur GAME_OVER
     pub msgt: MessageType,
     pub winner: u32,
+    /// Le score final de chacun des deux joueurs
+    pub scores: [u32; 2],
+}
+
+/// Introduit d'un coup toutes les tuiles de 'rows' lignes de la carte, à partir
+/// de la ligne 'y'. Ce message est immédiatement suivi de width * rows octets
+/// (un item par tuile, ligne par ligne), complétés par des zéros jusqu'à
+/// occuper `snapshot_slots(width, rows)` messages. Une grande carte est décrite
+/// par plusieurs MapSnapshot successifs, dans l'ordre de leurs lignes.
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+pub struct MapSnapshot {
+    /// Ce messagetype devra toujours avoir la valeur MAP_SNAPSHOT
+    pub msgt: MessageType,
+    /// Les dimensions de la carte complète
+    pub width: u32,
+    pub height: u32,
+    /// La première ligne décrite par ce message
+    pub y: u32,
+    /// Le nombre de lignes décrites par ce message
+    pub rows: u32,
+}
+
+/// Indique que les messages qui suivent sont encodés dans une autre version
+/// du protocole. Il ne concerne que la connexion au serveur: le client ne le
+/// transmet jamais à l'interface, qui parle toujours la version 1.
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+pub struct Protocol {
+    /// Ce messagetype devra toujours avoir la valeur PROTOCOL
+    pub msgt: MessageType,
+    pub version: u32,
 }
 
 #[repr(C)]
@@ -136,4 +179,21 @@ pub union Message {
     pub movement: Movement,
     pub eat_food: EatFood,
     pub game_over: GameOver,
+    pub snapshot: MapSnapshot,
+    pub protocol: Protocol,
+}
+
+/// Le nombre de messages qu'occupent les tuiles qui suivent un MapSnapshot
+/// décrivant 'rows' lignes d'une carte de largeur 'width'.
+pub fn snapshot_slots(width: u32, rows: u32) -> usize {
+    let size = std::mem::size_of::<Message>();
+    (width as usize * rows as usize + size - 1) / size
+}
+
+/// Ce qui est lu sur l'entrée standard: soit un message, soit un MapSnapshot
+/// accompagné des tuiles qui le suivent.
+#[derive(Clone)]
+pub enum Packet {
+    Message(Message),
+    Snapshot(MapSnapshot, Vec<u8>),
 }
\ No newline at end of file
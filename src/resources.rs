@@ -9,7 +9,12 @@ use std::ops::Index;
 
 use bracket_lib::{pathfinding::{Algorithm2D, BaseMap, SmallVec}, terminal::{DistanceAlg, Point}};
 
-use crate::Position;
+use crate::{pascman_protocol::{MAP_MAX_HEIGHT, MAP_MAX_WIDTH}, Position};
+
+/// The number of tiles shown on screen. A larger map scrolls to keep the
+/// player in view (see Camera).
+pub const VIEW_WIDTH: usize = 30;
+pub const VIEW_HEIGHT: usize = 20;
 
 #[derive(Debug, Clone, Copy, PartialEq, Eq)]
 pub enum TileType {
@@ -41,6 +46,28 @@ impl Index<Point> for Map {
 }
 
 impl Map {
+    /// Creates a map of the given dimensions, made of floor only
+    pub fn new(width: usize, height: usize) -> Self {
+        Map { width, height, tiles: vec![TileType::Floor; width * height] }
+    }
+
+    /// Grows the map (with floor) until it holds the position (x,y). Returns
+    /// false if that position is beyond the largest map the server plays.
+    pub fn fit(&mut self, x: usize, y: usize) -> bool {
+        if x >= MAP_MAX_WIDTH || y >= MAP_MAX_HEIGHT {
+            return false;
+        }
+        if x >= self.width || y >= self.height {
+            let mut grown = Map::new(self.width.max(x + 1), self.height.max(y + 1));
+            for row in 0..self.height {
+                let (from, to) = (row * self.width, row * grown.width);
+                grown.tiles[to..to + self.width].copy_from_slice(&self.tiles[from..from + self.width]);
+            }
+            *self = grown;
+        }
+        true
+    }
+
     /// Returns true iff the entity is allowed to move on to the next position (x,y)
     pub fn can_enter(&self, dest: Point) -> bool {
         self.in_bounds(dest) && self[dest] == TileType::Floor
@@ -104,4 +131,31 @@ impl BaseMap for Map {
                 self.index_to_point2d(start), 
                 self.index_to_point2d(end))
     }
-}
\ No newline at end of file
+}
+
+/// The part of the map which is shown on screen: its top left corner, in
+/// tiles. It follows the player when the map is larger than the screen.
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub struct Camera {
+    pub x: usize,
+    pub y: usize,
+}
+
+impl Camera {
+    /// Centers the view on 'pos', without going past the edges of the map
+    pub fn follow(&mut self, map: &Map, pos: Position) {
+        self.x = pos.x.saturating_sub(VIEW_WIDTH / 2).min(map.width.saturating_sub(VIEW_WIDTH));
+        self.y = pos.y.saturating_sub(VIEW_HEIGHT / 2).min(map.height.saturating_sub(VIEW_HEIGHT));
+    }
+
+    /// Returns where 'pos' is drawn on screen, None if it is out of view
+    pub fn project(&self, pos: Position) -> Option<Point> {
+        let x = pos.x.checked_sub(self.x)?;
+        let y = pos.y.checked_sub(self.y)?;
+        if x < VIEW_WIDTH && y < VIEW_HEIGHT {
+            Some(Point::new(x, y))
+        } else {
+            None
+        }
+    }
+}
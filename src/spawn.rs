@@ -10,6 +10,7 @@ static PLAYER_MARKS : [[char; 4]; 2] = [
 pub fn spawn_player1 (ecs : &mut World, id: u32, pos : Position) {
     ecs.push((
         Id(id),
+        Player(1),
         Character(&PLAYER_MARKS[0]),
         Hero,
         pos,
@@ -19,6 +20,7 @@ pub fn spawn_player1 (ecs : &mut World, id: u32, pos : Position) {
 pub fn spawn_player2 (ecs : &mut World, id: u32, pos : Position) {
     ecs.push((
         Id(id),
+        Player(2),
         Character(&PLAYER_MARKS[1]),
         Hero,
         pos,
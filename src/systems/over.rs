@@ -10,7 +10,7 @@ use std::process::exit;
 
 use bracket_lib::prelude::*;
 use legion::{Schedule, system};
-use crate::{proceed_to_restart_system, GameStatus, Map, Player};
+use crate::{proceed_to_restart_system, GameStatus, Player, VIEW_HEIGHT, VIEW_WIDTH};
 
 pub fn game_over_schedule() -> Schedule {
     Schedule::builder()
@@ -22,12 +22,11 @@ pub fn game_over_schedule() -> Schedule {
 
 #[system]
 pub fn render_gameover_screen(
-    #[resource] map: &Map, 
     #[resource] player: &Player,
     #[resource] status: &GameStatus,
     #[resource] key: &Option<VirtualKeyCode>,
 ) {
-    if let &GameStatus::Over { winner } = status {
+    if let &GameStatus::Over { winner, scores } = status {
         if let Some(VirtualKeyCode::Return) = key {
             exit(0);
         }
@@ -38,8 +37,8 @@ pub fn render_gameover_screen(
         batch.target(3);
         batch.set_all_alpha(1.0, 1.0);
 
-        let w = map.width * 2;
-        let h = map.height* 2;
+        let w = VIEW_WIDTH * 2;
+        let h = VIEW_HEIGHT* 2;
         
         batch.draw_box(Rect::with_size(w/4, h/4, w/2, h/2), ColorPair::new(WHITE, BLACK));
 
@@ -49,6 +48,9 @@ pub fn render_gameover_screen(
             batch.print_color_centered(h/2-2, "Too bad, you lost :( ",      ColorPair::new(RED, BLACK));
         }
 
+        let score = format!("Final score: {} - {}", scores[0], scores[1]);
+        batch.print_color_centered(h/2, score, ColorPair::new(WHITE, BLACK));
+
         batch.print_color_centered(h/2 + 2, "Press ENTER to end", ColorPair::new(TAN, BLACK));
 
         batch.submit(5_000).expect("error submitting draw batch");
@@ -14,10 +14,11 @@ use crate::*;
 pub fn run_game_schedule() -> Schedule {
     Schedule::builder()
         .add_system(user_input_system())
-        .add_system(render_map_system())
-        .flush()
         .add_system(move_to_next_place_system())
         .flush()
+        .add_system(follow_player_system())
+        .flush()
+        .add_system(render_map_system())
         .add_system(render_food_system())
         .add_system(render_characters_system())
         .flush()
@@ -47,21 +48,43 @@ pub fn user_input(
     }
 }
 
-/// This system renders the world map
+/// This system scrolls the view so that the player stays on screen
+#[system]
+#[read_component(Player)]
+#[read_component(Position)]
+pub fn follow_player(
+    ecs: &SubWorld,
+    #[resource] map: &Map,
+    #[resource] player: &Player,
+    #[resource] camera: &mut Camera,
+) {
+    // a spectator follows the first player
+    let me = player.0.max(1);
+    let pos = <(&Player, &Position)>::query()
+        .iter(ecs)
+        .find(|(character, _pos)| character.0 == me)
+        .map(|(_character, pos)| *pos);
+
+    if let Some(pos) = pos {
+        camera.follow(map, pos);
+    }
+}
+
+/// This system renders the part of the world map which is in view
 #[system]
-pub fn render_map(#[resource] map: &Map) {
+pub fn render_map(#[resource] map: &Map, #[resource] camera: &Camera) {
     let mut drawbatch = DrawBatch::new();
     drawbatch.target(0);
 
-    for y in 0..map.height {
-        for x in 0..map.width {
+    for y in camera.y..map.height.min(camera.y + VIEW_HEIGHT) {
+        for x in camera.x..map.width.min(camera.x + VIEW_WIDTH) {
             let pos   = Position{x, y};
             let glyph = match map[pos] {
                 TileType::Wall  => to_cp437('0'),
                 TileType::Floor => to_cp437(' '),
             };
             drawbatch.set(
-                Point::new(x,y), 
+                Point::new(x - camera.x, y - camera.y), 
                 ColorPair::new(WHITE, BLACK), 
                 glyph);
         }
@@ -74,16 +97,16 @@ pub fn render_map(#[resource] map: &Map) {
 #[system]
 #[read_component(Food)]
 #[read_component(Position)]
-pub fn render_food(ecs: &SubWorld) {
+pub fn render_food(ecs: &SubWorld, #[resource] camera: &Camera) {
     let mut batch = DrawBatch::new();
     batch.target(1);
 
     <(&Position, &Food)>::query()
         .iter(ecs)
-        .filter(|(pos, _food)| pos.is_valid())
-        .for_each(|(pos, food)| {
+        .filter_map(|(pos, food)| camera.project(*pos).map(|point| (point, food)))
+        .for_each(|(point, food)| {
             batch.set(
-                pos.into_point(),
+                point,
                 ColorPair::new(WHITE, BLACK),
                 to_cp437(food.0),
             );
@@ -96,16 +119,16 @@ pub fn render_food(ecs: &SubWorld) {
 #[read_component(Character)]
 #[read_component(Position)]
 #[read_component(Direction)]
-pub fn render_characters(ecs: &SubWorld) {
+pub fn render_characters(ecs: &SubWorld, #[resource] camera: &Camera) {
     let mut batch = DrawBatch::new();
     batch.target(2);
 
     <(&Position, &Character, &Direction)>::query()
         .iter(ecs)
-        .filter(|(pos, _character, _direction)| pos.is_valid())
-        .for_each(|(pos, character, direction)| {
+        .filter_map(|(pos, character, direction)| camera.project(*pos).map(|point| (point, character, direction)))
+        .for_each(|(point, character, direction)| {
             batch.set(
-                pos.into_point(),
+                point,
                 ColorPair::new(WHITE, BLACK),
                 to_cp437(character.0[*direction as usize]),
             );
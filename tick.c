@@ -0,0 +1,69 @@
+#include "tick.h"
+#include "trace.h"
+
+#define NS_PER_SEC 1000000000L
+
+static void add_ns(struct timespec *ts, long ns) {
+    ts->tv_sec  += ns / NS_PER_SEC;
+    ts->tv_nsec += ns % NS_PER_SEC;
+    if (ts->tv_nsec >= NS_PER_SEC) {
+        ts->tv_sec++;
+        ts->tv_nsec -= NS_PER_SEC;
+    }
+}
+
+void tick_clock_start(struct TickClock *clock, int rate) {
+    clock->period_ns = NS_PER_SEC / rate;
+    clock->ticks     = 0;
+    clock_gettime(CLOCK_MONOTONIC, &clock->next);
+    add_ns(&clock->next, clock->period_ns);
+}
+
+unsigned tick_clock_due(struct TickClock *clock) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long late = (long long) (now.tv_sec - clock->next.tv_sec) * NS_PER_SEC + (now.tv_nsec - clock->next.tv_nsec);
+    if (late < 0) {
+        return 0;
+    }
+
+    unsigned long long due = 1 + late / clock->period_ns;
+    if (due > TICK_MAX_CATCHUP) {
+        due         = TICK_MAX_CATCHUP;
+        clock->next = now;
+        add_ns(&clock->next, clock->period_ns);
+    } else {
+        add_ns(&clock->next, due * clock->period_ns);
+    }
+    clock->ticks += due;
+    return due;
+}
+
+void ticker_init(struct Ticker *ticker) {
+    for (int i = 0; i < NB_PLAYERS; i++) {
+        ticker->moving[i] = false;
+    }
+}
+
+void ticker_input(struct Ticker *ticker, int player, enum Direction dir) {
+    if (!valid_direction(dir)) {
+        return;
+    }
+    ticker->heading[player] = dir;
+    ticker->moving[player]  = true;
+}
+
+bool ticker_step(struct Ticker *ticker, struct Arbiter *arbiter, struct GameState *state, struct Outbox *out) {
+    int served = 0;
+    for (int k = 0; k < NB_PLAYERS && !state->game_over; k++) {
+        int i = arbiter_player(arbiter, k);
+        if (ticker->moving[i]) {
+            uint64_t start = trace_begin();
+            process_user_command_to(state, i == 0 ? PLAYER1 : PLAYER2, ticker->heading[i], out);
+            trace_end("process_user_command", start);
+            served++;
+        }
+    }
+    arbiter_next_round(arbiter, served);
+    return state->game_over;
+}
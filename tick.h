@@ -0,0 +1,51 @@
+#ifndef __TICK__
+#define __TICK__
+
+#include <stdbool.h>
+#include <time.h>
+
+#include "game.h"
+#include "arbiter.h"
+
+// Most ticks run at once by a game which fell behind its clock. Beyond
+// that, the ticks it missed are dropped and the clock starts again from now.
+#define TICK_MAX_CATCHUP 4
+
+// The clock of a game played at a fixed timestep: it tells when the next
+// tick is due and how many of them are due by now.
+struct TickClock {
+    // When the next tick is due (CLOCK_MONOTONIC)
+    struct timespec next;
+    long period_ns;
+    // Number of ticks run so far
+    unsigned long ticks;
+};
+
+// Starts the clock at 'rate' ticks per second. The first tick is due one
+// period from now.
+void tick_clock_start(struct TickClock *clock, int rate);
+
+// Number of ticks due by now, at most TICK_MAX_CATCHUP. The clock moves
+// past them.
+unsigned tick_clock_due(struct TickClock *clock);
+
+// What each player asked for, as seen by the game when it runs at a fixed
+// timestep: a player keeps moving in the last direction it requested,
+// whatever (and however many) commands it sent since the previous tick.
+struct Ticker {
+    enum Direction heading[NB_PLAYERS];
+    // Does the player move at all ? Not before its first command.
+    bool moving[NB_PLAYERS];
+};
+
+void ticker_init(struct Ticker *ticker);
+
+// Records a command of 'player' (0 for PLAYER1, 1 for PLAYER2).
+void ticker_input(struct Ticker *ticker, int player, enum Direction dir);
+
+// Runs one tick: every moving player moves one tile in its heading, in the
+// order 'arbiter' decides, the messages going to 'out'. Returns true if the
+// game is over.
+bool ticker_step(struct Ticker *ticker, struct Arbiter *arbiter, struct GameState *state, struct Outbox *out);
+
+#endif //__TICK__
@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "utils_v3.h"
+#include "histogram.h"
+#include "trace.h"
+
+// Room for the lines of a dump waiting to be written
+#define TRACE_CHUNK 16384
+// Longest line of the file (a span with the longest name)
+#define TRACE_LINE 256
+
+// A span. 'seq' is the index of the span in the ring plus one, once it has
+// been written whole: a dump skips the slots which are being written.
+struct TraceSpan {
+    const char *name;
+    uint64_t start_ns;
+    uint64_t dur_ns;
+    int tid;
+    _Atomic uint64_t seq;
+};
+
+bool trace_enabled = false;
+
+static char trace_path[4096];
+static const char *process_name = "main";
+static struct TraceSpan ring[TRACE_RING_SIZE];
+// Number of spans recorded, and of those already dumped
+static _Atomic uint64_t head;
+static _Atomic uint64_t dumped;
+// Id of the calling thread, 0 until it is known
+static _Thread_local int thread_id;
+
+void trace_init(const char *path) {
+    if (strlen(path) >= sizeof(trace_path)) {
+        fprintf(stderr, "Trace file path too long: %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    strcpy(trace_path, path);
+
+    // The closing bracket is optional in the JSON array format: every
+    // process can keep appending spans
+    int fd = open(trace_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    checkNeg(fd, "trace file");
+    swrite(fd, "[\n", 2);
+    sclose(fd);
+    trace_enabled = true;
+}
+
+void trace_process(const char *name) {
+    process_name = name;
+    thread_id    = 0;
+    atomic_store(&head, 0);
+    atomic_store(&dumped, 0);
+}
+
+uint64_t trace_begin(void) {
+    return trace_enabled ? now_ns() : 0;
+}
+
+void trace_end(const char *name, uint64_t start) {
+    if (!trace_enabled) {
+        return;
+    }
+    if (thread_id == 0) {
+        thread_id = syscall(SYS_gettid);
+    }
+    uint64_t end = now_ns();
+    uint64_t seq = atomic_fetch_add_explicit(&head, 1, memory_order_relaxed);
+    struct TraceSpan *span = &ring[seq % TRACE_RING_SIZE];
+    atomic_store_explicit(&span->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    span->name     = name;
+    span->start_ns = start;
+    span->dur_ns   = end - start;
+    span->tid      = thread_id;
+    atomic_store_explicit(&span->seq, seq + 1, memory_order_release);
+}
+
+//#############################################################################
+// DUMP (async-signal-safe: no stdio, no malloc)
+//#############################################################################
+
+static char *put_str(char *p, const char *s) {
+    while (*s != '\0') {
+        *p++ = *s++;
+    }
+    return p;
+}
+
+static char *put_u64(char *p, uint64_t value) {
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+    while (n > 0) {
+        *p++ = digits[--n];
+    }
+    return p;
+}
+
+// Chrome timestamps are in µs: nanoseconds become their fractional part
+static char *put_us(char *p, uint64_t ns) {
+    p = put_u64(p, ns / 1000);
+    *p++ = '.';
+    *p++ = '0' + ns % 1000 / 100;
+    *p++ = '0' + ns % 100 / 10;
+    *p++ = '0' + ns % 10;
+    return p;
+}
+
+// The names are string literals of the server, which need no escaping
+static char *put_name(char *p, const char *name) {
+    size_t len = strlen(name);
+    if (len > TRACE_LINE / 2) {
+        len = TRACE_LINE / 2;
+    }
+    memcpy(p, name, len);
+    return p + len;
+}
+
+static char *put_span(char *p, int pid, const struct TraceSpan *span) {
+    p = put_str(p, "{\"name\":\"");
+    p = put_name(p, span->name);
+    p = put_str(p, "\",\"ph\":\"X\",\"pid\":");
+    p = put_u64(p, pid);
+    p = put_str(p, ",\"tid\":");
+    p = put_u64(p, span->tid);
+    p = put_str(p, ",\"ts\":");
+    p = put_us(p, span->start_ns);
+    p = put_str(p, ",\"dur\":");
+    p = put_us(p, span->dur_ns);
+    return put_str(p, "},\n");
+}
+
+static char *put_process_name(char *p, int pid) {
+    p = put_str(p, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":");
+    p = put_u64(p, pid);
+    p = put_str(p, ",\"args\":{\"name\":\"");
+    p = put_name(p, process_name);
+    return put_str(p, "\"}},\n");
+}
+
+void trace_dump(void) {
+    if (!trace_enabled) {
+        return;
+    }
+    int saved_errno = errno;
+    int fd = open(trace_path, O_WRONLY | O_APPEND);
+    if (fd < 0) {
+        errno = saved_errno;
+        return;
+    }
+
+    // Each write holds whole lines: the lines of the processes dumping at
+    // the same time never interleave
+    static char chunk[TRACE_CHUNK];
+    int pid = getpid();
+    char *p = put_process_name(chunk, pid);
+    uint64_t end  = atomic_load(&head);
+    uint64_t from = atomic_load(&dumped);
+    if (end - from > TRACE_RING_SIZE) {
+        from = end - TRACE_RING_SIZE;
+    }
+    for (uint64_t seq = from; seq < end; seq++) {
+        const struct TraceSpan *span = &ring[seq % TRACE_RING_SIZE];
+        if (atomic_load_explicit(&span->seq, memory_order_acquire) != seq + 1) {
+            continue;
+        }
+        if (p - chunk > TRACE_CHUNK - TRACE_LINE) {
+            write(fd, chunk, p - chunk);
+            p = chunk;
+        }
+        p = put_span(p, pid, span);
+    }
+    write(fd, chunk, p - chunk);
+    atomic_store(&dumped, end);
+    close(fd);
+    errno = saved_errno;
+}
@@ -0,0 +1,46 @@
+#ifndef __TRACE__
+#define __TRACE__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Number of spans a process keeps (must be a power of two). Older ones are
+// overwritten.
+#define TRACE_RING_SIZE 16384
+
+// Spans of time recorded by every process (and thread) of the server into a
+// ring of its own, dumped on demand into a single file in the Chrome trace
+// event format (which Perfetto reads as well). Every process timestamps its
+// spans with the same monotonic clock (see now_ns), so the game owner, the
+// client handlers and the main process share one timeline.
+//
+// While tracing is disabled, recording a span costs a branch.
+//
+//     uint64_t start = trace_begin();
+//     ...
+//     trace_end("parse_map", start);
+//
+// Span names must be string literals (or live as long as the process).
+
+// Is tracing enabled ? Set by trace_init.
+extern bool trace_enabled;
+
+// Enables tracing to 'path', which is truncated. Must be called by the main
+// process before it forks, the children appending to the same file.
+void trace_init(const char *path);
+
+// Names the calling process on the timeline. Called right after a fork, it
+// also forgets the spans inherited from the parent.
+void trace_process(const char *name);
+
+// When a span starts (0 if tracing is disabled).
+uint64_t trace_begin(void);
+
+// Records the span 'name' from 'start' (as returned by trace_begin) to now.
+void trace_end(const char *name, uint64_t start);
+
+// Appends the spans recorded since the last dump to the file. It only makes
+// async-signal-safe calls, so it can be called by a signal handler.
+void trace_dump(void);
+
+#endif //__TRACE__
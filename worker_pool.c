@@ -0,0 +1,224 @@
+#include "utils_v3.h"
+#include "worker_pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+// The queue of one worker. Its lock is only ever contended by a thief, the
+// submitter or the worker itself, and only for a couple of pointer updates.
+struct Worker {
+    struct WorkerPool *pool;
+    int index;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    struct PoolTask *head;
+    struct PoolTask *tail;
+    // Counters, written by the worker only
+    _Atomic uint64_t executed;
+    _Atomic uint64_t stolen;
+    _Atomic uint64_t busy_ns;
+};
+
+struct WorkerPool {
+    int nb_workers;
+    struct Worker *workers;
+    // Next worker to receive a submitted task
+    unsigned next;
+    // Number of tasks queued and not picked by a worker yet
+    _Atomic int pending;
+    // Idle workers sleep here until some task is submitted
+    pthread_mutex_t park_lock;
+    pthread_cond_t park_cond;
+    _Atomic int idle;
+    _Atomic bool stop;
+    // Completed tasks (a lock-free LIFO) and the eventfd which announces them
+    _Atomic(struct PoolTask *) done;
+    FileDescriptor done_fd;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static void queue_push(struct Worker *worker, struct PoolTask *task) {
+    task->next = NULL;
+    pthread_mutex_lock(&worker->lock);
+    if (worker->tail == NULL) {
+        worker->head = task;
+    } else {
+        worker->tail->next = task;
+    }
+    worker->tail = task;
+    pthread_mutex_unlock(&worker->lock);
+}
+
+static struct PoolTask *queue_pop(struct Worker *worker) {
+    pthread_mutex_lock(&worker->lock);
+    struct PoolTask *task = worker->head;
+    if (task != NULL) {
+        worker->head = task->next;
+        if (worker->head == NULL) {
+            worker->tail = NULL;
+        }
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return task;
+}
+
+// Hands a completed task back to the submitter
+static void complete(struct WorkerPool *pool, struct PoolTask *task) {
+    struct PoolTask *head = atomic_load(&pool->done);
+    do {
+        task->next = head;
+    } while (!atomic_compare_exchange_weak(&pool->done, &head, task));
+
+    uint64_t one = 1;
+    ssize_t r;
+    do {
+        r = write(pool->done_fd, &one, sizeof(one));
+    } while (r < 0 && errno == EINTR);
+}
+
+// Takes a task from the worker's own queue or, failing that, steals one
+// from the other workers (starting with its neighbour).
+static struct PoolTask *next_task(struct Worker *self, bool *stolen) {
+    struct WorkerPool *pool = self->pool;
+    struct PoolTask *task   = queue_pop(self);
+    *stolen = false;
+    for (int i = 1; task == NULL && i < pool->nb_workers; i++) {
+        task    = queue_pop(&pool->workers[(self->index + i) % pool->nb_workers]);
+        *stolen = task != NULL;
+    }
+    if (task != NULL) {
+        atomic_fetch_sub(&pool->pending, 1);
+    }
+    return task;
+}
+
+static void *worker_main(void *arg) {
+    struct Worker *self     = arg;
+    struct WorkerPool *pool = self->pool;
+
+    while (true) {
+        bool stolen;
+        struct PoolTask *task = next_task(self, &stolen);
+        if (task != NULL) {
+            uint64_t start = now_ns();
+            task->run(task);
+            atomic_fetch_add_explicit(&self->busy_ns, now_ns() - start, memory_order_relaxed);
+            atomic_fetch_add_explicit(&self->executed, 1, memory_order_relaxed);
+            if (stolen) {
+                atomic_fetch_add_explicit(&self->stolen, 1, memory_order_relaxed);
+            }
+            complete(pool, task);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->park_lock);
+        atomic_fetch_add(&pool->idle, 1);
+        while (atomic_load(&pool->pending) == 0 && !atomic_load(&pool->stop)) {
+            pthread_cond_wait(&pool->park_cond, &pool->park_lock);
+        }
+        atomic_fetch_sub(&pool->idle, 1);
+        bool stop = atomic_load(&pool->stop) && atomic_load(&pool->pending) == 0;
+        pthread_mutex_unlock(&pool->park_lock);
+        if (stop) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+struct WorkerPool *pool_create(int nb_workers) {
+    struct WorkerPool *pool = smalloc(sizeof(struct WorkerPool));
+    memset(pool, 0, sizeof(struct WorkerPool));
+    pool->nb_workers = nb_workers;
+    pool->workers    = smalloc(nb_workers * sizeof(struct Worker));
+    memset(pool->workers, 0, nb_workers * sizeof(struct Worker));
+    pthread_mutex_init(&pool->park_lock, NULL);
+    pthread_cond_init(&pool->park_cond, NULL);
+    pool->done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    checkNeg(pool->done_fd, "eventfd");
+
+    for (int i = 0; i < nb_workers; i++) {
+        struct Worker *worker = &pool->workers[i];
+        worker->pool  = pool;
+        worker->index = i;
+        pthread_mutex_init(&worker->lock, NULL);
+    }
+    for (int i = 0; i < nb_workers; i++) {
+        int r = pthread_create(&pool->workers[i].thread, NULL, worker_main, &pool->workers[i]);
+        checkCond(r != 0, "pthread_create");
+    }
+    return pool;
+}
+
+int pool_size(const struct WorkerPool *pool) {
+    return pool->nb_workers;
+}
+
+void pool_submit(struct WorkerPool *pool, struct PoolTask *task) {
+    struct Worker *worker = &pool->workers[pool->next++ % pool->nb_workers];
+    queue_push(worker, task);
+    atomic_fetch_add(&pool->pending, 1);
+
+    // Whichever worker is idle will either find the task in its own queue
+    // or steal it from the one it was given to.
+    if (atomic_load(&pool->idle) > 0) {
+        pthread_mutex_lock(&pool->park_lock);
+        pthread_cond_signal(&pool->park_cond);
+        pthread_mutex_unlock(&pool->park_lock);
+    }
+}
+
+FileDescriptor pool_done_fd(const struct WorkerPool *pool) {
+    return pool->done_fd;
+}
+
+struct PoolTask *pool_completed(struct WorkerPool *pool) {
+    uint64_t count;
+    while (read(pool->done_fd, &count, sizeof(count)) < 0 && errno == EINTR) {
+        continue;
+    }
+
+    // The LIFO is reversed to give the tasks back in completion order
+    struct PoolTask *task = atomic_exchange(&pool->done, NULL);
+    struct PoolTask *list = NULL;
+    while (task != NULL) {
+        struct PoolTask *next = task->next;
+        task->next = list;
+        list       = task;
+        task       = next;
+    }
+    return list;
+}
+
+void pool_stats(struct WorkerPool *pool, int worker, struct WorkerStats *stats) {
+    stats->executed = atomic_load_explicit(&pool->workers[worker].executed, memory_order_relaxed);
+    stats->stolen   = atomic_load_explicit(&pool->workers[worker].stolen, memory_order_relaxed);
+    stats->busy_ns  = atomic_load_explicit(&pool->workers[worker].busy_ns, memory_order_relaxed);
+}
+
+void pool_destroy(struct WorkerPool *pool) {
+    pthread_mutex_lock(&pool->park_lock);
+    atomic_store(&pool->stop, true);
+    pthread_cond_broadcast(&pool->park_cond);
+    pthread_mutex_unlock(&pool->park_lock);
+
+    for (int i = 0; i < pool->nb_workers; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+        pthread_mutex_destroy(&pool->workers[i].lock);
+    }
+    pthread_mutex_destroy(&pool->park_lock);
+    pthread_cond_destroy(&pool->park_cond);
+    sclose(pool->done_fd);
+    free(pool->workers);
+    free(pool);
+}
@@ -0,0 +1,59 @@
+#ifndef __WORKER_POOL__
+#define __WORKER_POOL__
+
+#include <stdint.h>
+
+#include "game.h"
+
+// A task is whatever the pool runs. It is meant to be embedded in the
+// object it works on (a room for instance): submitting it hands that object
+// over to one worker, and it comes back to the submitter once completed.
+// The object therefore never needs a lock: it is owned by one thread at a
+// time.
+struct PoolTask {
+    // Function run by a worker
+    void (*run)(struct PoolTask *task);
+    // Whatever 'run' works on
+    void *arg;
+    // Intrusive link, owned by the pool while the task is queued
+    struct PoolTask *next;
+};
+
+// Counters maintained by each worker
+struct WorkerStats {
+    // Number of tasks run by this worker
+    uint64_t executed;
+    // How many of them were taken from the queue of another worker
+    uint64_t stolen;
+    // Time spent running tasks (in nanoseconds)
+    uint64_t busy_ns;
+};
+
+struct WorkerPool;
+
+// Starts 'nb_workers' threads. Each of them has its own queue of tasks;
+// a worker whose queue is empty steals the oldest task queued by another.
+struct WorkerPool *pool_create(int nb_workers);
+
+// Number of workers of the pool.
+int pool_size(const struct WorkerPool *pool);
+
+// Queues the task. From now on, the submitter must not touch the task (nor
+// what it works on) until the pool hands it back through pool_completed.
+void pool_submit(struct WorkerPool *pool, struct PoolTask *task);
+
+// A file descriptor which becomes readable when some tasks have completed.
+FileDescriptor pool_done_fd(const struct WorkerPool *pool);
+
+// Returns the list (linked through 'next', in completion order) of the tasks
+// completed since the last call, NULL if there are none.
+struct PoolTask *pool_completed(struct WorkerPool *pool);
+
+// Copies the counters of the given worker.
+void pool_stats(struct WorkerPool *pool, int worker, struct WorkerStats *stats);
+
+// Runs every queued task, stops the workers and frees the pool. Completed
+// tasks which have not been collected are simply forgotten.
+void pool_destroy(struct WorkerPool *pool);
+
+#endif //__WORKER_POOL__